@@ -78,12 +78,21 @@ have_func 'PQsslAttribute' # since PostgreSQL-9.5
 have_func 'PQresultVerboseErrorMessage' # since PostgreSQL-9.6
 have_func 'PQencryptPasswordConn' # since PostgreSQL-10
 have_func 'PQresultMemorySize' # since PostgreSQL-12
+have_func 'PQenterPipelineMode' # since PostgreSQL-14
 have_func 'timegm'
 have_func 'rb_gc_adjust_memory_usage' # since ruby-2.4
 
 # unistd.h confilicts with ruby/win32.h when cross compiling for win32 and ruby 1.9.1
 have_header 'unistd.h'
 have_header 'inttypes.h'
+have_header 'sys/mman.h'
+have_header 'poll.h'
+have_header 'pthread.h'
+have_func 'writev', 'sys/uio.h'
+have_func 'pwrite', 'unistd.h'
+have_func 'fsync', 'unistd.h'
+have_func 'symlink', 'unistd.h'
+have_func 'mkstemp', 'stdlib.h'
 
 checking_for "C99 variable length arrays" do
 	$defs.push( "-DHAVE_VARIABLE_LENGTH_ARRAYS" ) if try_compile('void test_vla(int l){ int vla[l]; }')
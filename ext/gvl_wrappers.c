@@ -9,6 +9,10 @@
 char *PQencryptPasswordConn(PGconn *conn, const char *passwd, const char *user, const char *algorithm){return NULL;}
 #endif
 
+#ifndef HAVE_PQENTERPIPELINEMODE
+int PQpipelineSync(PGconn *conn){return 0;}
+#endif
+
 FOR_EACH_BLOCKING_FUNCTION( DEFINE_GVL_WRAPPER_STRUCT );
 FOR_EACH_BLOCKING_FUNCTION( DEFINE_GVL_SKELETON );
 FOR_EACH_BLOCKING_FUNCTION( DEFINE_GVL_STUB );
@@ -184,6 +184,8 @@
 	param(const char *, passwd) \
 	param(const char *, user)
 
+#define FOR_EACH_PARAM_OF_PQpipelineSync(param)
+
 #define FOR_EACH_PARAM_OF_PQcancel(param) \
 	param(PGcancel *, cancel) \
 	param(char *, errbuf)
@@ -216,6 +218,7 @@
 	function(PQsetClientEncoding, GVL_TYPE_NONVOID, int, const char *, encoding) \
 	function(PQisBusy, GVL_TYPE_NONVOID, int, PGconn *, conn) \
 	function(PQencryptPasswordConn, GVL_TYPE_NONVOID, char *, const char *, algorithm) \
+	function(PQpipelineSync, GVL_TYPE_NONVOID, int, PGconn *, conn) \
 	function(PQcancel, GVL_TYPE_NONVOID, int, int, errbufsize);
 
 FOR_EACH_BLOCKING_FUNCTION( DEFINE_GVL_STUB_DECL );
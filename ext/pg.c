@@ -448,6 +448,17 @@ Init_pg_ext()
 	/* Transaction's connection is bad ( Connection#transaction_status ) */
 	rb_define_const(rb_mPGconstants, "PQTRANS_UNKNOWN", INT2FIX(PQTRANS_UNKNOWN));
 
+#ifdef HAVE_PQENTERPIPELINEMODE
+	/******     PG::Connection CLASS CONSTANTS: Pipeline Status     ******/
+
+	/* The connection is in pipeline mode ( Connection#pipeline_status ) */
+	rb_define_const(rb_mPGconstants, "PQ_PIPELINE_ON", INT2FIX(PQ_PIPELINE_ON));
+	/* The connection is not in pipeline mode ( Connection#pipeline_status ) */
+	rb_define_const(rb_mPGconstants, "PQ_PIPELINE_OFF", INT2FIX(PQ_PIPELINE_OFF));
+	/* The connection is in pipeline mode and an error occurred while processing the current pipeline ( Connection#pipeline_status ) */
+	rb_define_const(rb_mPGconstants, "PQ_PIPELINE_ABORTED", INT2FIX(PQ_PIPELINE_ABORTED));
+#endif
+
 	/******     PG::Connection CLASS CONSTANTS: Error Verbosity     ******/
 
 	/* Error verbosity level ( Connection#set_error_verbosity ).
@@ -525,6 +536,12 @@ Init_pg_ext()
 	rb_define_const(rb_mPGconstants, "PGRES_COPY_BOTH", INT2FIX(PGRES_COPY_BOTH));
 	/* Result#result_status constant - Single tuple from larger resultset. */
 	rb_define_const(rb_mPGconstants, "PGRES_SINGLE_TUPLE", INT2FIX(PGRES_SINGLE_TUPLE));
+#ifdef HAVE_PQENTERPIPELINEMODE
+	/* Result#result_status constant - End of a pipeline synchronization point. */
+	rb_define_const(rb_mPGconstants, "PGRES_PIPELINE_SYNC", INT2FIX(PGRES_PIPELINE_SYNC));
+	/* Result#result_status constant - Query skipped because of an earlier error in the pipeline. */
+	rb_define_const(rb_mPGconstants, "PGRES_PIPELINE_ABORTED", INT2FIX(PGRES_PIPELINE_ABORTED));
+#endif
 
 	/******     Result CONSTANTS: result error field codes      ******/
 
@@ -673,5 +690,7 @@ Init_pg_ext()
 	init_pg_copycoder();
 	init_pg_recordcoder();
 	init_pg_tuple();
+	init_pg_replication();
+	init_pg_spilled_result();
 }
 
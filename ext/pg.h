@@ -80,6 +80,42 @@ typedef long suseconds_t;
 
 #define PG_ENC_IDX_BITS 28
 
+/* Allocations done by pg_ext on behalf of a connection, see PG::Connection#alloc_stats */
+typedef struct {
+	/* Number of queries sent with query params */
+	size_t queries;
+	/* Number of query params */
+	size_t params;
+	/* Bytes of query params type casted by a coder */
+	size_t param_bytes;
+	/* Bytes allocated per xmalloc for params not fitting into the memory pool on the stack */
+	size_t xmalloc_bytes;
+	/* Number of memory chunks allocated in typecast_heap_chain */
+	size_t typecast_heap_chunks;
+	/* Number of PG::Result objects built */
+	size_t results;
+	/* Approximate memory size of the PGresult objects */
+	size_t result_bytes;
+} t_pg_alloc_stats;
+
+/* Objects created while retrieving values of a result, see PG::Result#decode_stats */
+typedef struct {
+	/* Number of values type casted */
+	size_t values;
+	/* Non-immediate Ruby objects returned by type casts */
+	size_t value_objects;
+	/* Bytes of String objects returned by type casts */
+	size_t string_bytes;
+	/* Field name objects */
+	size_t fnames;
+	/* Hash objects created or dup'ed for tuples */
+	size_t hashes;
+	/* Array objects created for rows and columns */
+	size_t arrays;
+	/* PG::Tuple objects */
+	size_t tuples;
+} t_pg_decode_stats;
+
 /* The data behind each PG::Connection object */
 typedef struct {
 	PGconn *pgconn;
@@ -104,6 +140,17 @@ typedef struct {
 	int enc_idx : PG_ENC_IDX_BITS;
 	/* flags controlling Symbol/String field names */
 	unsigned int flags : 2;
+	/* Set while a helper thread of PG::Result#stream_each uses the PGconn */
+	unsigned int in_read_ahead : 1;
+	/* Pass results exceeding max_result_bytes to the block of the exec methods in chunks */
+	unsigned int chunked_results : 1;
+
+	/* Allocation counters of query params and results */
+	t_pg_alloc_stats alloc_stats;
+	/* Maximum bytes of results received ahead while streaming, 0 = disabled */
+	size_t read_ahead;
+	/* Maximum bytes of a result retrieved by the exec methods, 0 = unlimited */
+	size_t max_result_bytes;
 
 #if defined(_WIN32)
 	/* File descriptor to be used for rb_w32_unwrap_io_handle() */
@@ -154,6 +201,23 @@ typedef struct {
 	/* Hash with fnames[] to field number mapping. */
 	VALUE field_map;
 
+	/* Array of all type casted values row by row, after PG::Result#materialize! .
+	 * pgresult retains the result status and field descriptions only then.
+	 * Set to Qnil if the values are retrieved from pgresult.
+	 */
+	VALUE mat_values;
+
+	/* Number of tuples in mat_values. */
+	int mat_ntuples;
+
+	/* Command status of a result restored by PG::Result.load_binary or accumulated
+	 * per max_result_bytes, since libpq can't set it in a PGresult. Qnil otherwise.
+	 */
+	VALUE cmd_status;
+
+	/* Counters of objects created for value retrieval */
+	t_pg_decode_stats decode_stats;
+
 	/* List of field names as frozen String or Symbol objects.
 	 * Only valid if nfields != -1
 	 */
@@ -236,6 +300,7 @@ extern VALUE rb_eConnectionBad;
 extern VALUE rb_eInvalidResultStatus;
 extern VALUE rb_eNoResultError;
 extern VALUE rb_eInvalidChangeOfResultFields;
+extern VALUE rb_eResultTooLarge;
 extern VALUE rb_mPGconstants;
 extern VALUE rb_cPGconn;
 extern VALUE rb_cPGresult;
@@ -292,6 +357,8 @@ void init_pg_text_decoder                              _(( void ));
 void init_pg_binary_encoder                            _(( void ));
 void init_pg_binary_decoder                            _(( void ));
 void init_pg_tuple                                     _(( void ));
+void init_pg_replication                               _(( void ));
+void init_pg_spilled_result                            _(( void ));
 VALUE lookup_error_class                               _(( const char * ));
 VALUE pg_bin_dec_bytea                                 _(( t_pg_coder*, const char *, int, int, int, int ));
 VALUE pg_text_dec_string                               _(( t_pg_coder*, const char *, int, int, int, int ));
@@ -302,6 +369,7 @@ t_pg_coder_dec_func pg_coder_dec_func                  _(( t_pg_coder*, int ));
 void pg_define_coder                                   _(( const char *, void *, VALUE, VALUE ));
 VALUE pg_obj_to_i                                      _(( VALUE ));
 VALUE pg_tmbc_allocate                                 _(( void ));
+VALUE pg_tmbo_build_type_map_for_oids                  _(( VALUE, int, const Oid *, int ));
 void pg_coder_init_encoder                             _(( VALUE ));
 void pg_coder_init_decoder                             _(( VALUE ));
 char *pg_rb_str_ensure_capa                            _(( VALUE, long, char *, char ** ));
@@ -325,6 +393,8 @@ t_pg_coder *pg_typemap_typecast_query_param            _(( t_typemap *, VALUE, i
 VALUE pg_typemap_typecast_copy_get                     _(( t_typemap *, VALUE, int, int, int ));
 
 PGconn *pg_get_pgconn                                  _(( VALUE ));
+void pgconn_transfer_ubf                               _(( void * ));
+VALUE pgconn_check_ints                                _(( VALUE ));
 t_pg_connection *pg_get_connection                     _(( VALUE ));
 
 VALUE pg_new_result                                    _(( PGresult *, VALUE ));
@@ -332,6 +402,7 @@ VALUE pg_new_result_autoclear                          _(( PGresult *, VALUE ));
 PGresult* pgresult_get                                 _(( VALUE ));
 VALUE pg_result_check                                  _(( VALUE ));
 VALUE pg_result_clear                                  _(( VALUE ));
+VALUE pg_result_copy_tuple                             _(( VALUE, int, VALUE, const VALUE * ));
 VALUE pg_tuple_new                                     _(( VALUE, int ));
 
 /*
@@ -343,6 +414,30 @@ pgresult_get_this( VALUE self )
 	return RTYPEDDATA_DATA(self);
 }
 
+/*
+ * Account a type casted result value in the decode stats of the result
+ */
+static inline VALUE
+pgresult_account_value( t_pg_result *this, VALUE value )
+{
+	this->decode_stats.values++;
+	if( !RB_SPECIAL_CONST_P(value) ){
+		this->decode_stats.value_objects++;
+		if( RB_TYPE_P(value, T_STRING) )
+			this->decode_stats.string_bytes += RSTRING_LEN(value);
+	}
+	return value;
+}
+
+/*
+ * Fetch a value of a result, which was materialized per PG::Result#materialize!
+ */
+static inline VALUE
+pgresult_materialized_value( t_pg_result *this, int tuple, int field )
+{
+	return RARRAY_AREF( this->mat_values, (long)tuple * PQnfields(this->pgresult) + field );
+}
+
 
 rb_encoding * pg_get_pg_encoding_as_rb_encoding        _(( int ));
 rb_encoding * pg_get_pg_encname_as_rb_encoding         _(( const char * ));
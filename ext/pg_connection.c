@@ -6,9 +6,27 @@
 
 #include "pg.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_WRITEV
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 /* Number of bytes that are reserved on the stack for query params. */
 #define QUERYDATA_BUFFER_SIZE 4000
 
+/* Maximum number of bytes passed to PQputCopyData() at once by #copy_from_file */
+#define COPY_FILE_SLICE_SIZE (1024 * 1024)
+/* Maximum number of rows and bytes written at once by #copy_to_io */
+#define COPY_IO_MAX_ROWS 64
+#define COPY_IO_MAX_BYTES (256 * 1024)
+
 
 VALUE rb_cPGconn;
 static ID s_id_encode;
@@ -21,6 +39,9 @@ static PQnoticeProcessor default_notice_processor = NULL;
 static VALUE pgconn_finish( VALUE );
 static VALUE pgconn_set_default_encoding( VALUE self );
 static void pgconn_set_internal_encoding_index( VALUE );
+static VALUE pgconn_get_last_result( VALUE );
+static VALUE pgconn_discard_results( VALUE );
+static VALUE pgconn_async_exec( int, VALUE *, VALUE );
 
 /*
  * Global functions
@@ -50,6 +71,8 @@ pg_get_connection_safe( VALUE self )
 
 	if ( !this->pgconn )
 		rb_raise( rb_eConnectionBad, "connection is closed" );
+	if ( this->in_read_ahead )
+		rb_raise( rb_ePGerror, "connection is in use by the read-ahead of a streamed result" );
 
 	return this;
 }
@@ -69,6 +92,8 @@ pg_get_pgconn( VALUE self )
 
 	if ( !this->pgconn )
 		rb_raise( rb_eConnectionBad, "connection is closed" );
+	if ( this->in_read_ahead )
+		rb_raise( rb_ePGerror, "connection is in use by the read-ahead of a streamed result" );
 
 	return this->pgconn;
 }
@@ -1014,6 +1039,8 @@ struct query_params_data {
 	VALUE params;
 	/* The typemap given from user space */
 	VALUE typemap;
+	/* Allocation counters of the connection */
+	t_pg_alloc_stats *alloc_stats;
 
 	/*
 	 * Filled by alloc_query_params()
@@ -1092,6 +1119,7 @@ alloc_query_params(struct query_params_data *paramsData)
 	t_pg_coder *conv;
 	unsigned int required_pool_size;
 	char *memory_pool;
+	t_pg_alloc_stats *stats = paramsData->alloc_stats;
 
 	Check_Type(paramsData->params, T_ARRAY);
 
@@ -1103,6 +1131,8 @@ alloc_query_params(struct query_params_data *paramsData)
 	paramsData->gc_array = Qnil;
 
 	nParams = (int)RARRAY_LEN(paramsData->params);
+	stats->queries++;
+	stats->params += nParams;
 
 	required_pool_size = nParams * (
 			sizeof(char *) +
@@ -1113,6 +1143,7 @@ alloc_query_params(struct query_params_data *paramsData)
 	if( sizeof(paramsData->memory_pool) < required_pool_size ){
 		/* Allocate one combined memory pool for all possible function parameters */
 		memory_pool = (char*)xmalloc( required_pool_size );
+		stats->xmalloc_bytes += required_pool_size;
 		/* Leave free'ing of the buffer to the GC, when paramsData has left the stack */
 		paramsData->heap_pool = Data_Wrap_Struct( rb_cObject, NULL, -1, memory_pool );
 		required_pool_size = 0;
@@ -1184,12 +1215,17 @@ alloc_query_params(struct query_params_data *paramsData)
 					}
 					paramsData->values[i] = RSTRING_PTR(intermediate);
 					paramsData->lengths[i] = RSTRING_LENINT(intermediate);
+					if( intermediate != param_value )
+						stats->param_bytes += RSTRING_LEN(intermediate);
 
 				} else {
 					/* Is the stack memory pool too small to take the type casted value? */
 					if( sizeof(paramsData->memory_pool) < required_pool_size + len + 1){
 						typecast_buf = alloc_typecast_buf( &paramsData->typecast_heap_chain, len + 1 );
+						stats->typecast_heap_chunks++;
+						stats->xmalloc_bytes += sizeof(struct linked_typecast_data) + len + 1;
 					}
+					stats->param_bytes += len;
 
 					/* 2nd pass for writing the data to prepared buffer */
 					len = enc_func(conv, param_value, typecast_buf, &intermediate, paramsData->enc_idx);
@@ -1259,6 +1295,7 @@ pgconn_exec_params( int argc, VALUE *argv, VALUE self )
 	/* For compatibility we accept 1 to 4 parameters */
 	rb_scan_args(argc, argv, "13", &command, &paramsData.params, &in_res_fmt, &paramsData.typemap);
 	paramsData.with_types = 1;
+	paramsData.alloc_stats = &this->alloc_stats;
 
 	/*
 	 * For backward compatibility no or +nil+ for the second parameter
@@ -1358,6 +1395,7 @@ pgconn_exec_prepared(int argc, VALUE *argv, VALUE self)
 
 	rb_scan_args(argc, argv, "13", &name, &paramsData.params, &in_res_fmt, &paramsData.typemap);
 	paramsData.with_types = 0;
+	paramsData.alloc_stats = &this->alloc_stats;
 
 	if(NIL_P(paramsData.params)) {
 		paramsData.params = rb_ary_new2(0);
@@ -1722,6 +1760,130 @@ pgconn_set_single_row_mode(VALUE self)
 	return self;
 }
 
+#ifdef HAVE_PQENTERPIPELINEMODE
+/*
+ * call-seq:
+ *    conn.pipeline_status -> Integer
+ *
+ * Returns the current pipeline mode status of the libpq connection.
+ *
+ * PQpipelineStatus can return one of the following values:
+ *
+ * * PQ_PIPELINE_ON - The libpq connection is in pipeline mode.
+ * * PQ_PIPELINE_OFF - The libpq connection is not in pipeline mode.
+ * * PQ_PIPELINE_ABORTED - The libpq connection is in pipeline mode and an error
+ *   occurred while processing the current pipeline.
+ *   The aborted flag is cleared when PQgetResult returns a result of type PGRES_PIPELINE_SYNC.
+ *
+ * Available since PostgreSQL-14
+ */
+static VALUE
+pgconn_pipeline_status(VALUE self)
+{
+	return INT2FIX(PQpipelineStatus(pg_get_pgconn(self)));
+}
+
+static void
+pgconn_raise_on_failure(VALUE self, PGconn *conn, int ret)
+{
+	VALUE error;
+
+	if( ret == 0 )
+	{
+		error = rb_exc_new2(rb_ePGerror, PQerrorMessage(conn));
+		rb_iv_set(error, "@connection", self);
+		rb_exc_raise(error);
+	}
+}
+
+/*
+ * call-seq:
+ *    conn.enter_pipeline_mode -> nil
+ *
+ * Causes a connection to enter pipeline mode if it is currently idle or already in pipeline mode.
+ *
+ * Raises PG::Error and has no effect if the connection is not currently idle, i.e., it has a result ready, or it is waiting for more input from the server, etc.
+ * This function does not actually send anything to the server, it just changes the libpq connection state.
+ *
+ * In pipeline mode only the asynchronous functions like #send_query_params and
+ * #send_query_prepared can be used.
+ * The results are retrieved per #get_result , which returns +nil+ after the
+ * results of each query.
+ *
+ * Available since PostgreSQL-14
+ */
+static VALUE
+pgconn_enter_pipeline_mode(VALUE self)
+{
+	PGconn *conn = pg_get_pgconn(self);
+	pgconn_raise_on_failure(self, conn, PQenterPipelineMode(conn));
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.exit_pipeline_mode -> nil
+ *
+ * Causes a connection to exit pipeline mode if it is currently in pipeline mode with an empty queue and no pending results.
+ *
+ * Takes no action if not in pipeline mode.
+ * Raises PG::Error if the current statement isn't finished processing, or PQgetResult has not been called to collect results from all previously sent query.
+ *
+ * Available since PostgreSQL-14
+ */
+static VALUE
+pgconn_exit_pipeline_mode(VALUE self)
+{
+	PGconn *conn = pg_get_pgconn(self);
+	pgconn_raise_on_failure(self, conn, PQexitPipelineMode(conn));
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.pipeline_sync -> nil
+ *
+ * Marks a synchronization point in a pipeline by sending a sync message and flushing the send buffer.
+ * This serves as the delimiter of an implicit transaction and an error recovery point.
+ *
+ * #get_result returns a result with status PGRES_PIPELINE_SYNC , when the server
+ * processed all queries up to the sync point.
+ * If one of them failed, the following queries up to the sync point are skipped
+ * and get a result with status PGRES_PIPELINE_ABORTED .
+ *
+ * Raises PG::Error if the connection is not in pipeline mode or sending a sync message failed.
+ *
+ * Available since PostgreSQL-14
+ */
+static VALUE
+pgconn_pipeline_sync(VALUE self)
+{
+	PGconn *conn = pg_get_pgconn(self);
+	pgconn_raise_on_failure(self, conn, gvl_PQpipelineSync(conn));
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.send_flush_request -> nil
+ *
+ * Sends a request for the server to flush its output buffer.
+ *
+ * The server flushes its output buffer automatically as a result of #pipeline_sync being called, or on any request when not in pipeline mode.
+ * This function is useful to cause the server to flush its output buffer in pipeline mode without establishing a synchronization point.
+ * Note that the request is not itself flushed to the server automatically; use #flush if necessary.
+ *
+ * Available since PostgreSQL-14
+ */
+static VALUE
+pgconn_send_flush_request(VALUE self)
+{
+	PGconn *conn = pg_get_pgconn(self);
+	pgconn_raise_on_failure(self, conn, PQsendFlushRequest(conn));
+	return Qnil;
+}
+#endif
+
 static VALUE pgconn_send_query_params(int argc, VALUE *argv, VALUE self);
 
 /*
@@ -1812,6 +1974,7 @@ pgconn_send_query_params(int argc, VALUE *argv, VALUE self)
 
 	rb_scan_args(argc, argv, "22", &command, &paramsData.params, &in_res_fmt, &paramsData.typemap);
 	paramsData.with_types = 1;
+	paramsData.alloc_stats = &this->alloc_stats;
 
 	pgconn_query_assign_typemap( self, &paramsData );
 	resultFormat = NIL_P(in_res_fmt) ? 0 : NUM2INT(in_res_fmt);
@@ -1938,6 +2101,7 @@ pgconn_send_query_prepared(int argc, VALUE *argv, VALUE self)
 
 	rb_scan_args(argc, argv, "13", &name, &paramsData.params, &in_res_fmt, &paramsData.typemap);
 	paramsData.with_types = 0;
+	paramsData.alloc_stats = &this->alloc_stats;
 
 	if(NIL_P(paramsData.params)) {
 		paramsData.params = rb_ary_new2(0);
@@ -2612,6 +2776,520 @@ pgconn_get_copy_data(int argc, VALUE *argv, VALUE self )
 	return result;
 }
 
+/*
+ * Unblocking function of transfers running without the GVL.
+ * It asks the transfer loop to come back to ruby to process interrupts.
+ */
+void
+pgconn_transfer_ubf( void *flag )
+{
+	*(volatile int *)flag = 1;
+}
+
+VALUE
+pgconn_check_ints( VALUE unused )
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/* State of a COPY FROM STDIN transfer out of a file */
+struct copy_from_file_data {
+	VALUE self;
+	VALUE sql;
+	VALUE path;
+	PGconn *pgconn;
+	int fd;
+	/* The mmap'ed file content or NULL, if the file is read into +buffer+ */
+	char *map;
+	size_t map_size;
+	char *buffer;
+	/* Number of bytes sent to the server */
+	size_t bytes;
+	/* Set by pgconn_transfer_ubf() to interrupt the transfer */
+	volatile int interrupted;
+	/* 0 = OK, -1 = error in libpq, otherwise the errno of a failed read() */
+	int error;
+	int eof;
+};
+
+/* Send the file content to the server. This runs without the GVL. */
+static void *
+copy_from_file_nogvl( void *ptr )
+{
+	struct copy_from_file_data *data = ptr;
+
+	while( !data->eof && !data->interrupted ){
+		const char *slice;
+		ssize_t len;
+
+		if( data->map ){
+			slice = data->map + data->bytes;
+			len = data->map_size - data->bytes;
+			if( len > COPY_FILE_SLICE_SIZE )
+				len = COPY_FILE_SLICE_SIZE;
+		} else {
+			slice = data->buffer;
+			len = read( data->fd, data->buffer, COPY_FILE_SLICE_SIZE );
+			if( len < 0 ){
+				if( errno == EINTR )
+					continue;
+				data->error = errno;
+				break;
+			}
+		}
+
+		if( len == 0 ){
+			data->eof = 1;
+		} else if( PQputCopyData(data->pgconn, slice, (int)len) != 1 ){
+			data->error = -1;
+			break;
+		} else {
+			data->bytes += len;
+		}
+	}
+
+	return NULL;
+}
+
+static VALUE
+copy_from_file_body( VALUE ptr )
+{
+	struct copy_from_file_data *data = (struct copy_from_file_data *)ptr;
+	struct stat st;
+	VALUE res, hash;
+
+	res = pgconn_async_exec( 1, &data->sql, data->self );
+	if( PQresultStatus(pgresult_get(res)) != PGRES_COPY_IN ){
+		pgconn_discard_results( data->self );
+		rb_raise( rb_eArgError, "SQL command is no COPY FROM STDIN statement: %" PRIsVALUE, data->sql );
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	if( fstat(data->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ){
+		void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, data->fd, 0 );
+		if( map != MAP_FAILED ){
+#ifdef MADV_SEQUENTIAL
+			madvise( map, st.st_size, MADV_SEQUENTIAL );
+#endif
+			data->map = map;
+			data->map_size = st.st_size;
+		}
+	}
+#else
+	UNUSED(st);
+#endif
+	if( !data->map )
+		data->buffer = xmalloc( COPY_FILE_SLICE_SIZE );
+
+	for(;;){
+		int state = 0;
+
+		rb_thread_call_without_gvl( copy_from_file_nogvl, data, pgconn_transfer_ubf, (void *)&data->interrupted );
+		if( !data->interrupted )
+			break;
+
+		/* Process pending interrupts and continue the transfer, unless an exception was raised. */
+		data->interrupted = 0;
+		rb_protect( pgconn_check_ints, Qnil, &state );
+		if( state ){
+			gvl_PQputCopyEnd( data->pgconn, "COPY interrupted" );
+			pgconn_discard_results( data->self );
+			rb_jump_tag( state );
+		}
+	}
+
+	if( data->error == -1 ){
+		VALUE error = rb_exc_new2( rb_ePGerror, PQerrorMessage(data->pgconn) );
+		rb_iv_set( error, "@connection", data->self );
+		rb_exc_raise( error );
+	} else if( data->error ){
+		gvl_PQputCopyEnd( data->pgconn, strerror(data->error) );
+		pgconn_discard_results( data->self );
+		rb_syserr_fail_str( data->error, data->path );
+	}
+
+	if( gvl_PQputCopyEnd(data->pgconn, NULL) == -1 ){
+		VALUE error = rb_exc_new2( rb_ePGerror, PQerrorMessage(data->pgconn) );
+		rb_iv_set( error, "@connection", data->self );
+		rb_exc_raise( error );
+	}
+	res = pgconn_get_last_result( data->self );
+
+	hash = rb_hash_new();
+	rb_hash_aset( hash, ID2SYM(rb_intern("bytes")), SIZET2NUM(data->bytes) );
+	rb_hash_aset( hash, ID2SYM(rb_intern("rows")), rb_funcall(res, rb_intern("cmd_tuples"), 0) );
+	return hash;
+}
+
+static VALUE
+copy_from_file_cleanup( VALUE ptr )
+{
+	struct copy_from_file_data *data = (struct copy_from_file_data *)ptr;
+
+#ifdef HAVE_SYS_MMAN_H
+	if( data->map )
+		munmap( data->map, data->map_size );
+#endif
+	xfree( data->buffer );
+	close( data->fd );
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.copy_from_file( sql, path ) -> Hash
+ *
+ * Executes the COPY FROM STDIN statement _sql_ and sends the content of the file at _path_ as copy data.
+ *
+ * The file must already be in the format expected by the COPY statement (text, CSV or binary).
+ * It is transferred without creating Ruby objects for the data: the file is mapped into memory
+ * by mmap() where available, otherwise it is read into one reused buffer.
+ * The GVL is released for the whole transfer, so that other threads can run meanwhile.
+ * The connection must be in blocking mode.
+ *
+ * Returns a Hash with the number of +:bytes+ sent and the number of +:rows+ reported by the server.
+ * Raises PG::Error if the COPY fails and a SystemCallError if the file can not be read.
+ *
+ * Example:
+ *   conn.copy_from_file( "COPY my_table FROM STDIN (FORMAT csv)", "/data/my_table.csv" )
+ *   # => {:bytes=>51234917, :rows=>1000000}
+ *
+ * See also #copy_data for transfers of data generated by Ruby code.
+ */
+static VALUE
+pgconn_copy_from_file( VALUE self, VALUE sql, VALUE path )
+{
+	t_pg_connection *this = pg_get_connection_safe( self );
+	struct copy_from_file_data data;
+
+	FilePathValue( path );
+	if( PQisnonblocking(this->pgconn) )
+		rb_raise( rb_eArgError, "copy_from_file requires a connection in blocking mode" );
+
+	memset( &data, 0, sizeof(data) );
+	data.self = self;
+	data.sql = sql;
+	data.path = path;
+	data.pgconn = this->pgconn;
+	data.fd = rb_cloexec_open( RSTRING_PTR(path), O_RDONLY, 0 );
+	if( data.fd < 0 )
+		rb_sys_fail_str( path );
+
+	return rb_ensure( copy_from_file_body, (VALUE)&data, copy_from_file_cleanup, (VALUE)&data );
+}
+
+/* State of a COPY TO STDOUT transfer into a file descriptor */
+struct copy_to_io_data {
+	VALUE self;
+	VALUE sql;
+	PGconn *pgconn;
+	int fd;
+	/* Rows received but not yet written */
+	char *rows[COPY_IO_MAX_ROWS];
+	int row_lens[COPY_IO_MAX_ROWS];
+	int nrows;
+	/* Number of bytes of the first row already written */
+	int offset;
+	/* Number of bytes written */
+	size_t bytes;
+	/* File status flags to be restored after the transfer */
+	int fd_flags;
+	/* Set by pgconn_transfer_ubf() to interrupt the transfer */
+	volatile int interrupted;
+	/* 0 = OK, -1 = error in libpq, otherwise the errno of a failed write() */
+	int error;
+	int eof;
+};
+
+/*
+ * Wait until the file descriptor is writable or the transfer is interrupted.
+ * Returns 0 or an errno value.
+ */
+static int
+copy_to_io_wait_writable( struct copy_to_io_data *data )
+{
+	while( !data->interrupted ){
+		int ret;
+#ifdef HAVE_POLL_H
+		struct pollfd pfd;
+		pfd.fd = data->fd;
+		pfd.events = POLLOUT;
+		ret = poll( &pfd, 1, 100 );
+#else
+		fd_set wfds;
+		struct timeval timeout = { 0, 100000 };
+		FD_ZERO( &wfds );
+		FD_SET( data->fd, &wfds );
+		ret = select( data->fd + 1, NULL, &wfds, NULL, &timeout );
+#endif
+		if( ret > 0 )
+			break;
+		if( ret < 0 && errno != EINTR )
+			return errno;
+	}
+	return 0;
+}
+
+static void
+copy_to_io_free_rows( struct copy_to_io_data *data )
+{
+	while( data->nrows > 0 )
+		PQfreemem( data->rows[--data->nrows] );
+	data->offset = 0;
+}
+
+/*
+ * Write all received rows to the file descriptor and free them. Returns 0 or an errno value.
+ * The rows not yet written are kept, if the transfer is interrupted.
+ */
+static int
+copy_to_io_flush( struct copy_to_io_data *data )
+{
+	int first = 0;
+	int offset = data->offset;
+	int err = 0;
+
+	while( first < data->nrows ){
+		ssize_t written;
+
+		if( data->interrupted ){
+			data->nrows -= first;
+			memmove( data->rows, data->rows + first, data->nrows * sizeof(*data->rows) );
+			memmove( data->row_lens, data->row_lens + first, data->nrows * sizeof(*data->row_lens) );
+			data->offset = offset;
+			return 0;
+		}
+#ifdef HAVE_WRITEV
+		struct iovec iov[COPY_IO_MAX_ROWS];
+		int i;
+
+		for( i = first; i < data->nrows; i++ ){
+			iov[i - first].iov_base = data->rows[i] + (i == first ? offset : 0);
+			iov[i - first].iov_len = data->row_lens[i] - (i == first ? offset : 0);
+		}
+		written = writev( data->fd, iov, data->nrows - first );
+#else
+		written = write( data->fd, data->rows[first] + offset, data->row_lens[first] - offset );
+#endif
+		if( written < 0 ){
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK ){
+				if( (err = copy_to_io_wait_writable(data)) == 0 )
+					continue;
+			} else {
+				err = errno;
+			}
+			break;
+		}
+
+		data->bytes += written;
+		/* Skip the rows written completely */
+		written += offset;
+		while( first < data->nrows && written >= data->row_lens[first] ){
+			written -= data->row_lens[first];
+			PQfreemem( data->rows[first++] );
+		}
+		offset = (int)written;
+	}
+
+	/* Free the rows not written because of an error */
+	while( first < data->nrows )
+		PQfreemem( data->rows[first++] );
+	data->nrows = 0;
+	data->offset = 0;
+
+	return err;
+}
+
+/* Receive the COPY data and write it to the file descriptor. This runs without the GVL. */
+static void *
+copy_to_io_nogvl( void *ptr )
+{
+	struct copy_to_io_data *data = ptr;
+
+	while( !data->error && !data->interrupted ){
+		int batch_bytes = 0;
+
+		/* Take all rows already received, so that they are batched without delaying them. */
+		while( !data->eof && data->nrows < COPY_IO_MAX_ROWS && batch_bytes < COPY_IO_MAX_BYTES ){
+			char *buffer;
+#ifdef HAVE_POLL_H
+			int ret = PQgetCopyData( data->pgconn, &buffer, 1 );
+#else
+			/* Block for the first row only */
+			int ret = PQgetCopyData( data->pgconn, &buffer, data->nrows > 0 );
+#endif
+
+			if( ret > 0 ){
+				data->rows[data->nrows] = buffer;
+				data->row_lens[data->nrows++] = ret;
+				batch_bytes += ret;
+			} else if( ret == 0 ){
+				/* No complete row received so far */
+				if( data->nrows > 0 || data->interrupted )
+					break;
+#ifdef HAVE_POLL_H
+				/* Wait for more data, but don't block in libpq, so that interrupts can be checked. */
+				{
+					struct pollfd pfd;
+					pfd.fd = PQsocket( data->pgconn );
+					pfd.events = POLLIN;
+					if( poll(&pfd, 1, 100) < 0 && errno != EINTR ){
+						data->error = errno;
+						break;
+					}
+				}
+				if( PQconsumeInput(data->pgconn) == 0 ){
+					data->error = -1;
+					break;
+				}
+#endif
+			} else {
+				if( ret == -1 )
+					data->eof = 1;
+				else
+					data->error = -1;
+				break;
+			}
+		}
+
+		if( data->nrows > 0 ){
+			int err = copy_to_io_flush( data );
+			if( err )
+				data->error = err;
+		} else if( data->eof ){
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Stop the running COPY TO STDOUT and skip the data still to be received. */
+static void
+copy_to_io_abort( struct copy_to_io_data *data )
+{
+	char *buffer;
+
+	copy_to_io_free_rows( data );
+	rb_funcall( data->self, rb_intern("cancel"), 0 );
+	while( gvl_PQgetCopyData(data->pgconn, &buffer, 0) > 0 )
+		PQfreemem( buffer );
+	pgconn_discard_results( data->self );
+}
+
+static VALUE
+copy_to_io_body( VALUE ptr )
+{
+	struct copy_to_io_data *data = (struct copy_to_io_data *)ptr;
+	VALUE res, hash;
+
+	res = pgconn_async_exec( 1, &data->sql, data->self );
+	if( PQresultStatus(pgresult_get(res)) != PGRES_COPY_OUT ){
+		pgconn_discard_results( data->self );
+		rb_raise( rb_eArgError, "SQL command is no COPY TO STDOUT statement: %" PRIsVALUE, data->sql );
+	}
+
+	for(;;){
+		int state = 0;
+
+		rb_thread_call_without_gvl( copy_to_io_nogvl, data, pgconn_transfer_ubf, (void *)&data->interrupted );
+		if( !data->interrupted )
+			break;
+
+		/* Process pending interrupts and continue the transfer, unless an exception was raised. */
+		data->interrupted = 0;
+		rb_protect( pgconn_check_ints, Qnil, &state );
+		if( state ){
+			copy_to_io_abort( data );
+			rb_jump_tag( state );
+		}
+	}
+
+	if( data->error == -1 ){
+		VALUE error;
+		copy_to_io_free_rows( data );
+		error = rb_exc_new2( rb_ePGerror, PQerrorMessage(data->pgconn) );
+		rb_iv_set( error, "@connection", data->self );
+		rb_exc_raise( error );
+	} else if( data->error ){
+		copy_to_io_abort( data );
+		rb_syserr_fail( data->error, "write to COPY destination" );
+	}
+
+	res = pgconn_get_last_result( data->self );
+
+	hash = rb_hash_new();
+	rb_hash_aset( hash, ID2SYM(rb_intern("bytes")), SIZET2NUM(data->bytes) );
+	rb_hash_aset( hash, ID2SYM(rb_intern("rows")), rb_funcall(res, rb_intern("cmd_tuples"), 0) );
+	return hash;
+}
+
+#if defined(O_NONBLOCK) && defined(F_SETFL)
+static VALUE
+copy_to_io_restore_flags( VALUE ptr )
+{
+	struct copy_to_io_data *data = (struct copy_to_io_data *)ptr;
+	fcntl( data->fd, F_SETFL, data->fd_flags );
+	return Qnil;
+}
+#endif
+
+/*
+ * call-seq:
+ *    conn.copy_to_io( sql, io ) -> Hash
+ *
+ * Executes the COPY TO STDOUT statement _sql_ and writes the received copy data to _io_.
+ *
+ * _io_ can be an IO object or an Integer file descriptor.
+ * The data is written to the file descriptor directly as received from libpq, without
+ * creating any Ruby objects. Rows are batched into one writev() call where available.
+ * The GVL is released for the whole transfer, so that other threads can run meanwhile.
+ * Any data buffered in _io_ is flushed before the transfer.
+ * The file descriptor is switched to non-blocking mode during the transfer, so that a
+ * stalled reader of a pipe or socket doesn't prevent the interruption of the thread.
+ *
+ * Returns a Hash with the number of +:bytes+ written and the number of +:rows+ reported by the server.
+ * Raises PG::Error if the COPY fails and a SystemCallError if writing fails.
+ *
+ * Example:
+ *   File.open( "/backup/my_table.csv", "wb" ) do |file|
+ *     conn.copy_to_io( "COPY my_table TO STDOUT (FORMAT csv)", file )
+ *   end
+ *   # => {:bytes=>51234917, :rows=>1000000}
+ *
+ * See also #copy_data for processing of the data in Ruby.
+ */
+static VALUE
+pgconn_copy_to_io( VALUE self, VALUE sql, VALUE io )
+{
+	t_pg_connection *this = pg_get_connection_safe( self );
+	struct copy_to_io_data data;
+
+	memset( &data, 0, sizeof(data) );
+	data.self = self;
+	data.sql = sql;
+	data.pgconn = this->pgconn;
+	if( RB_INTEGER_TYPE_P(io) ){
+		data.fd = NUM2INT( io );
+	} else {
+		io = rb_io_get_io( io );
+		rb_io_flush( io );
+		data.fd = NUM2INT( rb_funcall(io, rb_intern("fileno"), 0) );
+	}
+
+#if defined(O_NONBLOCK) && defined(F_SETFL)
+	/* A blocking write() couldn't be interrupted by pgconn_transfer_ubf(). */
+	data.fd_flags = fcntl( data.fd, F_GETFL );
+	if( data.fd_flags >= 0 && !(data.fd_flags & O_NONBLOCK) &&
+			fcntl(data.fd, F_SETFL, data.fd_flags | O_NONBLOCK) == 0 )
+		return rb_ensure( copy_to_io_body, (VALUE)&data, copy_to_io_restore_flags, (VALUE)&data );
+#endif
+	return copy_to_io_body( (VALUE)&data );
+}
+
 /*
  * call-seq:
  *    conn.set_error_verbosity( verbosity ) -> Integer
@@ -3076,7 +3754,7 @@ pgconn_get_last_result(VALUE self)
 		prev = cur;
 
 		status = PQresultStatus(cur);
-		if (status == PGRES_COPY_OUT || status == PGRES_COPY_IN)
+		if (status == PGRES_COPY_OUT || status == PGRES_COPY_IN || status == PGRES_COPY_BOTH)
 			break;
 	}
 
@@ -3118,6 +3796,211 @@ pgconn_discard_results(VALUE self)
 	return Qnil;
 }
 
+/* State of the retrieval of a result limited by max_result_bytes */
+struct bounded_result {
+	VALUE self;
+	PGconn *pgconn;
+	size_t max_bytes;
+	int chunked;
+	/* Rows of the current statement received so far */
+	PGresult *rows;
+	size_t bytes;
+	/* The last completed result */
+	PGresult *last;
+	/* The final result of the statement, if last holds its accumulated rows */
+	PGresult *last_status;
+	int finished;
+};
+
+/* Build an empty result with the fields of a single row result. */
+static PGresult *
+pgconn_make_rows_result( PGconn *conn, const PGresult *row )
+{
+	int i, nfields = PQnfields( row );
+	PGresult *res = PQmakeEmptyPGresult( conn, PGRES_TUPLES_OK );
+	PG_VARIABLE_LENGTH_ARRAY(PGresAttDesc, attrs, nfields, PG_MAX_COLUMNS)
+
+	if( !res ) return NULL;
+	for( i = 0; i < nfields; i++ ){
+		attrs[i].name = PQfname( row, i );
+		attrs[i].tableid = PQftable( row, i );
+		attrs[i].columnid = PQftablecol( row, i );
+		attrs[i].format = PQfformat( row, i );
+		attrs[i].typid = PQftype( row, i );
+		attrs[i].typlen = PQfsize( row, i );
+		attrs[i].atttypmod = PQfmod( row, i );
+	}
+	if( nfields > 0 && !PQsetResultAttrs(res, nfields, attrs) ){
+		PQclear( res );
+		return NULL;
+	}
+	return res;
+}
+
+/* Append row _src_row_ of _src_ to _dest_ and add its approximate memory size to _bytes_ . */
+static int
+pgconn_append_row( PGresult *dest, const PGresult *src, int src_row, size_t *bytes )
+{
+	int j, nfields = PQnfields( src );
+	int row = PQntuples( dest );
+
+	for( j = 0; j < nfields; j++ ){
+		int ok;
+		if( PQgetisnull(src, src_row, j) ){
+			ok = PQsetvalue( dest, row, j, NULL, -1 );
+		} else {
+			int len = PQgetlength( src, src_row, j );
+			ok = PQsetvalue( dest, row, j, PQgetvalue(src, src_row, j), len );
+			*bytes += len + 1;
+		}
+		if( !ok ) return 0;
+	}
+	/* Each value has a length and a pointer and each row a pointer. */
+	*bytes += nfields * (sizeof(int) + sizeof(char *)) + sizeof(void *);
+	return 1;
+}
+
+static VALUE
+pgconn_bounded_result_body( VALUE ptr )
+{
+	struct bounded_result *br = (struct bounded_result *)ptr;
+	PGresult *cur;
+	VALUE rb_pgresult;
+
+	while( (cur = gvl_PQgetResult(br->pgconn)) != NULL ){
+		ExecStatusType status = PQresultStatus( cur );
+		int ok;
+
+		if( status == PGRES_SINGLE_TUPLE ){
+			if( !br->rows )
+				br->rows = pgconn_make_rows_result( br->pgconn, cur );
+			ok = br->rows && pgconn_append_row( br->rows, cur, 0, &br->bytes );
+			PQclear( cur );
+			if( !ok )
+				rb_raise( rb_eNoMemError, "out of memory while accumulating result rows" );
+
+			if( br->bytes > br->max_bytes ){
+				VALUE chunk;
+
+				if( !br->chunked || !rb_block_given_p() )
+					rb_raise( rb_eResultTooLarge, "result exceeds max_result_bytes of %" PRIuSIZE " bytes", br->max_bytes );
+
+				/* Pass the rows received so far to the block and continue with the next chunk. */
+				chunk = pg_new_result( br->rows, br->self );
+				br->rows = NULL;
+				br->bytes = 0;
+				rb_ensure( rb_yield, chunk, pg_result_clear, chunk );
+			}
+			continue;
+		}
+
+		/* A statement is complete. */
+		if( br->last ){
+			PQclear( br->last );
+			br->last = NULL;
+		}
+		if( br->last_status ){
+			PQclear( br->last_status );
+			br->last_status = NULL;
+		}
+		if( status == PGRES_TUPLES_OK && br->rows ){
+			/* The final result carries the command status only. Keep it beside the
+			 * accumulated rows instead of copying them, which would double the memory. */
+			br->last = br->rows;
+			br->last_status = cur;
+		} else {
+			if( br->rows ) PQclear( br->rows );
+			br->last = cur;
+		}
+		br->rows = NULL;
+		br->bytes = 0;
+
+		if( status == PGRES_COPY_OUT || status == PGRES_COPY_IN || status == PGRES_COPY_BOTH )
+			break;
+	}
+	br->finished = 1;
+
+	if( !br->last )
+		return Qnil;
+	rb_pgresult = pg_new_result( br->last, br->self );
+	br->last = NULL;
+	if( br->last_status ){
+		t_pg_result *res = pgresult_get_this( rb_pgresult );
+		res->cmd_status = rb_str_new2( PQcmdStatus(br->last_status) );
+		PG_ENCODING_SET_NOCHECK( res->cmd_status, res->enc_idx );
+		rb_obj_freeze( res->cmd_status );
+		PQclear( br->last_status );
+		br->last_status = NULL;
+	}
+	pg_result_check( rb_pgresult );
+	return rb_pgresult;
+}
+
+static VALUE
+pgconn_bounded_result_cleanup( VALUE ptr )
+{
+	struct bounded_result *br = (struct bounded_result *)ptr;
+
+	if( br->rows ) PQclear( br->rows );
+	if( br->last ) PQclear( br->last );
+	if( br->last_status ) PQclear( br->last_status );
+	if( !br->finished ){
+		/* Don't receive the rest of a too large result. */
+		pgconn_cancel( br->self );
+		pgconn_discard_results( br->self );
+	}
+	return Qnil;
+}
+
+/*
+ * Retrieve the result of the query sent by an exec method.
+ *
+ * If the query was sent in single row mode because of max_result_bytes, the rows are
+ * accumulated into one result until the limit is exceeded. Then the rows received so far
+ * are yielded, if a block is given and #chunked_results is enabled, or PG::ResultTooLarge
+ * is raised.
+ * The block is called with the last result, too.
+ */
+static VALUE
+pgconn_async_exec_result( VALUE self, size_t max_result_bytes )
+{
+	t_pg_connection *this = pg_get_connection( self );
+	VALUE rb_pgresult;
+
+	pgconn_block( 0, NULL, self ); /* wait for input (without blocking) before reading the last result */
+	if( max_result_bytes > 0 ){
+		struct bounded_result br;
+
+		memset( &br, 0, sizeof(br) );
+		br.self = self;
+		br.pgconn = pg_get_pgconn( self );
+		br.max_bytes = max_result_bytes;
+		br.chunked = this->chunked_results;
+		rb_pgresult = rb_ensure( pgconn_bounded_result_body, (VALUE)&br, pgconn_bounded_result_cleanup, (VALUE)&br );
+	} else {
+		rb_pgresult = pgconn_get_last_result( self );
+	}
+
+	if ( rb_block_given_p() ) {
+		return rb_ensure( rb_yield, rb_pgresult, pg_result_clear, rb_pgresult );
+	}
+	return rb_pgresult;
+}
+
+/*
+ * Enable single row mode for the query just sent, if the result size is limited.
+ * Returns the limit.
+ */
+static size_t
+pgconn_apply_result_budget( VALUE self )
+{
+	t_pg_connection *this = pg_get_connection_safe( self );
+
+	if( this->max_result_bytes > 0 && PQsetSingleRowMode(this->pgconn) )
+		return this->max_result_bytes;
+	return 0;
+}
+
 /*
  * call-seq:
  *    conn.exec(sql) -> PG::Result
@@ -3134,6 +4017,8 @@ pgconn_discard_results(VALUE self)
  * If the optional code block is given, it will be passed <i>result</i> as an argument,
  * and the PG::Result object will  automatically be cleared when the block terminates.
  * In this instance, <code>conn.exec</code> returns the value of the block.
+ * If #max_result_bytes and #chunked_results are set, large results are passed to the block
+ * in several chunks.
  *
  * #exec is an alias for #async_exec which is almost identical to #sync_exec .
  * #sync_exec is implemented on the simpler synchronous command processing API of libpq, whereas
@@ -3148,17 +4033,9 @@ pgconn_discard_results(VALUE self)
 static VALUE
 pgconn_async_exec(int argc, VALUE *argv, VALUE self)
 {
-	VALUE rb_pgresult = Qnil;
-
 	pgconn_discard_results( self );
 	pgconn_send_query( argc, argv, self );
-	pgconn_block( 0, NULL, self ); /* wait for input (without blocking) before reading the last result */
-	rb_pgresult = pgconn_get_last_result( self );
-
-	if ( rb_block_given_p() ) {
-		return rb_ensure( rb_yield, rb_pgresult, pg_result_clear, rb_pgresult );
-	}
-	return rb_pgresult;
+	return pgconn_async_exec_result( self, pgconn_apply_result_budget(self) );
 }
 
 
@@ -3215,8 +4092,6 @@ pgconn_async_exec(int argc, VALUE *argv, VALUE self)
 static VALUE
 pgconn_async_exec_params(int argc, VALUE *argv, VALUE self)
 {
-	VALUE rb_pgresult = Qnil;
-
 	pgconn_discard_results( self );
 	/* If called with no or nil parameters, use PQsendQuery for compatibility */
 	if ( argc == 1 || (argc >= 2 && argc <= 4 && NIL_P(argv[1]) )) {
@@ -3225,13 +4100,7 @@ pgconn_async_exec_params(int argc, VALUE *argv, VALUE self)
 	} else {
 		pgconn_send_query_params( argc, argv, self );
 	}
-	pgconn_block( 0, NULL, self ); /* wait for input (without blocking) before reading the last result */
-	rb_pgresult = pgconn_get_last_result( self );
-
-	if ( rb_block_given_p() ) {
-		return rb_ensure( rb_yield, rb_pgresult, pg_result_clear, rb_pgresult );
-	}
-	return rb_pgresult;
+	return pgconn_async_exec_result( self, pgconn_apply_result_budget(self) );
 }
 
 
@@ -3314,17 +4183,9 @@ pgconn_async_prepare(int argc, VALUE *argv, VALUE self)
 static VALUE
 pgconn_async_exec_prepared(int argc, VALUE *argv, VALUE self)
 {
-	VALUE rb_pgresult = Qnil;
-
 	pgconn_discard_results( self );
 	pgconn_send_query_prepared( argc, argv, self );
-	pgconn_block( 0, NULL, self ); /* wait for input (without blocking) before reading the last result */
-	rb_pgresult = pgconn_get_last_result( self );
-
-	if ( rb_block_given_p() ) {
-		return rb_ensure( rb_yield, rb_pgresult, pg_result_clear, rb_pgresult );
-	}
-	return rb_pgresult;
+	return pgconn_async_exec_result( self, pgconn_apply_result_budget(self) );
 }
 
 
@@ -3623,32 +4484,65 @@ static VALUE
 pgconn_loread(VALUE self, VALUE in_lo_desc, VALUE in_len)
 {
 	int ret;
-  PGconn *conn = pg_get_pgconn(self);
+	PGconn *conn = pg_get_pgconn(self);
 	int len = NUM2INT(in_len);
 	int lo_desc = NUM2INT(in_lo_desc);
 	VALUE str;
-	char *buffer;
-
-  buffer = ALLOC_N(char, len);
-	if(buffer == NULL)
-		rb_raise(rb_eNoMemError, "ALLOC failed!");
 
 	if (len < 0){
 		rb_raise(rb_ePGerror,"nagative length %d given", len);
 	}
 
-	if((ret = lo_read(conn, lo_desc, buffer, len)) < 0)
+	/* Read directly into the memory of the String object */
+	str = rb_str_new(NULL, len);
+	if((ret = lo_read(conn, lo_desc, RSTRING_PTR(str), len)) < 0)
 		rb_raise(rb_ePGerror, "lo_read failed");
 
-	if(ret == 0) {
-		xfree(buffer);
+	if(ret == 0)
 		return Qnil;
+
+	rb_str_set_len(str, ret);
+	return str;
+}
+
+/*
+ * call-seq:
+ *    conn.lo_read_into( lo_desc, len, buffer ) -> String
+ *
+ * Attempts to read _len_ bytes from large object _lo_desc_ into the String _buffer_.
+ *
+ * The previous content of _buffer_ is replaced by the data read and its encoding is set to BINARY.
+ * Returns _buffer_ or +nil+ at the end of the large object.
+ * Reusing the same _buffer_ for several calls avoids the allocation of a String object per chunk.
+ *
+ *   buffer = String.new
+ *   while conn.lo_read_into( lo_desc, 65536, buffer )
+ *     io.write buffer
+ *   end
+ */
+static VALUE
+pgconn_loread_into(VALUE self, VALUE in_lo_desc, VALUE in_len, VALUE buffer)
+{
+	int ret;
+	PGconn *conn = pg_get_pgconn(self);
+	int len = NUM2INT(in_len);
+	int lo_desc = NUM2INT(in_lo_desc);
+
+	Check_Type(buffer, T_STRING);
+	if (len < 0){
+		rb_raise(rb_ePGerror,"nagative length %d given", len);
 	}
 
-	str = rb_str_new(buffer, ret);
-	xfree(buffer);
+	rb_str_resize(buffer, len);
+	rb_enc_associate_index(buffer, rb_ascii8bit_encindex());
 
-	return str;
+	if((ret = lo_read(conn, lo_desc, RSTRING_PTR(buffer), len)) < 0){
+		rb_str_set_len(buffer, 0);
+		rb_raise(rb_ePGerror, "lo_read failed: %s", PQerrorMessage(conn));
+	}
+
+	rb_str_set_len(buffer, ret);
+	return ret == 0 ? Qnil : buffer;
 }
 
 
@@ -4134,6 +5028,199 @@ pgconn_field_name_type_get(VALUE self)
 }
 
 
+/*
+ * call-seq:
+ *    conn.read_ahead = Integer
+ *
+ * Enable read-ahead of rows while streaming results in single row mode.
+ *
+ * If set to a value greater than 0, PG::Result#stream_each , #stream_each_row and
+ * #stream_each_tuple start a native helper thread, which receives and parses the
+ * following rows while the current rows are type casted and yielded.
+ * Network transfer and type casting then overlap, so that the throughput is limited by
+ * the slower of both instead of their sum.
+ * The value is the maximum memory size in bytes of the rows received ahead.
+ * Until the stream is finished, methods using the connection raise a PG::Error .
+ *
+ * The default is +0+ (disabled). Read-ahead is not used on platforms without pthreads
+ * and poll() and if a notice receiver or processor is set.
+ *
+ * Example:
+ *   conn.read_ahead = 4 * 1024 * 1024
+ *   conn.send_query( "SELECT * FROM large_table" )
+ *   conn.set_single_row_mode
+ *   conn.get_result.stream_each_row do |row|
+ *     # ...
+ *   end
+ */
+static VALUE
+pgconn_read_ahead_set(VALUE self, VALUE size)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	long bytes = NUM2LONG( size );
+
+	if( bytes < 0 )
+		rb_raise( rb_eArgError, "read-ahead size must not be negative" );
+	this->read_ahead = (size_t)bytes;
+	return size;
+}
+
+/*
+ * call-seq:
+ *    conn.read_ahead -> Integer
+ *
+ * Returns the maximum memory size of rows received ahead while streaming results.
+ *
+ * See description at #read_ahead=
+ */
+static VALUE
+pgconn_read_ahead_get(VALUE self)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	return SIZET2NUM( this->read_ahead );
+}
+
+
+/*
+ * call-seq:
+ *    conn.max_result_bytes = Integer
+ *
+ * Limit the memory size of results retrieved by #exec , #exec_params and #exec_prepared .
+ *
+ * If set to a value greater than 0, the queries are executed in single row mode and the
+ * rows are accumulated into a regular PG::Result . If the approximate memory size of the
+ * rows exceeds the limit, PG::ResultTooLarge is raised. The query is canceled, so that
+ * the rest of the result isn't received.
+ *
+ * Results within the limit are the same as without limit.
+ * The default is +0+ (unlimited). The limit does not apply to #sync_exec and friends.
+ * See #chunked_results= to process large results in parts instead.
+ *
+ * Example:
+ *   conn.max_result_bytes = 256 * 1024 * 1024
+ */
+static VALUE
+pgconn_max_result_bytes_set(VALUE self, VALUE size)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	long bytes = NUM2LONG( size );
+
+	if( bytes < 0 )
+		rb_raise( rb_eArgError, "result size limit must not be negative" );
+	this->max_result_bytes = (size_t)bytes;
+	return size;
+}
+
+/*
+ * call-seq:
+ *    conn.max_result_bytes -> Integer
+ *
+ * Returns the memory size limit of results retrieved by the exec methods.
+ *
+ * See description at #max_result_bytes=
+ */
+static VALUE
+pgconn_max_result_bytes_get(VALUE self)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	return SIZET2NUM( this->max_result_bytes );
+}
+
+/*
+ * call-seq:
+ *    conn.chunked_results = Boolean
+ *
+ * Pass results exceeding #max_result_bytes to the block of #exec , #exec_params and
+ * #exec_prepared in chunks.
+ *
+ * If enabled and a block is given, the rows received so far are passed to the block as a
+ * PG::Result each time #max_result_bytes is exceeded and accumulation starts over, so that
+ * the block is called with consecutive chunks of the result, each at most about the given
+ * size. The connection must not be used for other queries within the block, until the
+ * last chunk is yielded.
+ * Since existing blocks expect the whole result at once, this is disabled by default,
+ * so that PG::ResultTooLarge is raised with and without a block.
+ *
+ * Example:
+ *   conn.max_result_bytes = 256 * 1024 * 1024
+ *   conn.chunked_results = true
+ *   conn.exec( "SELECT * FROM events" ) do |res|
+ *     res.each {|row| ... }
+ *   end
+ */
+static VALUE
+pgconn_chunked_results_set(VALUE self, VALUE enable)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	this->chunked_results = RTEST( enable );
+	return enable;
+}
+
+/*
+ * call-seq:
+ *    conn.chunked_results -> Boolean
+ *
+ * Returns whether results exceeding #max_result_bytes are yielded in chunks.
+ *
+ * See description at #chunked_results=
+ */
+static VALUE
+pgconn_chunked_results_get(VALUE self)
+{
+	t_pg_connection *this = pg_get_connection( self );
+	return this->chunked_results ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *    conn.alloc_stats -> Hash
+ *
+ * Returns counters of the allocations done by pg_ext for queries and results on this connection.
+ *
+ * The Hash contains the following keys:
+ * * +:queries+ - number of queries sent with query params
+ * * +:params+ - number of query params
+ * * +:param_bytes+ - bytes of query params type casted by coders
+ * * +:xmalloc_bytes+ - bytes allocated on the heap for query params, which didn't fit into the memory pool on the stack
+ * * +:typecast_heap_chunks+ - number of such heap allocations for type casted params
+ * * +:results+ - number of PG::Result objects built for this connection
+ * * +:result_bytes+ - approximate memory size of these results
+ *
+ * Objects created while retrieving result values are counted per result, see PG::Result#decode_stats .
+ * The counters are never reset implicitly; see #reset_alloc_stats .
+ */
+static VALUE
+pgconn_alloc_stats(VALUE self)
+{
+	t_pg_alloc_stats *stats = &pg_get_connection(self)->alloc_stats;
+	VALUE hash = rb_hash_new();
+
+	rb_hash_aset(hash, ID2SYM(rb_intern("queries")), SIZET2NUM(stats->queries));
+	rb_hash_aset(hash, ID2SYM(rb_intern("params")), SIZET2NUM(stats->params));
+	rb_hash_aset(hash, ID2SYM(rb_intern("param_bytes")), SIZET2NUM(stats->param_bytes));
+	rb_hash_aset(hash, ID2SYM(rb_intern("xmalloc_bytes")), SIZET2NUM(stats->xmalloc_bytes));
+	rb_hash_aset(hash, ID2SYM(rb_intern("typecast_heap_chunks")), SIZET2NUM(stats->typecast_heap_chunks));
+	rb_hash_aset(hash, ID2SYM(rb_intern("results")), SIZET2NUM(stats->results));
+	rb_hash_aset(hash, ID2SYM(rb_intern("result_bytes")), SIZET2NUM(stats->result_bytes));
+
+	return hash;
+}
+
+/*
+ * call-seq:
+ *    conn.reset_alloc_stats -> nil
+ *
+ * Sets all counters of #alloc_stats to zero.
+ */
+static VALUE
+pgconn_reset_alloc_stats(VALUE self)
+{
+	t_pg_connection *this = pg_get_connection(self);
+	memset(&this->alloc_stats, 0, sizeof(this->alloc_stats));
+	return Qnil;
+}
+
+
 /*
  * Document-class: PG::Connection
  */
@@ -4252,6 +5339,15 @@ init_pg_connection()
 	rb_define_method(rb_cPGconn, "flush", pgconn_flush, 0);
 	rb_define_method(rb_cPGconn, "discard_results", pgconn_discard_results, 0);
 
+#ifdef HAVE_PQENTERPIPELINEMODE
+	/******     PG::Connection INSTANCE METHODS: Pipeline Mode     ******/
+	rb_define_method(rb_cPGconn, "pipeline_status", pgconn_pipeline_status, 0);
+	rb_define_method(rb_cPGconn, "enter_pipeline_mode", pgconn_enter_pipeline_mode, 0);
+	rb_define_method(rb_cPGconn, "exit_pipeline_mode", pgconn_exit_pipeline_mode, 0);
+	rb_define_method(rb_cPGconn, "pipeline_sync", pgconn_pipeline_sync, 0);
+	rb_define_method(rb_cPGconn, "send_flush_request", pgconn_send_flush_request, 0);
+#endif
+
 	/******     PG::Connection INSTANCE METHODS: Cancelling Queries in Progress     ******/
 	rb_define_method(rb_cPGconn, "cancel", pgconn_cancel, 0);
 
@@ -4262,6 +5358,8 @@ init_pg_connection()
 	rb_define_method(rb_cPGconn, "put_copy_data", pgconn_put_copy_data, -1);
 	rb_define_method(rb_cPGconn, "put_copy_end", pgconn_put_copy_end, -1);
 	rb_define_method(rb_cPGconn, "get_copy_data", pgconn_get_copy_data, -1);
+	rb_define_method(rb_cPGconn, "copy_from_file", pgconn_copy_from_file, 2);
+	rb_define_method(rb_cPGconn, "copy_to_io", pgconn_copy_to_io, 2);
 
 	/******     PG::Connection INSTANCE METHODS: Control Functions     ******/
 	rb_define_method(rb_cPGconn, "set_error_verbosity", pgconn_set_error_verbosity, 1);
@@ -4310,6 +5408,7 @@ init_pg_connection()
 	rb_define_alias(rb_cPGconn, "lowrite", "lo_write");
 	rb_define_method(rb_cPGconn, "lo_read",pgconn_loread, 2);
 	rb_define_alias(rb_cPGconn, "loread", "lo_read");
+	rb_define_method(rb_cPGconn, "lo_read_into",pgconn_loread_into, 3);
 	rb_define_method(rb_cPGconn, "lo_lseek",pgconn_lolseek, 3);
 	rb_define_alias(rb_cPGconn, "lolseek", "lo_lseek");
 	rb_define_alias(rb_cPGconn, "lo_seek", "lo_lseek");
@@ -4339,4 +5438,13 @@ init_pg_connection()
 
 	rb_define_method(rb_cPGconn, "field_name_type=", pgconn_field_name_type_set, 1 );
 	rb_define_method(rb_cPGconn, "field_name_type", pgconn_field_name_type_get, 0 );
+	rb_define_method(rb_cPGconn, "read_ahead=", pgconn_read_ahead_set, 1 );
+	rb_define_method(rb_cPGconn, "read_ahead", pgconn_read_ahead_get, 0 );
+	rb_define_method(rb_cPGconn, "max_result_bytes=", pgconn_max_result_bytes_set, 1 );
+	rb_define_method(rb_cPGconn, "max_result_bytes", pgconn_max_result_bytes_get, 0 );
+	rb_define_method(rb_cPGconn, "chunked_results=", pgconn_chunked_results_set, 1 );
+	rb_define_method(rb_cPGconn, "chunked_results", pgconn_chunked_results_get, 0 );
+
+	rb_define_method(rb_cPGconn, "alloc_stats", pgconn_alloc_stats, 0);
+	rb_define_method(rb_cPGconn, "reset_alloc_stats", pgconn_reset_alloc_stats, 0);
 }
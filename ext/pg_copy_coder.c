@@ -17,6 +17,15 @@ typedef struct {
 	VALUE typemap;
 	VALUE null_string;
 	char delimiter;
+	/* CSV format only: */
+	char quote;
+	/* 0 means: same as quote */
+	char escape;
+	/* true, false or an Array of column numbers */
+	VALUE force_quote;
+	int header;
+	/* set while the header line is still to be processed */
+	int header_pending;
 } t_pg_copycoder;
 
 
@@ -25,6 +34,7 @@ pg_copycoder_mark( t_pg_copycoder *this )
 {
 	rb_gc_mark(this->typemap);
 	rb_gc_mark(this->null_string);
+	rb_gc_mark(this->force_quote);
 }
 
 static VALUE
@@ -36,6 +46,11 @@ pg_copycoder_encoder_allocate( VALUE klass )
 	this->typemap = pg_typemap_all_strings;
 	this->delimiter = '\t';
 	this->null_string = rb_str_new_cstr("\\N");
+	this->quote = '"';
+	this->escape = 0;
+	this->force_quote = Qfalse;
+	this->header = 0;
+	this->header_pending = 0;
 	return self;
 }
 
@@ -48,6 +63,31 @@ pg_copycoder_decoder_allocate( VALUE klass )
 	this->typemap = pg_typemap_all_strings;
 	this->delimiter = '\t';
 	this->null_string = rb_str_new_cstr("\\N");
+	this->quote = '"';
+	this->escape = 0;
+	this->force_quote = Qfalse;
+	this->header = 0;
+	this->header_pending = 0;
+	return self;
+}
+
+static VALUE
+pg_csvcoder_encoder_allocate( VALUE klass )
+{
+	VALUE self = pg_copycoder_encoder_allocate( klass );
+	t_pg_copycoder *this = DATA_PTR( self );
+	this->delimiter = ',';
+	this->null_string = rb_str_new_cstr("");
+	return self;
+}
+
+static VALUE
+pg_csvcoder_decoder_allocate( VALUE klass )
+{
+	VALUE self = pg_copycoder_decoder_allocate( klass );
+	t_pg_copycoder *this = DATA_PTR( self );
+	this->delimiter = ',';
+	this->null_string = rb_str_new_cstr("");
 	return self;
 }
 
@@ -148,6 +188,147 @@ pg_copycoder_type_map_get(VALUE self)
 }
 
 
+/*
+ * call-seq:
+ *    coder.quote = String
+ *
+ * Specifies the quoting character to be used when a data value is quoted.
+ * The default is double-quote.
+ * This must be a single one-byte character.
+ */
+static VALUE
+pg_csvcoder_quote_set(VALUE self, VALUE quote)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	StringValue(quote);
+	if(RSTRING_LEN(quote) != 1)
+		rb_raise( rb_eArgError, "quote size must be one byte");
+	this->quote = *RSTRING_PTR(quote);
+	return quote;
+}
+
+/*
+ * call-seq:
+ *    coder.quote -> String
+ *
+ * The quoting character to be used when a data value is quoted.
+ */
+static VALUE
+pg_csvcoder_quote_get(VALUE self)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	return rb_str_new(&this->quote, 1);
+}
+
+/*
+ * call-seq:
+ *    coder.escape = String
+ *
+ * Specifies the character that should appear before a data character that matches the #quote value.
+ * The default is the same as the #quote value (so that the quoting character is doubled
+ * if it appears in the data).
+ * This must be a single one-byte character. Assign +nil+ to return to the default.
+ */
+static VALUE
+pg_csvcoder_escape_set(VALUE self, VALUE escape)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	if( NIL_P(escape) ){
+		this->escape = 0;
+		return escape;
+	}
+	StringValue(escape);
+	if(RSTRING_LEN(escape) != 1)
+		rb_raise( rb_eArgError, "escape size must be one byte");
+	this->escape = *RSTRING_PTR(escape);
+	return escape;
+}
+
+/*
+ * call-seq:
+ *    coder.escape -> String
+ *
+ * The character that appears before a data character that matches the #quote value.
+ */
+static VALUE
+pg_csvcoder_escape_get(VALUE self)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	return rb_str_new(this->escape ? &this->escape : &this->quote, 1);
+}
+
+/*
+ * call-seq:
+ *    coder.force_quote = true | false | Array
+ *
+ * Forces quoting to be used for all non-NULL values (+true+) or for the non-NULL values
+ * of the given column numbers (Array of Integer, starting at 0).
+ * NULL values are never quoted.
+ * The default is +false+, so that values are quoted only when necessary.
+ */
+static VALUE
+pg_csvcoder_force_quote_set(VALUE self, VALUE force_quote)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	if( RB_TYPE_P(force_quote, T_ARRAY) ){
+		long i;
+		for( i=0; i<RARRAY_LEN(force_quote); i++ )
+			NUM2INT(rb_ary_entry(force_quote, i));
+		this->force_quote = rb_obj_freeze(rb_ary_dup(force_quote));
+	} else {
+		this->force_quote = RTEST(force_quote) ? Qtrue : Qfalse;
+	}
+	return force_quote;
+}
+
+/*
+ * call-seq:
+ *    coder.force_quote -> true | false | Array
+ *
+ * The columns that are quoted regardless of their content.
+ */
+static VALUE
+pg_csvcoder_force_quote_get(VALUE self)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	return this->force_quote;
+}
+
+/*
+ * call-seq:
+ *    coder.header = true | false
+ *
+ * Specifies that the first row processed by the coder is a header line with the names of the columns.
+ * This corresponds to the +HEADER+ option of the COPY command.
+ *
+ * The header row is encoded respectively decoded as plain strings, bypassing the #type_map.
+ * Every further row is processed per #type_map as usual.
+ * Assigning the attribute rearms the coder for a new header line, so that it can be reused
+ * for the next COPY run.
+ */
+static VALUE
+pg_csvcoder_header_set(VALUE self, VALUE header)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	this->header = RTEST(header);
+	this->header_pending = this->header;
+	return header;
+}
+
+/*
+ * call-seq:
+ *    coder.header -> true | false
+ *
+ * Whether the first row is treated as header line.
+ */
+static VALUE
+pg_csvcoder_header_get(VALUE self)
+{
+	t_pg_copycoder *this = DATA_PTR(self);
+	return this->header ? Qtrue : Qfalse;
+}
+
+
 /*
  * Document-class: PG::TextEncoder::CopyRow < PG::CopyEncoder
  *
@@ -561,6 +742,378 @@ pg_text_dec_copy_row(t_pg_coder *conv, const char *input_line, int len, int _tup
 }
 
 
+/*
+ * Quote a CSV field in place.
+ *
+ * The unquoted value of +len+ bytes is expected at out+1, so that there is room for the
+ * opening quote. The buffer must have space for 2 * len + 2 bytes at +out+ .
+ * Returns the position behind the written field.
+ */
+static char *
+pg_csv_quote_field(t_pg_copycoder *this, char *out, int len, int force)
+{
+	char quotec = this->quote;
+	char escapec = this->escape ? this->escape : this->quote;
+	char *ptr1;
+	char *ptr2;
+	int use_quote = force;
+	int escapes = 0;
+
+	/* A value matching the NULL string must be quoted to distinguish it from NULL. */
+	if( !use_quote && len == RSTRING_LEN(this->null_string) &&
+			memcmp(out + 1, RSTRING_PTR(this->null_string), len) == 0 ){
+		use_quote = 1;
+	}
+
+	for(ptr1 = out + 1; ptr1 < out + 1 + len; ptr1++) {
+		char c = *ptr1;
+		if(c == this->delimiter || c == quotec || c == '\n' || c == '\r'){
+			use_quote = 1;
+		}
+		if(c == quotec || c == escapec){
+			escapes++;
+		}
+	}
+
+	if( !use_quote ){
+		memmove( out, out + 1, len );
+		return out + len;
+	}
+
+	ptr1 = out + 1 + len;
+	ptr2 = out + 1 + len + escapes;
+	*ptr2 = quotec;
+
+	/* Store the escaped string on the final position, walking
+	 * right to left, until all escape characters are placed. */
+	while( ptr1 != ptr2 ) {
+		*--ptr2 = *--ptr1;
+		if(*ptr1 == quotec || *ptr1 == escapec){
+			*--ptr2 = escapec;
+		}
+	}
+	*out = quotec;
+
+	return out + len + escapes + 2;
+}
+
+static int
+pg_csv_force_quote_p(t_pg_copycoder *this, int fieldno)
+{
+	long i;
+
+	if( this->force_quote == Qtrue ) return 1;
+	if( !RB_TYPE_P(this->force_quote, T_ARRAY) ) return 0;
+
+	for( i=0; i<RARRAY_LEN(this->force_quote); i++ ){
+		if( NUM2INT(rb_ary_entry(this->force_quote, i)) == fieldno ) return 1;
+	}
+	return 0;
+}
+
+/*
+ * Document-class: PG::TextEncoder::CsvRow < PG::CopyEncoder
+ *
+ * This class encodes one row of arbitrary columns for transmission as COPY data in CSV format.
+ * See the {COPY command}[http://www.postgresql.org/docs/current/static/sql-copy.html]
+ * for description of the format.
+ *
+ * It is intended to be used in conjunction with PG::Connection#put_copy_data and
+ * a <tt>COPY ... FROM STDIN (FORMAT csv)</tt> command.
+ * The columns are expected as Array of values and are encoded as defined in the
+ * assigned #type_map, like PG::TextEncoder::CopyRow does.
+ *
+ * Values are quoted when they contain the #delimiter, the #quote character, CR or LF,
+ * or when they match the #null_string. The #quote and #escape characters within quoted
+ * values are preceded by the #escape character. NULL values are written as the
+ * unquoted #null_string, which defaults to an empty string.
+ * #force_quote enforces quotation of all or of some columns.
+ * When #header is set, the first row encoded is taken as Array of column names.
+ *
+ * Example:
+ *   enco = PG::TextEncoder::CsvRow.new
+ *   enco.encode ["astring", 7, nil, "", "a,b"]  # => "astring,7,,\"\",\"a,b\"\n"
+ *
+ * See also PG::TextDecoder::CsvRow for the decoding direction.
+ */
+static int
+pg_text_enc_csv_row(t_pg_coder *conv, VALUE value, char *out, VALUE *intermediate, int enc_idx)
+{
+	t_pg_copycoder *this = (t_pg_copycoder *)conv;
+	t_pg_coder_enc_func enc_func;
+	t_pg_coder *p_elem_coder;
+	int i;
+	t_typemap *p_typemap;
+	char *current_out;
+	char *end_capa_ptr;
+
+	if( this->header_pending ){
+		/* The header line consists of column names only. */
+		p_typemap = DATA_PTR( pg_typemap_all_strings );
+	} else {
+		p_typemap = DATA_PTR( this->typemap );
+		p_typemap->funcs.fit_to_query( this->typemap, value );
+	}
+
+	/* Allocate a new string with embedded capacity and realloc exponential when needed. */
+	PG_RB_STR_NEW( *intermediate, current_out, end_capa_ptr );
+	PG_ENCODING_SET_NOCHECK(*intermediate, enc_idx);
+
+	for( i=0; i<RARRAY_LEN(value); i++){
+		int strlen;
+		VALUE subint;
+		VALUE entry;
+
+		entry = rb_ary_entry(value, i);
+
+		if( i > 0 ){
+			PG_RB_STR_ENSURE_CAPA( *intermediate, 1, current_out, end_capa_ptr );
+			*current_out++ = this->delimiter;
+		}
+
+		switch(TYPE(entry)){
+			case T_NIL:
+				PG_RB_STR_ENSURE_CAPA( *intermediate, RSTRING_LEN(this->null_string), current_out, end_capa_ptr );
+				memcpy( current_out, RSTRING_PTR(this->null_string), RSTRING_LEN(this->null_string) );
+				current_out += RSTRING_LEN(this->null_string);
+				break;
+			default:
+				p_elem_coder = p_typemap->funcs.typecast_query_param(p_typemap, entry, i);
+				enc_func = pg_coder_enc_func(p_elem_coder);
+
+				/* 1st pass for retiving the required memory space */
+				strlen = enc_func(p_elem_coder, entry, NULL, &subint, enc_idx);
+
+				if( strlen == -1 ){
+					/* we can directly use String value in subint */
+					strlen = RSTRING_LEN(subint);
+
+					/* size of string assuming the worst case, that every character must be escaped. */
+					PG_RB_STR_ENSURE_CAPA( *intermediate, strlen * 2 + 2, current_out, end_capa_ptr );
+					memcpy( current_out + 1, RSTRING_PTR(subint), strlen );
+				} else {
+					/* 2nd pass for writing the data to prepared buffer */
+					/* size of string assuming the worst case, that every character must be escaped. */
+					PG_RB_STR_ENSURE_CAPA( *intermediate, strlen * 2 + 2, current_out, end_capa_ptr );
+
+					/* Place the unquoted string behind the room for the opening quote. */
+					strlen = enc_func(p_elem_coder, entry, current_out + 1, &subint, enc_idx);
+				}
+				current_out = pg_csv_quote_field( this, current_out, strlen,
+						!this->header_pending && pg_csv_force_quote_p(this, i) );
+		}
+	}
+	PG_RB_STR_ENSURE_CAPA( *intermediate, 1, current_out, end_capa_ptr );
+	*current_out++ = '\n';
+
+	rb_str_set_len( *intermediate, current_out - RSTRING_PTR(*intermediate) );
+	this->header_pending = 0;
+
+	return -1;
+}
+
+/*
+ * Document-class: PG::TextDecoder::CsvRow < PG::CopyDecoder
+ *
+ * This class decodes one row of arbitrary columns received as COPY data in CSV format.
+ * See the {COPY command}[http://www.postgresql.org/docs/current/static/sql-copy.html]
+ * for description of the format.
+ *
+ * It is intended to be used in conjunction with PG::Connection#get_copy_data and
+ * a <tt>COPY ... TO STDOUT (FORMAT csv)</tt> command.
+ * The columns are retrieved as Array of values and are decoded as defined in the
+ * assigned #type_map, like PG::TextDecoder::CopyRow does.
+ *
+ * Only unquoted values matching the #null_string are returned as +nil+, so that a quoted
+ * empty string is retrieved as empty String with the default #null_string.
+ * Quoted values may contain the #delimiter and line breaks.
+ * When #header is set, the first row decoded is returned as Array of Strings,
+ * bypassing the #type_map.
+ *
+ * Example:
+ *   deco = PG::TextDecoder::CsvRow.new
+ *   deco.decode "astring,7,,\"\",\"a,b\"\n"  # => ["astring", "7", nil, "", "a,b"]
+ *
+ * See also PG::TextEncoder::CsvRow for the encoding direction.
+ */
+/*
+ * The parser follows CopyReadAttributesCSV() of the PostgreSQL sources:
+ * src/backend/commands/copyfromparse.c
+ */
+static VALUE
+pg_text_dec_csv_row(t_pg_coder *conv, const char *input_line, int len, int _tuple, int _field, int enc_idx)
+{
+	t_pg_copycoder *this = (t_pg_copycoder *)conv;
+
+	/* Return value: array */
+	VALUE array;
+
+	/* Current field */
+	VALUE field_str;
+
+	char delimc = this->delimiter;
+	char quotec = this->quote;
+	char escapec = this->escape ? this->escape : this->quote;
+	int fieldno;
+	int expected_fields;
+	char *output_ptr;
+	const char *cur_ptr;
+	const char *line_end_ptr;
+	char *end_capa_ptr;
+	t_typemap *p_typemap;
+
+	if( this->header_pending ){
+		/* The header line consists of column names only. */
+		p_typemap = DATA_PTR( pg_typemap_all_strings );
+		expected_fields = 0;
+	} else {
+		p_typemap = DATA_PTR( this->typemap );
+		expected_fields = p_typemap->funcs.fit_to_copy_get( this->typemap );
+	}
+
+	array = rb_ary_new2(expected_fields);
+
+	/* Allocate a new string with embedded capacity and realloc later with
+	 * exponential growing size when needed. */
+	PG_RB_STR_NEW( field_str, output_ptr, end_capa_ptr );
+
+	/* set pointer variables for loop */
+	cur_ptr = input_line;
+	line_end_ptr = input_line + len;
+
+	/* Outer loop iterates over fields */
+	fieldno = 0;
+	for (;;)
+	{
+		int found_delim = 0;
+		int saw_quote = 0;
+		int found_eol = 0;
+		const char *start_ptr;
+		const char *end_ptr;
+		int input_len;
+
+		/* Remember start of field on input side */
+		start_ptr = cur_ptr;
+		end_ptr = cur_ptr;
+
+		/*
+		 * Scan data for field,
+		 *
+		 * The loop starts in "not quote" mode and then toggles between that
+		 * and "in quote" mode. The loop exits normally if it is in "not
+		 * quote" mode and a delimiter or line end is seen.
+		 */
+		for (;;)
+		{
+			char c;
+
+			/* Not in quote */
+			for (;;)
+			{
+				end_ptr = cur_ptr;
+				if (cur_ptr >= line_end_ptr)
+					goto endfield;
+				c = *cur_ptr++;
+				/* unquoted field delimiter */
+				if (c == delimc){
+					found_delim = 1;
+					goto endfield;
+				}
+				/* line end, optionally preceded by CR */
+				if (c == '\n' || (c == '\r' && cur_ptr < line_end_ptr && *cur_ptr == '\n')){
+					if (c == '\r') cur_ptr++;
+					found_eol = 1;
+					goto endfield;
+				}
+				/* start of quoted field (or part of field) */
+				if (c == quotec){
+					saw_quote = 1;
+					break;
+				}
+				/* Add c to output string */
+				PG_RB_STR_ENSURE_CAPA( field_str, 1, output_ptr, end_capa_ptr );
+				*output_ptr++ = c;
+			}
+
+			/* In quote */
+			for (;;)
+			{
+				end_ptr = cur_ptr;
+				if (cur_ptr >= line_end_ptr)
+					rb_raise( rb_eArgError, "unterminated CSV quoted field" );
+
+				c = *cur_ptr++;
+
+				/* escape within a quoted field */
+				if (c == escapec){
+					/*
+					 * peek at the next char if available, and escape it if it
+					 * is an escape char or a quote char
+					 */
+					if (cur_ptr < line_end_ptr){
+						char nextc = *cur_ptr;
+
+						if (nextc == escapec || nextc == quotec){
+							PG_RB_STR_ENSURE_CAPA( field_str, 1, output_ptr, end_capa_ptr );
+							*output_ptr++ = nextc;
+							cur_ptr++;
+							continue;
+						}
+					}
+				}
+
+				/*
+				 * end of quoted field. Must do this test after testing for
+				 * escape in case quote char and escape char are the same
+				 * (which is the common case).
+				 */
+				if (c == quotec)
+					break;
+
+				/* Add c to output string */
+				PG_RB_STR_ENSURE_CAPA( field_str, 1, output_ptr, end_capa_ptr );
+				*output_ptr++ = c;
+			}
+		}
+endfield:
+
+		if (found_eol && cur_ptr < line_end_ptr)
+			rb_raise( rb_eArgError, "trailing data after linefeed at position: %ld", (long)(cur_ptr - input_line) + 1 );
+
+		/* Check whether raw input matched null marker */
+		input_len = end_ptr - start_ptr;
+		if (!saw_quote && !this->header_pending && input_len == RSTRING_LEN(this->null_string) &&
+					strncmp(start_ptr, RSTRING_PTR(this->null_string), input_len) == 0) {
+			rb_ary_push(array, Qnil);
+		} else {
+			VALUE field_value;
+
+			rb_str_set_len( field_str, output_ptr - RSTRING_PTR(field_str) );
+			field_value = p_typemap->funcs.typecast_copy_get( p_typemap, field_str, fieldno, 0, enc_idx );
+
+			rb_ary_push(array, field_value);
+
+			if( field_value == field_str ){
+				/* Our output string will be send to the user, so we can not reuse
+				 * it for the next field. */
+				PG_RB_STR_NEW( field_str, output_ptr, end_capa_ptr );
+			}
+		}
+		/* Reset the pointer to the start of the output/buffer string. */
+		output_ptr = RSTRING_PTR(field_str);
+
+		fieldno++;
+		/* Done if we hit EOL instead of a delim */
+		if (!found_delim)
+			break;
+	}
+
+	this->header_pending = 0;
+
+	return array;
+}
+
+
 void
 init_pg_copycoder()
 {
@@ -595,4 +1148,29 @@ init_pg_copycoder()
 	/* Although CopyRow is a text decoder, data can contain zero bytes and are not zero terminated.
 	 * They are handled like binaries. So format is set to 1 (binary). */
 	rb_include_module( rb_cPG_CopyDecoder, rb_mPG_BinaryFormatting );
+
+	/* dummy = rb_define_class_under( rb_mPG_TextEncoder, "CsvRow", rb_cPG_CopyEncoder ); */
+	pg_define_coder( "CsvRow", pg_text_enc_csv_row, rb_cPG_CopyEncoder, rb_mPG_TextEncoder );
+	/* dummy = rb_define_class_under( rb_mPG_TextDecoder, "CsvRow", rb_cPG_CopyDecoder ); */
+	pg_define_coder( "CsvRow", pg_text_dec_csv_row, rb_cPG_CopyDecoder, rb_mPG_TextDecoder );
+
+	{
+		VALUE csv_klasses[2];
+		int i;
+		csv_klasses[0] = rb_const_get( rb_mPG_TextEncoder, rb_intern("CsvRow") );
+		csv_klasses[1] = rb_const_get( rb_mPG_TextDecoder, rb_intern("CsvRow") );
+		rb_define_alloc_func( csv_klasses[0], pg_csvcoder_encoder_allocate );
+		rb_define_alloc_func( csv_klasses[1], pg_csvcoder_decoder_allocate );
+
+		for( i=0; i<2; i++ ){
+			rb_define_method( csv_klasses[i], "quote=", pg_csvcoder_quote_set, 1 );
+			rb_define_method( csv_klasses[i], "quote", pg_csvcoder_quote_get, 0 );
+			rb_define_method( csv_klasses[i], "escape=", pg_csvcoder_escape_set, 1 );
+			rb_define_method( csv_klasses[i], "escape", pg_csvcoder_escape_get, 0 );
+			rb_define_method( csv_klasses[i], "force_quote=", pg_csvcoder_force_quote_set, 1 );
+			rb_define_method( csv_klasses[i], "force_quote", pg_csvcoder_force_quote_get, 0 );
+			rb_define_method( csv_klasses[i], "header=", pg_csvcoder_header_set, 1 );
+			rb_define_method( csv_klasses[i], "header", pg_csvcoder_header_get, 0 );
+		}
+	}
 }
@@ -0,0 +1,1420 @@
+/*
+ * pg_replication.c - PG::Replication module and PG::Replication::PgoutputDecoder class
+ *
+ * Parsing and building of the messages of the streaming replication protocol.
+ * See https://www.postgresql.org/docs/current/protocol-replication.html and
+ * https://www.postgresql.org/docs/current/protocol-logicalrep-message-formats.html
+ */
+
+#include "pg.h"
+
+#if defined(HAVE_POLL_H) && defined(HAVE_PWRITE) && defined(HAVE_FSYNC) && defined(HAVE_SYMLINK)
+#define PG_HAVE_PHYSICAL_REPLICATION
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+static VALUE rb_mPG_Replication;
+static VALUE rb_cPG_PgoutputDecoder;
+
+static VALUE sym_type, sym_xlog_data, sym_keepalive, sym_wal_start, sym_wal_end, sym_send_time,
+	sym_data, sym_reply_requested;
+static VALUE sym_begin, sym_commit, sym_origin, sym_relation, sym_type_info, sym_insert, sym_update,
+	sym_delete, sym_truncate, sym_message, sym_unknown;
+static VALUE sym_final_lsn, sym_commit_lsn, sym_end_lsn, sym_commit_time, sym_xid, sym_flags, sym_lsn,
+	sym_name, sym_oid, sym_namespace, sym_replica_identity, sym_columns, sym_type_oid,
+	sym_type_modifier, sym_key, sym_new, sym_old, sym_relations, sym_cascade, sym_restart_identity,
+	sym_transactional, sym_prefix, sym_content, sym_tag, sym_unchanged_toast;
+
+/* Seconds between 1970-01-01 and 2000-01-01, the epoch of PostgreSQL timestamps */
+#define PG_EPOCH_OFFSET 946684800LL
+
+typedef struct {
+	VALUE type_map;
+	/* Hash of relation OID => [relation Hash, Array of column names, type map of the columns] */
+	VALUE relations;
+	int enc_idx;
+} t_pg_pgoutput;
+
+/* Read position within a message */
+typedef struct {
+	const char *ptr;
+	const char *end;
+} t_pg_repl_reader;
+
+
+static void
+pg_repl_need( t_pg_repl_reader *r, long len )
+{
+	if( len < 0 || r->end - r->ptr < len )
+		rb_raise( rb_eArgError, "replication message is truncated" );
+}
+
+static int
+pg_repl_read_int8( t_pg_repl_reader *r )
+{
+	pg_repl_need( r, 1 );
+	return (unsigned char)*r->ptr++;
+}
+
+static int
+pg_repl_read_int16( t_pg_repl_reader *r )
+{
+	const unsigned char *p;
+	pg_repl_need( r, 2 );
+	p = (const unsigned char *)r->ptr;
+	r->ptr += 2;
+	return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t
+pg_repl_read_int32( t_pg_repl_reader *r )
+{
+	const unsigned char *p;
+	pg_repl_need( r, 4 );
+	p = (const unsigned char *)r->ptr;
+	r->ptr += 4;
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t
+pg_repl_read_int64( t_pg_repl_reader *r )
+{
+	uint64_t high = pg_repl_read_int32( r );
+	return (high << 32) | pg_repl_read_int32( r );
+}
+
+static VALUE
+pg_repl_read_cstring( t_pg_repl_reader *r, int enc_idx )
+{
+	const char *nul = memchr( r->ptr, 0, r->end - r->ptr );
+	VALUE str;
+
+	if( !nul )
+		rb_raise( rb_eArgError, "replication message is truncated" );
+	str = rb_str_new( r->ptr, nul - r->ptr );
+	PG_ENCODING_SET_NOCHECK( str, enc_idx );
+	r->ptr = nul + 1;
+	return str;
+}
+
+/* Convert a PostgreSQL timestamp (microseconds since 2000-01-01) to a Time object. */
+static VALUE
+pg_repl_time( int64_t pg_usec )
+{
+	int64_t sec = pg_usec / 1000000;
+	int64_t usec = pg_usec % 1000000;
+	if( usec < 0 ){
+		sec--;
+		usec += 1000000;
+	}
+	return rb_time_nano_new( (time_t)(sec + PG_EPOCH_OFFSET), (long)(usec * 1000) );
+}
+
+static VALUE
+pg_repl_read_time( t_pg_repl_reader *r )
+{
+	return pg_repl_time( (int64_t)pg_repl_read_int64(r) );
+}
+
+static VALUE
+pg_repl_read_lsn( t_pg_repl_reader *r )
+{
+	return ULL2NUM( pg_repl_read_int64(r) );
+}
+
+static void
+pg_repl_write_int64( char *p, uint64_t val )
+{
+	int i;
+	for( i=7; i>=0; i-- ){
+		p[i] = (char)(val & 0xff);
+		val >>= 8;
+	}
+}
+
+static int64_t
+pg_repl_now( void )
+{
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return ((int64_t)tv.tv_sec - PG_EPOCH_OFFSET) * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ * call-seq:
+ *    PG::Replication.parse_copy_data( data ) -> Hash
+ *
+ * Parses one CopyData message received per PG::Connection#get_copy_data while
+ * streaming replication is active.
+ *
+ * Returns one of:
+ *   {type: :xlog_data, wal_start: Integer, wal_end: Integer, send_time: Time, data: String}
+ *   {type: :keepalive, wal_end: Integer, send_time: Time, reply_requested: Boolean}
+ *
+ * The +data+ of XLogData messages is a binary String with the WAL data or
+ * the message of the logical decoding output plugin.
+ * Other message types raise an ArgumentError.
+ */
+static VALUE
+pg_repl_s_parse_copy_data( VALUE self, VALUE data )
+{
+	t_pg_repl_reader r;
+	VALUE hash = rb_hash_new();
+	int tag;
+
+	StringValue( data );
+	r.ptr = RSTRING_PTR( data );
+	r.end = r.ptr + RSTRING_LEN( data );
+
+	tag = pg_repl_read_int8( &r );
+	switch( tag ){
+		case 'w':
+			rb_hash_aset( hash, sym_type, sym_xlog_data );
+			rb_hash_aset( hash, sym_wal_start, pg_repl_read_lsn(&r) );
+			rb_hash_aset( hash, sym_wal_end, pg_repl_read_lsn(&r) );
+			rb_hash_aset( hash, sym_send_time, pg_repl_read_time(&r) );
+			rb_hash_aset( hash, sym_data, rb_str_subseq(data, r.ptr - RSTRING_PTR(data), r.end - r.ptr) );
+			break;
+		case 'k':
+			rb_hash_aset( hash, sym_type, sym_keepalive );
+			rb_hash_aset( hash, sym_wal_end, pg_repl_read_lsn(&r) );
+			rb_hash_aset( hash, sym_send_time, pg_repl_read_time(&r) );
+			rb_hash_aset( hash, sym_reply_requested, pg_repl_read_int8(&r) ? Qtrue : Qfalse );
+			break;
+		default:
+			rb_raise( rb_eArgError, "unknown replication message type %c", tag );
+	}
+
+	RB_GC_GUARD( data );
+	return hash;
+}
+
+/*
+ * call-seq:
+ *    PG::Replication.standby_status_update( written_lsn, flushed_lsn, applied_lsn, reply_requested=false ) -> String
+ *
+ * Builds a Standby status update message to be sent per PG::Connection#put_copy_data .
+ *
+ * It reports the WAL positions which were written, flushed to disk and applied by the client.
+ * The server uses the flushed position to release WAL of the replication slot.
+ * The current time is used as send time.
+ */
+static VALUE
+pg_repl_s_standby_status_update( int argc, VALUE *argv, VALUE self )
+{
+	VALUE written, flushed, applied, reply;
+	char buf[34];
+
+	rb_scan_args( argc, argv, "31", &written, &flushed, &applied, &reply );
+
+	buf[0] = 'r';
+	pg_repl_write_int64( buf + 1, NUM2ULL(written) );
+	pg_repl_write_int64( buf + 9, NUM2ULL(flushed) );
+	pg_repl_write_int64( buf + 17, NUM2ULL(applied) );
+	pg_repl_write_int64( buf + 25, (uint64_t)pg_repl_now() );
+	buf[33] = RTEST(reply) ? 1 : 0;
+
+	return rb_str_new( buf, sizeof(buf) );
+}
+
+
+static void
+pg_pgoutput_gc_mark( t_pg_pgoutput *this )
+{
+	rb_gc_mark( this->type_map );
+	rb_gc_mark( this->relations );
+}
+
+static void
+pg_pgoutput_gc_free( t_pg_pgoutput *this )
+{
+	xfree( this );
+}
+
+static size_t
+pg_pgoutput_memsize( t_pg_pgoutput *this )
+{
+	return sizeof(*this);
+}
+
+static const rb_data_type_t pg_pgoutput_type = {
+	"pg",
+	{
+		(void (*)(void*))pg_pgoutput_gc_mark,
+		(void (*)(void*))pg_pgoutput_gc_free,
+		(size_t (*)(const void *))pg_pgoutput_memsize,
+	},
+	0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static VALUE
+pg_pgoutput_s_allocate( VALUE klass )
+{
+	t_pg_pgoutput *this;
+	VALUE self = TypedData_Make_Struct( klass, t_pg_pgoutput, &pg_pgoutput_type, this );
+
+	this->type_map = pg_typemap_all_strings;
+	this->relations = rb_hash_new();
+	this->enc_idx = rb_utf8_encindex();
+	return self;
+}
+
+static t_pg_pgoutput *
+pg_pgoutput_get( VALUE self )
+{
+	t_pg_pgoutput *this;
+	TypedData_Get_Struct( self, t_pg_pgoutput, &pg_pgoutput_type, this );
+	return this;
+}
+
+/*
+ * call-seq:
+ *    PG::Replication::PgoutputDecoder.new( type_map = nil, encoding = Encoding::UTF_8 )
+ *
+ * Creates a decoder for the messages of the +pgoutput+ logical decoding plugin.
+ *
+ * Column values are decoded per _type_map_ .
+ * A PG::TypeMapByOid (like PG::BasicTypeMapForResults ) is the natural choice, since it
+ * selects the decoder by the column types announced per Relation message.
+ * Any other PG::TypeMap is used by column position for all tables.
+ * Without _type_map_ all values are returned as Strings.
+ *
+ * _encoding_ is the Encoding of the database.
+ */
+static VALUE
+pg_pgoutput_init( int argc, VALUE *argv, VALUE self )
+{
+	t_pg_pgoutput *this = pg_pgoutput_get( self );
+	VALUE type_map, encoding;
+
+	rb_scan_args( argc, argv, "02", &type_map, &encoding );
+
+	if( !NIL_P(type_map) ){
+		if( !rb_obj_is_kind_of(type_map, rb_cTypeMap) ){
+			rb_raise( rb_eTypeError, "wrong argument type %s (expected kind of PG::TypeMap)",
+					rb_obj_classname( type_map ) );
+		}
+		this->type_map = type_map;
+	}
+	if( !NIL_P(encoding) ){
+		this->enc_idx = rb_to_encoding_index( encoding );
+	}
+	return self;
+}
+
+/*
+ * call-seq:
+ *    decoder.type_map -> PG::TypeMap
+ *
+ * The type map used to decode column values.
+ */
+static VALUE
+pg_pgoutput_type_map( VALUE self )
+{
+	return pg_pgoutput_get( self )->type_map;
+}
+
+/*
+ * call-seq:
+ *    decoder.relations -> Hash
+ *
+ * All relations announced so far as Hash of OID => relation description.
+ */
+static VALUE
+pg_pgoutput_relations( VALUE self )
+{
+	t_pg_pgoutput *this = pg_pgoutput_get( self );
+	VALUE hash = rb_hash_new();
+	VALUE oids = rb_funcall( this->relations, rb_intern("keys"), 0 );
+	long i;
+
+	for( i=0; i<RARRAY_LEN(oids); i++ ){
+		VALUE oid = RARRAY_AREF( oids, i );
+		rb_hash_aset( hash, oid, RARRAY_AREF(rb_hash_aref(this->relations, oid), 0) );
+	}
+	return hash;
+}
+
+static VALUE
+pg_pgoutput_read_relation( t_pg_pgoutput *this, t_pg_repl_reader *r, VALUE msg )
+{
+	uint32_t oid = pg_repl_read_int32( r );
+	VALUE columns, names, type_map;
+	VALUE entry;
+	VALUE oid_buf;
+	Oid *oids;
+	int ncols, i;
+
+	rb_hash_aset( msg, sym_oid, UINT2NUM(oid) );
+	rb_hash_aset( msg, sym_namespace, pg_repl_read_cstring(r, this->enc_idx) );
+	rb_hash_aset( msg, sym_name, pg_repl_read_cstring(r, this->enc_idx) );
+	rb_hash_aset( msg, sym_replica_identity, rb_sprintf("%c", pg_repl_read_int8(r)) );
+
+	ncols = pg_repl_read_int16( r );
+	if( ncols < 0 )
+		rb_raise( rb_eArgError, "invalid number of columns %d", ncols );
+	columns = rb_ary_new2( ncols );
+	names = rb_ary_new2( ncols );
+	oid_buf = rb_str_new( NULL, sizeof(Oid) * ncols );
+	oids = (Oid *)RSTRING_PTR( oid_buf );
+
+	for( i=0; i<ncols; i++ ){
+		VALUE column = rb_hash_new();
+		int flags = pg_repl_read_int8( r );
+		VALUE name = pg_repl_read_cstring( r, this->enc_idx );
+
+		rb_obj_freeze( name );
+		oids[i] = pg_repl_read_int32( r );
+		rb_hash_aset( column, sym_name, name );
+		rb_hash_aset( column, sym_type_oid, UINT2NUM(oids[i]) );
+		rb_hash_aset( column, sym_type_modifier, INT2NUM((int32_t)pg_repl_read_int32(r)) );
+		rb_hash_aset( column, sym_key, (flags & 1) ? Qtrue : Qfalse );
+		rb_ary_push( columns, column );
+		rb_ary_push( names, name );
+	}
+	rb_hash_aset( msg, sym_columns, columns );
+
+	/* A TypeMapByOid is resolved to the column types of the relation once. */
+	type_map = pg_tmbo_build_type_map_for_oids( this->type_map, ncols, oids, 0 );
+	if( NIL_P(type_map) )
+		type_map = this->type_map;
+
+	entry = rb_ary_new3( 3, msg, names, type_map );
+	rb_hash_aset( this->relations, UINT2NUM(oid), entry );
+	RB_GC_GUARD( oid_buf );
+	return msg;
+}
+
+static VALUE
+pg_pgoutput_lookup_relation( t_pg_pgoutput *this, t_pg_repl_reader *r )
+{
+	uint32_t oid = pg_repl_read_int32( r );
+	VALUE entry = rb_hash_lookup( this->relations, UINT2NUM(oid) );
+
+	if( NIL_P(entry) )
+		rb_raise( rb_eArgError, "no Relation message received for relation OID %u", oid );
+	return entry;
+}
+
+/* Decode TupleData to a Hash of column name => value */
+static VALUE
+pg_pgoutput_read_tuple( t_pg_pgoutput *this, t_pg_repl_reader *r, VALUE entry )
+{
+	VALUE names = RARRAY_AREF( entry, 1 );
+	VALUE type_map = RARRAY_AREF( entry, 2 );
+	t_typemap *p_typemap = DATA_PTR( type_map );
+	VALUE tuple = rb_hash_new();
+	int ncols, i;
+
+	p_typemap->funcs.fit_to_copy_get( type_map );
+
+	ncols = pg_repl_read_int16( r );
+	for( i=0; i<ncols; i++ ){
+		VALUE name = i < RARRAY_LEN(names) ? RARRAY_AREF(names, i) : INT2FIX(i);
+		VALUE value;
+		int kind = pg_repl_read_int8( r );
+		uint32_t len;
+
+		switch( kind ){
+			case 'n':
+				value = Qnil;
+				break;
+			case 'u':
+				value = sym_unchanged_toast;
+				break;
+			case 't':
+				len = pg_repl_read_int32( r );
+				pg_repl_need( r, len );
+				value = rb_str_new( r->ptr, len );
+				r->ptr += len;
+				value = p_typemap->funcs.typecast_copy_get( p_typemap, value, i, 0, this->enc_idx );
+				break;
+			case 'b':
+				/* Values of the binary option of pgoutput are not type casted. */
+				len = pg_repl_read_int32( r );
+				pg_repl_need( r, len );
+				value = rb_str_new( r->ptr, len );
+				r->ptr += len;
+				break;
+			default:
+				rb_raise( rb_eArgError, "unknown tuple data type %c", kind );
+		}
+		rb_hash_aset( tuple, name, value );
+	}
+	return tuple;
+}
+
+/*
+ * call-seq:
+ *    decoder.decode( data ) -> Hash
+ *
+ * Decodes one message of the +pgoutput+ plugin (protocol version 1), which is the
+ * +data+ of an XLogData message as returned by PG::Replication.parse_copy_data .
+ *
+ * Returns a Hash with the message +:type+ and its fields:
+ *   {type: :begin, final_lsn:, commit_time:, xid:}
+ *   {type: :commit, flags:, commit_lsn:, end_lsn:, commit_time:}
+ *   {type: :origin, lsn:, name:}
+ *   {type: :relation, oid:, namespace:, name:, replica_identity:, columns: [{name:, type_oid:, type_modifier:, key:}, ...]}
+ *   {type: :type_info, oid:, namespace:, name:}
+ *   {type: :insert, relation:, new:}
+ *   {type: :update, relation:, old:, key:, new:}
+ *   {type: :delete, relation:, old:, key:}
+ *   {type: :truncate, relations: [...], cascade:, restart_identity:}
+ *   {type: :message, transactional:, lsn:, prefix:, content:}
+ *
+ * Tuples are Hashes of column name => value. Values are decoded per #type_map .
+ * Unchanged TOASTed values of updates are returned as <tt>:unchanged_toast</tt> .
+ * The +old+ tuple of updates and deletes contains either the replica identity key
+ * columns (+key+ is +true+) or the whole old row.
+ * Relations are returned as the Hash of the preceding Relation message.
+ */
+static VALUE
+pg_pgoutput_decode( VALUE self, VALUE data )
+{
+	t_pg_pgoutput *this = pg_pgoutput_get( self );
+	t_pg_repl_reader r;
+	VALUE msg = rb_hash_new();
+	VALUE entry;
+	int tag, kind, i, nrels, options;
+
+	StringValue( data );
+	r.ptr = RSTRING_PTR( data );
+	r.end = r.ptr + RSTRING_LEN( data );
+
+	tag = pg_repl_read_int8( &r );
+	switch( tag ){
+		case 'B':
+			rb_hash_aset( msg, sym_type, sym_begin );
+			rb_hash_aset( msg, sym_final_lsn, pg_repl_read_lsn(&r) );
+			rb_hash_aset( msg, sym_commit_time, pg_repl_read_time(&r) );
+			rb_hash_aset( msg, sym_xid, UINT2NUM(pg_repl_read_int32(&r)) );
+			break;
+		case 'C':
+			rb_hash_aset( msg, sym_type, sym_commit );
+			rb_hash_aset( msg, sym_flags, INT2FIX(pg_repl_read_int8(&r)) );
+			rb_hash_aset( msg, sym_commit_lsn, pg_repl_read_lsn(&r) );
+			rb_hash_aset( msg, sym_end_lsn, pg_repl_read_lsn(&r) );
+			rb_hash_aset( msg, sym_commit_time, pg_repl_read_time(&r) );
+			break;
+		case 'O':
+			rb_hash_aset( msg, sym_type, sym_origin );
+			rb_hash_aset( msg, sym_lsn, pg_repl_read_lsn(&r) );
+			rb_hash_aset( msg, sym_name, pg_repl_read_cstring(&r, this->enc_idx) );
+			break;
+		case 'R':
+			rb_hash_aset( msg, sym_type, sym_relation );
+			pg_pgoutput_read_relation( this, &r, msg );
+			break;
+		case 'Y':
+			rb_hash_aset( msg, sym_type, sym_type_info );
+			rb_hash_aset( msg, sym_oid, UINT2NUM(pg_repl_read_int32(&r)) );
+			rb_hash_aset( msg, sym_namespace, pg_repl_read_cstring(&r, this->enc_idx) );
+			rb_hash_aset( msg, sym_name, pg_repl_read_cstring(&r, this->enc_idx) );
+			break;
+		case 'I':
+			rb_hash_aset( msg, sym_type, sym_insert );
+			entry = pg_pgoutput_lookup_relation( this, &r );
+			rb_hash_aset( msg, sym_relation, RARRAY_AREF(entry, 0) );
+			if( pg_repl_read_int8(&r) != 'N' )
+				rb_raise( rb_eArgError, "expected new tuple in insert message" );
+			rb_hash_aset( msg, sym_new, pg_pgoutput_read_tuple(this, &r, entry) );
+			break;
+		case 'U':
+			rb_hash_aset( msg, sym_type, sym_update );
+			entry = pg_pgoutput_lookup_relation( this, &r );
+			rb_hash_aset( msg, sym_relation, RARRAY_AREF(entry, 0) );
+			kind = pg_repl_read_int8( &r );
+			if( kind == 'K' || kind == 'O' ){
+				rb_hash_aset( msg, sym_key, kind == 'K' ? Qtrue : Qfalse );
+				rb_hash_aset( msg, sym_old, pg_pgoutput_read_tuple(this, &r, entry) );
+				kind = pg_repl_read_int8( &r );
+			} else {
+				rb_hash_aset( msg, sym_key, Qfalse );
+				rb_hash_aset( msg, sym_old, Qnil );
+			}
+			if( kind != 'N' )
+				rb_raise( rb_eArgError, "expected new tuple in update message" );
+			rb_hash_aset( msg, sym_new, pg_pgoutput_read_tuple(this, &r, entry) );
+			break;
+		case 'D':
+			rb_hash_aset( msg, sym_type, sym_delete );
+			entry = pg_pgoutput_lookup_relation( this, &r );
+			rb_hash_aset( msg, sym_relation, RARRAY_AREF(entry, 0) );
+			kind = pg_repl_read_int8( &r );
+			if( kind != 'K' && kind != 'O' )
+				rb_raise( rb_eArgError, "expected old tuple in delete message" );
+			rb_hash_aset( msg, sym_key, kind == 'K' ? Qtrue : Qfalse );
+			rb_hash_aset( msg, sym_old, pg_pgoutput_read_tuple(this, &r, entry) );
+			break;
+		case 'T':
+			rb_hash_aset( msg, sym_type, sym_truncate );
+			nrels = (int)pg_repl_read_int32( &r );
+			options = pg_repl_read_int8( &r );
+			rb_hash_aset( msg, sym_cascade, (options & 1) ? Qtrue : Qfalse );
+			rb_hash_aset( msg, sym_restart_identity, (options & 2) ? Qtrue : Qfalse );
+			{
+				VALUE rels = rb_ary_new();
+				for( i=0; i<nrels; i++ ){
+					entry = pg_pgoutput_lookup_relation( this, &r );
+					rb_ary_push( rels, RARRAY_AREF(entry, 0) );
+				}
+				rb_hash_aset( msg, sym_relations, rels );
+			}
+			break;
+		case 'M':
+			rb_hash_aset( msg, sym_type, sym_message );
+			rb_hash_aset( msg, sym_transactional, (pg_repl_read_int8(&r) & 1) ? Qtrue : Qfalse );
+			rb_hash_aset( msg, sym_lsn, pg_repl_read_lsn(&r) );
+			rb_hash_aset( msg, sym_prefix, pg_repl_read_cstring(&r, this->enc_idx) );
+			{
+				uint32_t len = pg_repl_read_int32( &r );
+				pg_repl_need( &r, len );
+				rb_hash_aset( msg, sym_content, rb_str_new(r.ptr, len) );
+				r.ptr += len;
+			}
+			break;
+		default:
+			rb_hash_aset( msg, sym_type, sym_unknown );
+			rb_hash_aset( msg, sym_tag, rb_sprintf("%c", tag) );
+			rb_hash_aset( msg, sym_data, rb_str_subseq(data, 1, RSTRING_LEN(data) - 1) );
+	}
+
+	RB_GC_GUARD( data );
+	return msg;
+}
+
+
+#ifdef PG_HAVE_PHYSICAL_REPLICATION
+
+/* Microseconds of a monotonic clock */
+static int64_t
+pg_repl_monotonic_usec( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+pg_repl_get_int64( const char *p )
+{
+	const unsigned char *u = (const unsigned char *)p;
+	uint64_t val = 0;
+	int i;
+	for( i=0; i<8; i++ )
+		val = (val << 8) | u[i];
+	return val;
+}
+
+/* Write the whole buffer at the given offset. Returns 0 or an errno value. */
+static int
+pg_repl_pwrite_all( int fd, const char *buf, size_t len, off_t offset )
+{
+	while( len > 0 ){
+		ssize_t ret = pwrite( fd, buf, len, offset );
+		if( ret < 0 ){
+			if( errno == EINTR ) continue;
+			return errno;
+		}
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+static int
+pg_repl_fsync_dir( const char *dir )
+{
+	int fd = open( dir, O_RDONLY );
+	if( fd < 0 ) return errno;
+	if( fsync(fd) < 0 && errno != EINVAL ){
+		int err = errno;
+		close( fd );
+		return err;
+	}
+	close( fd );
+	return 0;
+}
+
+
+/* State of a physical WAL stream */
+struct wal_receive_data {
+	VALUE self;
+	PGconn *pgconn;
+	VALUE dir;
+	uint32_t timeline;
+	uint64_t segment_size;
+	/* Position behind the data written to disk */
+	uint64_t written_lsn;
+	/* Position behind the data which is fsync'ed */
+	uint64_t flushed_lsn;
+	/* fsync after this number of unsynced bytes */
+	uint64_t fsync_bytes;
+	uint64_t unsynced;
+	int64_t status_interval;
+	int64_t next_status;
+	/* Currently open segment file or -1 */
+	int fd;
+	uint64_t segno;
+	char partial_path[1024];
+	/* Path of a completed segment to be yielded */
+	char done_path[1024];
+	int segment_done;
+	/* Set by pgconn_transfer_ubf() to interrupt the transfer */
+	volatile int interrupted;
+	/* 0 = OK, -1 = error in libpq, otherwise an errno value */
+	int error;
+	int eof;
+};
+
+static void
+wal_segment_path( struct wal_receive_data *data, char *path, size_t size, uint64_t segno, const char *suffix )
+{
+	uint64_t segs_per_id = UINT64_C(0x100000000) / data->segment_size;
+	snprintf( path, size, "%s/%08X%08X%08X%s", RSTRING_PTR(data->dir), data->timeline,
+			(uint32_t)(segno / segs_per_id), (uint32_t)(segno % segs_per_id), suffix );
+}
+
+static int
+wal_sync( struct wal_receive_data *data )
+{
+	if( data->fd >= 0 && data->unsynced > 0 ){
+		if( fsync(data->fd) < 0 ) return errno;
+	}
+	data->unsynced = 0;
+	data->flushed_lsn = data->written_lsn;
+	return 0;
+}
+
+static int
+wal_send_status( struct wal_receive_data *data, int reply_requested )
+{
+	char buf[34];
+
+	buf[0] = 'r';
+	pg_repl_write_int64( buf + 1, data->written_lsn );
+	pg_repl_write_int64( buf + 9, data->flushed_lsn );
+	/* A WAL receiver doesn't apply anything. */
+	pg_repl_write_int64( buf + 17, 0 );
+	pg_repl_write_int64( buf + 25, (uint64_t)pg_repl_now() );
+	buf[33] = reply_requested ? 1 : 0;
+
+	data->next_status = pg_repl_monotonic_usec() + data->status_interval;
+	if( PQputCopyData(data->pgconn, buf, sizeof(buf)) <= 0 || PQflush(data->pgconn) < 0 )
+		return -1;
+	return 0;
+}
+
+/* Write the WAL data of one XLogData message into the segment files. */
+static int
+wal_write( struct wal_receive_data *data, uint64_t start, const char *buf, size_t len )
+{
+	int err;
+
+	while( len > 0 ){
+		uint64_t segno = start / data->segment_size;
+		uint64_t offset = start % data->segment_size;
+		size_t chunk = len;
+
+		if( data->fd >= 0 && segno != data->segno ){
+			if( (err = wal_sync(data)) ) return err;
+			close( data->fd );
+			data->fd = -1;
+		}
+		if( data->fd < 0 ){
+			wal_segment_path( data, data->partial_path, sizeof(data->partial_path), segno, ".partial" );
+			data->fd = open( data->partial_path, O_WRONLY | O_CREAT, 0600 );
+			if( data->fd < 0 ) return errno;
+			data->segno = segno;
+		}
+
+		if( chunk > data->segment_size - offset )
+			chunk = data->segment_size - offset;
+		if( (err = pg_repl_pwrite_all(data->fd, buf, chunk, offset)) ) return err;
+
+		start += chunk;
+		buf += chunk;
+		len -= chunk;
+		data->unsynced += chunk;
+		data->written_lsn = start;
+
+		if( offset + chunk == data->segment_size ){
+			/* The segment is complete: make it durable and give it its final name. */
+			if( (err = wal_sync(data)) ) return err;
+			close( data->fd );
+			data->fd = -1;
+			wal_segment_path( data, data->done_path, sizeof(data->done_path), segno, "" );
+			if( rename(data->partial_path, data->done_path) < 0 ) return errno;
+			if( (err = pg_repl_fsync_dir(RSTRING_PTR(data->dir))) ) return err;
+			data->segment_done = 1;
+		} else if( data->unsynced >= data->fsync_bytes ){
+			if( (err = wal_sync(data)) ) return err;
+		}
+	}
+	return 0;
+}
+
+/* Receive WAL until a segment is completed, the stream ends or an interrupt. This runs without the GVL. */
+static void *
+wal_receive_nogvl( void *ptr )
+{
+	struct wal_receive_data *data = ptr;
+
+	while( !data->interrupted && !data->segment_done ){
+		char *buffer;
+		int len = PQgetCopyData( data->pgconn, &buffer, 1 );
+
+		if( len == 0 ){
+			struct pollfd pfd;
+			int64_t now = pg_repl_monotonic_usec();
+			int timeout;
+
+			if( now >= data->next_status ){
+				if( (data->error = wal_sync(data)) ) return NULL;
+				if( wal_send_status(data, 0) ){
+					data->error = -1;
+					return NULL;
+				}
+				now = pg_repl_monotonic_usec();
+			}
+			/* Wake up at least every 100 ms to check for interrupts. */
+			timeout = (int)((data->next_status - now) / 1000);
+			if( timeout > 100 ) timeout = 100;
+			if( timeout < 0 ) timeout = 0;
+
+			pfd.fd = PQsocket( data->pgconn );
+			pfd.events = POLLIN;
+			if( poll(&pfd, 1, timeout) < 0 && errno != EINTR ){
+				data->error = errno;
+				return NULL;
+			}
+			if( !PQconsumeInput(data->pgconn) ){
+				data->error = -1;
+				return NULL;
+			}
+			continue;
+		}
+		if( len == -1 ){
+			data->eof = 1;
+			data->error = wal_sync( data );
+			return NULL;
+		}
+		if( len < 0 ){
+			data->error = -1;
+			return NULL;
+		}
+
+		if( buffer[0] == 'w' && len >= 25 ){
+			data->error = wal_write( data, pg_repl_get_int64(buffer + 1), buffer + 25, len - 25 );
+		} else if( buffer[0] == 'k' && len >= 18 ){
+			/* Keepalive: reply immediately if requested */
+			if( buffer[17] ){
+				if( (data->error = wal_sync(data)) == 0 && wal_send_status(data, 0) )
+					data->error = -1;
+			}
+		}
+		PQfreemem( buffer );
+		if( data->error ) return NULL;
+	}
+	return NULL;
+}
+
+static VALUE
+wal_receive_body( VALUE ptr )
+{
+	struct wal_receive_data *data = (struct wal_receive_data *)ptr;
+
+	for(;;){
+		int state = 0;
+
+		rb_thread_call_without_gvl( wal_receive_nogvl, data, pgconn_transfer_ubf, (void *)&data->interrupted );
+
+		if( data->error == -1 ){
+			VALUE error = rb_exc_new2( rb_ePGerror, PQerrorMessage(data->pgconn) );
+			rb_iv_set( error, "@connection", data->self );
+			rb_exc_raise( error );
+		} else if( data->error ){
+			rb_syserr_fail( data->error, "write of WAL segment" );
+		}
+
+		if( data->segment_done ){
+			data->segment_done = 0;
+			if( rb_block_given_p() )
+				rb_yield( rb_str_new_cstr(data->done_path) );
+		}
+		if( data->eof )
+			break;
+
+		if( data->interrupted ){
+			/* Process pending interrupts and continue the transfer. */
+			data->interrupted = 0;
+			rb_protect( pgconn_check_ints, Qnil, &state );
+			if( state ) rb_jump_tag( state );
+		}
+	}
+	return Qnil;
+}
+
+/* Close the partial segment and end the stream, if it wasn't ended by the server. */
+static VALUE
+wal_receive_cleanup( VALUE ptr )
+{
+	struct wal_receive_data *data = (struct wal_receive_data *)ptr;
+
+	if( data->fd >= 0 ){
+		wal_sync( data );
+		close( data->fd );
+		data->fd = -1;
+	}
+	PQsetnonblocking( data->pgconn, 0 );
+	if( !data->eof ){
+		char *buffer;
+		wal_send_status( data, 0 );
+		gvl_PQputCopyEnd( data->pgconn, NULL );
+		while( gvl_PQgetCopyData(data->pgconn, &buffer, 0) > 0 )
+			PQfreemem( buffer );
+	} else {
+		/* The stream was ended by the server, so that the COPY BOTH mode must be ended
+		 * on our side by CopyDone. PG::Connection#discard_results would send CopyFail,
+		 * which terminates the walsender. */
+		PGresult *res = gvl_PQgetResult( data->pgconn );
+		if( res && PQresultStatus(res) == PGRES_COPY_IN )
+			gvl_PQputCopyEnd( data->pgconn, NULL );
+		PQclear( res );
+	}
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.receive_wal( dir, start_lsn, timeline, segment_size, fsync_bytes, status_interval ) {|path| ... } -> Hash
+ *
+ * Receives WAL of a running <tt>START_REPLICATION ... PHYSICAL</tt> command and stores it in
+ * segment files of _dir_ , like pg_receivewal does.
+ * Use PG::Connection#stream_wal instead of this low level method.
+ *
+ * The data is written per pwrite() into files with the suffix <tt>.partial</tt> , which are renamed
+ * when the segment is complete. Files are fsync'ed after _fsync_bytes_ of data and before the
+ * position is reported to the server, at least every _status_interval_ seconds.
+ * The GVL is released while receiving and writing.
+ *
+ * The block is called with the path of each completed segment.
+ * Returns a Hash with the +:written_lsn+ and +:flushed_lsn+ when the server ended the stream.
+ * The COPY mode is then ended, but the results of the replication command must still be retrieved.
+ */
+static VALUE
+pgconn_receive_wal( VALUE self, VALUE dir, VALUE start_lsn, VALUE timeline, VALUE segment_size,
+		VALUE fsync_bytes, VALUE status_interval )
+{
+	struct wal_receive_data data;
+	VALUE hash;
+
+	memset( &data, 0, sizeof(data) );
+	data.self = self;
+	data.pgconn = pg_get_pgconn( self );
+	data.dir = rb_str_new_frozen( rb_get_path(dir) );
+	data.timeline = NUM2UINT( timeline );
+	data.segment_size = NUM2ULL( segment_size );
+	data.written_lsn = data.flushed_lsn = NUM2ULL( start_lsn );
+	data.fsync_bytes = NUM2ULL( fsync_bytes );
+	data.status_interval = (int64_t)(NUM2DBL( status_interval ) * 1000000);
+	data.next_status = pg_repl_monotonic_usec();
+	data.fd = -1;
+
+	if( data.segment_size == 0 || (data.segment_size & (data.segment_size - 1)) || data.segment_size > UINT64_C(0x40000000) )
+		rb_raise( rb_eArgError, "invalid WAL segment size %" PRIu64, data.segment_size );
+	if( PQsetnonblocking(data.pgconn, 1) != 0 )
+		rb_raise( rb_ePGerror, "%s", PQerrorMessage(data.pgconn) );
+
+	rb_ensure( wal_receive_body, (VALUE)&data, wal_receive_cleanup, (VALUE)&data );
+
+	hash = rb_hash_new();
+	rb_hash_aset( hash, ID2SYM(rb_intern("written_lsn")), ULL2NUM(data.written_lsn) );
+	rb_hash_aset( hash, ID2SYM(rb_intern("flushed_lsn")), ULL2NUM(data.flushed_lsn) );
+	RB_GC_GUARD( data.dir );
+	return hash;
+}
+
+
+/* Extraction of a tar stream into a directory */
+struct tar_extract {
+	char header[512];
+	size_t header_fill;
+	/* Bytes of the current entry still to be received */
+	uint64_t remaining;
+	/* Bytes of padding after the current entry */
+	uint64_t padding;
+	/* File of the current entry or -1 */
+	int fd;
+	char root[1024];
+	/* Target directory of tablespace symlinks or empty */
+	char tablespace_dir[1024];
+};
+
+static uint64_t
+tar_octal( const char *p, size_t len )
+{
+	uint64_t val = 0;
+	size_t i;
+	for( i=0; i<len && p[i]; i++ ){
+		if( p[i] >= '0' && p[i] <= '7' )
+			val = (val << 3) + (p[i] - '0');
+	}
+	return val;
+}
+
+/* Create all missing directories of +path+ . */
+static int
+tar_mkdir_p( char *path, int including_last )
+{
+	char *p;
+	for( p = path + 1; *p; p++ ){
+		if( *p == '/' ){
+			*p = 0;
+			if( mkdir(path, 0700) < 0 && errno != EEXIST ){
+				*p = '/';
+				return errno;
+			}
+			*p = '/';
+		}
+	}
+	if( including_last && mkdir(path, 0700) < 0 && errno != EEXIST )
+		return errno;
+	return 0;
+}
+
+static int
+tar_start_entry( struct tar_extract *tar )
+{
+	char name[256];
+	char path[2048];
+	char type = tar->header[156];
+	int mode = (int)tar_octal( tar->header + 100, 8 ) & 07777;
+	uint64_t size = tar_octal( tar->header + 124, 12 );
+	int err;
+
+	/* ustar stores long names in a prefix field */
+	if( memcmp(tar->header + 257, "ustar", 5) == 0 && tar->header[345] ){
+		snprintf( name, sizeof(name), "%.155s/%.100s", tar->header + 345, tar->header );
+	} else {
+		snprintf( name, sizeof(name), "%.100s", tar->header );
+	}
+	if( name[0] == '/' || strstr(name, "..") )
+		return EINVAL;
+	while( name[0] == '.' && name[1] == '/' )
+		memmove( name, name + 2, strlen(name + 2) + 1 );
+
+	snprintf( path, sizeof(path), "%s/%s", tar->root, name );
+	tar->remaining = size;
+	tar->padding = (512 - size % 512) % 512;
+
+	switch( type ){
+		case '5':
+			return tar_mkdir_p( path, 1 );
+		case '0':
+		case '\0':
+			if( (err = tar_mkdir_p(path, 0)) ) return err;
+			/* Don't write through a symlink of the archive. */
+			tar->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, mode ? mode : 0600 );
+			if( tar->fd < 0 ) return errno;
+			if( size == 0 ){
+				close( tar->fd );
+				tar->fd = -1;
+			}
+			return 0;
+		case '2': {
+			char target[2048];
+			/* Only tablespace links are expected. They are linked to the extracted copy of
+			 * the tablespace, so that no symlink of the archive points outside of the root. */
+			if( !tar->tablespace_dir[0] || strncmp(name, "pg_tblspc/", 10) != 0 ||
+					!name[10] || strchr(name + 10, '/') )
+				return EINVAL;
+			if( (err = tar_mkdir_p(path, 0)) ) return err;
+			snprintf( target, sizeof(target), "%s/%s", tar->tablespace_dir, name + 10 );
+			unlink( path );
+			if( symlink(target, path) < 0 ) return errno;
+			return 0;
+		}
+		default:
+			/* Skip other entry types */
+			return 0;
+	}
+}
+
+/* Process a chunk of a tar stream. Returns 0 or an errno value. */
+static int
+tar_extract_data( struct tar_extract *tar, const char *buf, size_t len )
+{
+	int err;
+
+	while( len > 0 ){
+		if( tar->remaining > 0 ){
+			size_t chunk = len < tar->remaining ? len : (size_t)tar->remaining;
+			if( tar->fd >= 0 ){
+				const char *p = buf;
+				size_t left = chunk;
+				while( left > 0 ){
+					ssize_t ret = write( tar->fd, p, left );
+					if( ret < 0 ){
+						if( errno == EINTR ) continue;
+						return errno;
+					}
+					p += ret;
+					left -= ret;
+				}
+			}
+			buf += chunk;
+			len -= chunk;
+			tar->remaining -= chunk;
+			if( tar->remaining == 0 && tar->fd >= 0 ){
+				if( close(tar->fd) < 0 ) return errno;
+				tar->fd = -1;
+			}
+		} else if( tar->padding > 0 ){
+			size_t chunk = len < tar->padding ? len : (size_t)tar->padding;
+			buf += chunk;
+			len -= chunk;
+			tar->padding -= chunk;
+		} else {
+			size_t chunk = sizeof(tar->header) - tar->header_fill;
+			if( chunk > len ) chunk = len;
+			memcpy( tar->header + tar->header_fill, buf, chunk );
+			tar->header_fill += chunk;
+			buf += chunk;
+			len -= chunk;
+
+			if( tar->header_fill == sizeof(tar->header) ){
+				tar->header_fill = 0;
+				/* Zero blocks mark the end of the archive. */
+				if( tar->header[0] && (err = tar_start_entry(tar)) )
+					return err;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/* State of the transfer of BASE_BACKUP archives */
+struct backup_receive_data {
+	VALUE self;
+	PGconn *pgconn;
+	VALUE dir;
+	int plain;
+	/* Messages of the archive stream are framed (PostgreSQL-15+) */
+	int framed;
+	/* Archive file in tar format or -1 */
+	int fd;
+	/* The backup manifest is received */
+	int manifest;
+	struct tar_extract tar;
+	/* Message of a new archive, to be processed with GVL */
+	char *new_archive;
+	volatile int interrupted;
+	/* 0 = OK, -1 = error in libpq, otherwise an errno value */
+	int error;
+	int eof;
+};
+
+static int
+backup_write( struct backup_receive_data *data, const char *buf, size_t len )
+{
+	if( data->plain && !data->manifest )
+		return tar_extract_data( &data->tar, buf, len );
+
+	while( len > 0 ){
+		ssize_t ret = write( data->fd, buf, len );
+		if( ret < 0 ){
+			if( errno == EINTR ) continue;
+			return errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void *
+backup_receive_nogvl( void *ptr )
+{
+	struct backup_receive_data *data = ptr;
+
+	while( !data->interrupted ){
+		char *buffer;
+		int len = PQgetCopyData( data->pgconn, &buffer, 1 );
+
+		if( len == 0 ){
+			struct pollfd pfd;
+			pfd.fd = PQsocket( data->pgconn );
+			pfd.events = POLLIN;
+			if( poll(&pfd, 1, 100) < 0 && errno != EINTR ){
+				data->error = errno;
+				return NULL;
+			}
+			if( !PQconsumeInput(data->pgconn) ){
+				data->error = -1;
+				return NULL;
+			}
+			continue;
+		}
+		if( len == -1 ){
+			data->eof = 1;
+			return NULL;
+		}
+		if( len < 0 ){
+			data->error = -1;
+			return NULL;
+		}
+
+		if( !data->framed ){
+			data->error = backup_write( data, buffer, len );
+		} else switch( buffer[0] ){
+			case 'n':
+			case 'm':
+				/* Open the next archive or the manifest with GVL. */
+				data->new_archive = buffer;
+				return NULL;
+			case 'd':
+				if( data->fd >= 0 || (data->plain && !data->manifest) )
+					data->error = backup_write( data, buffer + 1, len - 1 );
+				break;
+			default:
+				/* Progress reports are ignored. */
+				break;
+		}
+		PQfreemem( buffer );
+		if( data->error ) return NULL;
+	}
+	return NULL;
+}
+
+static void
+backup_close( struct backup_receive_data *data )
+{
+	if( data->fd >= 0 ){
+		fsync( data->fd );
+		close( data->fd );
+		data->fd = -1;
+	}
+	if( data->tar.fd >= 0 ){
+		close( data->tar.fd );
+		data->tar.fd = -1;
+	}
+}
+
+/* Start writing archive _name_ of the tablespace in _location_ . */
+static void
+backup_open( struct backup_receive_data *data, const char *name, int manifest )
+{
+	char path[2048];
+	const char *dir = RSTRING_PTR( data->dir );
+
+	backup_close( data );
+	data->manifest = manifest;
+
+	if( data->plain && !manifest ){
+		memset( &data->tar, 0, sizeof(data->tar) );
+		data->tar.fd = -1;
+		if( strcmp(name, "base.tar") == 0 ){
+			snprintf( data->tar.root, sizeof(data->tar.root), "%s", dir );
+			snprintf( data->tar.tablespace_dir, sizeof(data->tar.tablespace_dir), "%s/tablespaces", dir );
+		} else if( strcmp(name, "pg_wal.tar") == 0 ){
+			snprintf( data->tar.root, sizeof(data->tar.root), "%s/pg_wal", dir );
+			tar_mkdir_p( data->tar.root, 1 );
+		} else {
+			/* Other tablespaces are extracted to tablespaces/<oid> */
+			snprintf( data->tar.root, sizeof(data->tar.root), "%s/tablespaces/%.*s", dir,
+					(int)(strlen(name) > 4 ? strlen(name) - 4 : strlen(name)), name );
+			tar_mkdir_p( data->tar.root, 1 );
+		}
+		return;
+	}
+
+	snprintf( path, sizeof(path), "%s/%s", dir, manifest ? "backup_manifest" : name );
+	data->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+	if( data->fd < 0 )
+		rb_syserr_fail_str( errno, rb_str_new_cstr(path) );
+}
+
+struct backup_receive_args {
+	struct backup_receive_data *data;
+	VALUE archives;
+};
+
+static VALUE
+backup_receive_body( VALUE ptr )
+{
+	struct backup_receive_args *args = (struct backup_receive_args *)ptr;
+	struct backup_receive_data *data = args->data;
+
+	for(;;){
+		int state = 0;
+
+		rb_thread_call_without_gvl( backup_receive_nogvl, data, pgconn_transfer_ubf, (void *)&data->interrupted );
+
+		if( data->error == -1 ){
+			VALUE error = rb_exc_new2( rb_ePGerror, PQerrorMessage(data->pgconn) );
+			rb_iv_set( error, "@connection", data->self );
+			rb_exc_raise( error );
+		} else if( data->error ){
+			rb_syserr_fail( data->error, "write of base backup" );
+		}
+
+		if( data->new_archive ){
+			char *msg = data->new_archive;
+			int manifest = msg[0] == 'm';
+			VALUE name = rb_str_new_cstr( manifest ? "backup_manifest" : msg + 1 );
+
+			data->new_archive = NULL;
+			PQfreemem( msg );
+			if( strchr(RSTRING_PTR(name), '/') )
+				rb_raise( rb_eArgError, "invalid archive name %" PRIsVALUE, name );
+			backup_open( data, RSTRING_PTR(name), manifest );
+			rb_ary_push( args->archives, name );
+			continue;
+		}
+		if( data->eof )
+			break;
+
+		/* Process pending interrupts and continue the transfer. */
+		data->interrupted = 0;
+		rb_protect( pgconn_check_ints, Qnil, &state );
+		if( state ) rb_jump_tag( state );
+	}
+	return Qnil;
+}
+
+static VALUE
+backup_receive_cleanup( VALUE ptr )
+{
+	struct backup_receive_args *args = (struct backup_receive_args *)ptr;
+	struct backup_receive_data *data = args->data;
+
+	backup_close( data );
+	if( data->new_archive ){
+		PQfreemem( data->new_archive );
+		data->new_archive = NULL;
+	}
+	if( !data->eof ){
+		char *buffer;
+		rb_funcall( data->self, rb_intern("cancel"), 0 );
+		while( gvl_PQgetCopyData(data->pgconn, &buffer, 0) > 0 )
+			PQfreemem( buffer );
+	}
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.receive_base_backup( dir, plain, framed, archive_name = nil ) -> Array
+ *
+ * Receives the archives of a running +BASE_BACKUP+ command into _dir_ .
+ * Use PG::Connection#base_backup instead of this low level method.
+ *
+ * The connection must be in COPY OUT state. If _framed_ is +true+ the archives are received
+ * in the format of PostgreSQL-15+, with messages for each new archive and the manifest.
+ * Otherwise the COPY data is one archive named _archive_name_ .
+ *
+ * The archives are written as tar files or are extracted, if _plain_ is +true+ .
+ * The base archive is then extracted into _dir_ , the WAL archive into <tt>dir/pg_wal</tt>
+ * and other tablespaces into <tt>dir/tablespaces/<oid></tt> . The GVL is released while receiving and writing.
+ *
+ * Returns the names of the received archives.
+ */
+static VALUE
+pgconn_receive_base_backup( int argc, VALUE *argv, VALUE self )
+{
+	struct backup_receive_data data;
+	struct backup_receive_args args;
+	VALUE dir, plain, framed, archive_name;
+
+	rb_scan_args( argc, argv, "31", &dir, &plain, &framed, &archive_name );
+
+	memset( &data, 0, sizeof(data) );
+	data.self = self;
+	data.pgconn = pg_get_pgconn( self );
+	data.dir = rb_str_new_frozen( rb_get_path(dir) );
+	data.plain = RTEST( plain );
+	data.framed = RTEST( framed );
+	data.fd = -1;
+	data.tar.fd = -1;
+	args.data = &data;
+	args.archives = rb_ary_new();
+
+	if( !data.framed ){
+		StringValue( archive_name );
+		backup_open( &data, StringValueCStr(archive_name), strcmp(RSTRING_PTR(archive_name), "backup_manifest") == 0 );
+		rb_ary_push( args.archives, archive_name );
+	}
+
+	rb_ensure( backup_receive_body, (VALUE)&args, backup_receive_cleanup, (VALUE)&args );
+
+	RB_GC_GUARD( data.dir );
+	return args.archives;
+}
+
+#endif /* PG_HAVE_PHYSICAL_REPLICATION */
+
+
+#define PG_DEFINE_SYM(name) (sym_##name = ID2SYM(rb_intern(#name)))
+
+void
+init_pg_replication()
+{
+	PG_DEFINE_SYM(type); PG_DEFINE_SYM(xlog_data); PG_DEFINE_SYM(keepalive); PG_DEFINE_SYM(wal_start);
+	PG_DEFINE_SYM(wal_end); PG_DEFINE_SYM(send_time); PG_DEFINE_SYM(data); PG_DEFINE_SYM(reply_requested);
+	PG_DEFINE_SYM(begin); PG_DEFINE_SYM(commit); PG_DEFINE_SYM(origin); PG_DEFINE_SYM(relation);
+	PG_DEFINE_SYM(type_info); PG_DEFINE_SYM(insert); PG_DEFINE_SYM(update); PG_DEFINE_SYM(delete);
+	PG_DEFINE_SYM(truncate); PG_DEFINE_SYM(message); PG_DEFINE_SYM(unknown);
+	PG_DEFINE_SYM(final_lsn); PG_DEFINE_SYM(commit_lsn); PG_DEFINE_SYM(end_lsn); PG_DEFINE_SYM(commit_time);
+	PG_DEFINE_SYM(xid); PG_DEFINE_SYM(flags); PG_DEFINE_SYM(lsn); PG_DEFINE_SYM(name); PG_DEFINE_SYM(oid);
+	PG_DEFINE_SYM(namespace); PG_DEFINE_SYM(replica_identity); PG_DEFINE_SYM(columns);
+	PG_DEFINE_SYM(type_oid); PG_DEFINE_SYM(type_modifier); PG_DEFINE_SYM(key); PG_DEFINE_SYM(new);
+	PG_DEFINE_SYM(old); PG_DEFINE_SYM(relations); PG_DEFINE_SYM(cascade); PG_DEFINE_SYM(restart_identity);
+	PG_DEFINE_SYM(transactional); PG_DEFINE_SYM(prefix); PG_DEFINE_SYM(content); PG_DEFINE_SYM(tag);
+	PG_DEFINE_SYM(unchanged_toast);
+
+	/*
+	 * Document-module: PG::Replication
+	 *
+	 * Functions to parse and build the messages of the streaming replication protocol,
+	 * which are exchanged per PG::Connection#get_copy_data and PG::Connection#put_copy_data
+	 * after a +START_REPLICATION+ command.
+	 *
+	 * See PG::LogicalReplication for a complete client of logical replication.
+	 */
+	rb_mPG_Replication = rb_define_module_under( rb_mPG, "Replication" );
+	rb_define_singleton_method( rb_mPG_Replication, "parse_copy_data", pg_repl_s_parse_copy_data, 1 );
+	rb_define_singleton_method( rb_mPG_Replication, "standby_status_update", pg_repl_s_standby_status_update, -1 );
+
+	/*
+	 * Document-class: PG::Replication::PgoutputDecoder
+	 *
+	 * Decoder for the messages of the +pgoutput+ logical decoding plugin, which is the
+	 * plugin used by PostgreSQL's built-in logical replication.
+	 *
+	 * The decoder keeps track of the Relation messages, to decode the tuples of subsequent
+	 * Insert, Update and Delete messages.
+	 */
+	rb_cPG_PgoutputDecoder = rb_define_class_under( rb_mPG_Replication, "PgoutputDecoder", rb_cObject );
+	rb_define_alloc_func( rb_cPG_PgoutputDecoder, pg_pgoutput_s_allocate );
+	rb_define_method( rb_cPG_PgoutputDecoder, "initialize", pg_pgoutput_init, -1 );
+	rb_define_method( rb_cPG_PgoutputDecoder, "type_map", pg_pgoutput_type_map, 0 );
+	rb_define_method( rb_cPG_PgoutputDecoder, "relations", pg_pgoutput_relations, 0 );
+	rb_define_method( rb_cPG_PgoutputDecoder, "decode", pg_pgoutput_decode, 1 );
+
+#ifdef PG_HAVE_PHYSICAL_REPLICATION
+	rb_define_method( rb_cPGconn, "receive_wal", pgconn_receive_wal, 6 );
+	rb_define_method( rb_cPGconn, "receive_base_backup", pgconn_receive_base_backup, -1 );
+#endif
+}
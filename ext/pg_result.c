@@ -6,10 +6,17 @@
 
 #include "pg.h"
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_POLL_H)
+#define PG_HAVE_READ_AHEAD
+#include <pthread.h>
+#include <poll.h>
+#endif
+
 VALUE rb_cPGresult;
 static VALUE sym_symbol, sym_string, sym_static_symbol;
 
 static VALUE pgresult_type_map_set( VALUE, VALUE );
+static void pgresult_update_size( t_pg_result * );
 static t_pg_result *pgresult_get_this( VALUE );
 static t_pg_result *pgresult_get_this_safe( VALUE );
 
@@ -115,6 +122,8 @@ pgresult_gc_mark( t_pg_result *this )
 	rb_gc_mark( this->typemap );
 	rb_gc_mark( this->tuple_hash );
 	rb_gc_mark( this->field_map );
+	rb_gc_mark( this->mat_values );
+	rb_gc_mark( this->cmd_status );
 
 	for( i=0; i < this->nfields; i++ ){
 		rb_gc_mark( this->fnames[i] );
@@ -136,6 +145,7 @@ pgresult_clear( t_pg_result *this )
 	this->result_size = 0;
 	this->nfields = -1;
 	this->pgresult = NULL;
+	this->mat_values = Qnil;
 }
 
 static void
@@ -195,10 +205,14 @@ pg_new_result2(PGresult *result, VALUE rb_pgconn)
 	this->nfields = -1;
 	this->tuple_hash = Qnil;
 	this->field_map = Qnil;
+	this->mat_values = Qnil;
+	this->mat_ntuples = 0;
+	this->cmd_status = Qnil;
 	this->flags = 0;
+	memset(&this->decode_stats, 0, sizeof(this->decode_stats));
 	self = TypedData_Wrap_Struct(rb_cPGresult, &pgresult_type, this);
 
-	if( result ){
+	if( result && !NIL_P(rb_pgconn) ){
 		t_pg_connection *p_conn = pg_get_connection(rb_pgconn);
 		VALUE typemap = p_conn->type_map_for_results;
 		/* Type check is done when assigned to PG::Connection. */
@@ -222,6 +236,25 @@ pg_new_result(PGresult *result, VALUE rb_pgconn)
 	t_pg_result *this = pgresult_get_this(self);
 
 	this->autoclear = 0;
+	this->result_size = 0;
+	pgresult_update_size(this);
+
+	if( result && !NIL_P(rb_pgconn) ){
+		t_pg_alloc_stats *stats = &pg_get_connection(rb_pgconn)->alloc_stats;
+		stats->results++;
+		stats->result_bytes += this->result_size;
+	}
+
+	return self;
+}
+
+/*
+ * Estimate size of underlying pgresult memory storage and account the change to ruby GC.
+ */
+static void
+pgresult_update_size(t_pg_result *this)
+{
+	ssize_t old_size = this->result_size;
 
 	/* Estimate size of underlying pgresult memory storage and account to ruby GC.
 	 * There's no need to adjust the GC for xmalloc'ed memory, but libpq is using libc malloc() ruby doesn't know about.
@@ -229,13 +262,11 @@ pg_new_result(PGresult *result, VALUE rb_pgconn)
 	/* TODO: If someday most systems provide PQresultMemorySize(), it's questionable to store result_size in t_pg_result in addition to the value already stored in PGresult.
 	 * For now the memory savings don't justify the ifdefs necessary to support both cases.
 	 */
-	this->result_size = pgresult_approx_size(result);
+	this->result_size = pgresult_approx_size(this->pgresult);
 
 #ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
-	rb_gc_adjust_memory_usage(this->result_size);
+	rb_gc_adjust_memory_usage(this->result_size - old_size);
 #endif
-
-	return self;
 }
 
 static VALUE
@@ -252,6 +283,55 @@ pg_copy_result(t_pg_result *this)
 	return TypedData_Wrap_Struct(rb_cPGresult, &pgresult_type, copy);
 }
 
+/*
+ * Create a PG::Result with a copy of the values of one tuple of the given result.
+ *
+ * Fields with values[i] != Qundef are already retrieved and are stored as NULL.
+ * The new result uses +typemap+ instead of the type map of the given result.
+ * It's used by PG::Tuple#compact! to release the reference to the whole result.
+ */
+VALUE
+pg_result_copy_tuple(VALUE self, int tuple_num, VALUE typemap, const VALUE *values)
+{
+	t_pg_result *this = pgresult_get_this_safe(self);
+	int nfields = PQnfields(this->pgresult);
+	int field;
+	PGresult *copy;
+	VALUE rb_copy;
+	t_pg_result *p_copy;
+
+	copy = PQcopyResult(this->pgresult, PG_COPYRES_ATTRS);
+	if( copy == NULL )
+		rb_raise( rb_eNoMemError, "out of memory while copying the tuple" );
+
+	/* Add the tuple, so that it exists even when no value is copied. All values are NULL initially. */
+	if( !PQsetvalue(copy, 0, 0, NULL, -1) ){
+		PQclear(copy);
+		rb_raise( rb_eNoMemError, "out of memory while copying the tuple" );
+	}
+	for( field = 0; field < nfields; field++ ){
+		if( values[field] != Qundef || PQgetisnull(this->pgresult, tuple_num, field) )
+			continue;
+		if( !PQsetvalue(copy, 0, field, PQgetvalue(this->pgresult, tuple_num, field), PQgetlength(this->pgresult, tuple_num, field)) ){
+			PQclear(copy);
+			rb_raise( rb_eNoMemError, "out of memory while copying the tuple" );
+		}
+	}
+
+	rb_copy = pg_new_result2(copy, Qnil);
+	p_copy = pgresult_get_this(rb_copy);
+	p_copy->connection = this->connection;
+	p_copy->enc_idx = this->enc_idx;
+	p_copy->flags = this->flags;
+	p_copy->typemap = typemap;
+	p_copy->p_typemap = DATA_PTR( typemap );
+	p_copy->autoclear = 0;
+	p_copy->result_size = 0;
+	pgresult_update_size(p_copy);
+
+	return rb_copy;
+}
+
 VALUE
 pg_new_result_autoclear(PGresult *result, VALUE rb_pgconn)
 {
@@ -295,12 +375,20 @@ pg_result_check( VALUE self )
 		case PGRES_SINGLE_TUPLE:
 		case PGRES_EMPTY_QUERY:
 		case PGRES_COMMAND_OK:
+#ifdef HAVE_PQENTERPIPELINEMODE
+		case PGRES_PIPELINE_SYNC:
+#endif
 			return self;
 		case PGRES_BAD_RESPONSE:
 		case PGRES_FATAL_ERROR:
 		case PGRES_NONFATAL_ERROR:
 			error = rb_str_new2( PQresultErrorMessage(this->pgresult) );
 			break;
+#ifdef HAVE_PQENTERPIPELINEMODE
+		case PGRES_PIPELINE_ABORTED:
+			error = rb_str_new2( "query skipped because of an earlier error in the pipeline" );
+			break;
+#endif
 		default:
 			error = rb_str_new2( "internal error : unknown result status." );
 		}
@@ -325,6 +413,13 @@ pg_result_check( VALUE self )
  * doesn't handle blocks, check results, etc. Once connection and result are disentangled
  * a bit more, I can make this a static pgresult_clear() again.
  */
+VALUE
+pg_result_clear(VALUE self)
+{
+	t_pg_result *this = pgresult_get_this(self);
+	pgresult_clear( this );
+	return Qnil;
+}
 
 /*
  * call-seq:
@@ -340,13 +435,14 @@ pg_result_check( VALUE self )
  *
  * If PG::Result#autoclear? is +true+ then the result is only marked as cleared but clearing the underlying C struct will happen when the callback returns.
  *
+ * A frozen result, like the results shared by PG::QueryCache , can't be cleared.
+ *
  */
-VALUE
-pg_result_clear(VALUE self)
+static VALUE
+pgresult_clear_m(VALUE self)
 {
-	t_pg_result *this = pgresult_get_this(self);
-	pgresult_clear( this );
-	return Qnil;
+	rb_check_frozen( self );
+	return pg_result_clear( self );
 }
 
 /*
@@ -379,6 +475,453 @@ pgresult_autoclear_p( VALUE self )
 	return this->autoclear ? Qtrue : Qfalse;
 }
 
+/*
+ * call-seq:
+ *    res.memsize -> Integer
+ *
+ * Returns the number of bytes of memory allocated by libpq for this result.
+ *
+ * The value is retrieved per PQresultMemorySize() on PostgreSQL-12+ and is estimated from
+ * a sample of the field values otherwise. It is 0 after #clear .
+ */
+static VALUE
+pgresult_memsize_get( VALUE self )
+{
+	t_pg_result *this = pgresult_get_this(self);
+	return this->pgresult ? SSIZET2NUM(this->result_size) : INT2FIX(0);
+}
+
+/*
+ * call-seq:
+ *    res.materialize! -> self
+ *
+ * Type casts all values of the result and releases the memory held by libpq.
+ *
+ * The values are decoded once per #type_map and stored as frozen objects within the
+ * Result object. Afterwards the PGresult is replaced by a copy that retains the
+ * result status and the field descriptions only.
+ * All value retrieval methods like #each, #values, #tuple or #column_values keep
+ * working, but return the stored objects instead of decoding the values again.
+ * So a result, that is kept for a long time, needs the memory of the Ruby objects only
+ * and no longer the text values of libpq in addition.
+ *
+ * Whether this saves memory depends on the values: Integers, Floats, booleans and +nil+
+ * need just one slot in the Array of values, which is less than the text and the
+ * descriptor of each value in libpq. String values however need an object and a copy
+ * of the text each, which is more than libpq needs for them.
+ * #memsize reports the remaining memory of libpq only.
+ *
+ * The #type_map can't be changed after #materialize! .
+ * Results other than +PGRES_TUPLES_OK+ and +PGRES_SINGLE_TUPLE+ are left unchanged.
+ */
+static VALUE
+pgresult_materialize_bang( VALUE self )
+{
+	t_pg_result *this = pgresult_get_this_safe(self);
+	PGresult *attrs;
+	VALUE values;
+	int ntuples, nfields, tuple, field;
+
+	if( !NIL_P(this->mat_values) )
+		return self;
+	if( this->autoclear )
+		rb_raise( rb_ePGerror, "results of a notice receiver can't be materialized" );
+	switch( PQresultStatus(this->pgresult) ){
+		case PGRES_TUPLES_OK:
+		case PGRES_SINGLE_TUPLE:
+			break;
+		default:
+			return self;
+	}
+
+	ntuples = PQntuples(this->pgresult);
+	nfields = PQnfields(this->pgresult);
+	values = rb_ary_new2( (long)ntuples * nfields );
+	for( tuple = 0; tuple < ntuples; tuple++ ){
+		for( field = 0; field < nfields; field++ ){
+			VALUE value = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, tuple, field);
+			rb_ary_push( values, rb_obj_freeze(pgresult_account_value(this, value)) );
+		}
+	}
+	this->decode_stats.arrays++;
+
+	attrs = PQcopyResult( this->pgresult, PG_COPYRES_ATTRS );
+	if( attrs == NULL )
+		rb_raise( rb_eNoMemError, "out of memory while materializing the result" );
+
+	PQclear( this->pgresult );
+	this->pgresult = attrs;
+	this->mat_values = values;
+	this->mat_ntuples = ntuples;
+	/* The reused Hash of #[] would keep the last row alive. */
+	this->tuple_hash = Qnil;
+	pgresult_update_size( this );
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *    res.materialized? -> Boolean
+ *
+ * Returns +true+ if the values were decoded and the libpq memory released per #materialize! .
+ */
+static VALUE
+pgresult_materialized_p( VALUE self )
+{
+	t_pg_result *this = pgresult_get_this(self);
+	return NIL_P(this->mat_values) ? Qfalse : Qtrue;
+}
+
+/*
+ * call-seq:
+ *    res.dup -> PG::Result
+ *
+ * Returns an independent copy of the result.
+ *
+ * The copy has its own PGresult with the field descriptions, values and
+ * command status of the result, so that it's valid after #clear of the original.
+ * It uses the same #type_map and stores the same objects of a #materialize!'d result.
+ * The copy isn't frozen, so that the shared results of PG::QueryCache or
+ * PG::Singleflight can be duplicated to get a result, that may be cleared.
+ *
+ * Error messages and #oid_value are not retained by libpq's copy.
+ */
+static VALUE
+pgresult_dup( VALUE self )
+{
+	t_pg_result *this = pgresult_get_this_safe(self);
+	VALUE rb_copy;
+	t_pg_result *p_copy;
+	PGresult *copy;
+
+	copy = PQcopyResult( this->pgresult, PG_COPYRES_ATTRS | PG_COPYRES_TUPLES | PG_COPYRES_NOTICEHOOKS );
+	if( copy == NULL )
+		rb_raise( rb_eNoMemError, "out of memory while copying the result" );
+
+	rb_copy = pg_new_result2(copy, Qnil);
+	p_copy = pgresult_get_this(rb_copy);
+	p_copy->connection = this->connection;
+	p_copy->enc_idx = this->enc_idx;
+	p_copy->flags = this->flags;
+	p_copy->typemap = this->typemap;
+	p_copy->p_typemap = this->p_typemap;
+	p_copy->mat_values = this->mat_values;
+	p_copy->mat_ntuples = this->mat_ntuples;
+	if( NIL_P(this->cmd_status) ){
+		/* PQcopyResult doesn't copy the command status */
+		p_copy->cmd_status = rb_str_new2( PQcmdStatus(this->pgresult) );
+		PG_ENCODING_SET_NOCHECK( p_copy->cmd_status, this->enc_idx );
+		rb_obj_freeze( p_copy->cmd_status );
+	} else {
+		p_copy->cmd_status = this->cmd_status;
+	}
+	if( this->nfields != -1 ){
+		memcpy( p_copy->fnames, this->fnames, sizeof(*this->fnames) * this->nfields );
+		p_copy->nfields = this->nfields;
+	}
+	p_copy->autoclear = 0;
+	p_copy->result_size = 0;
+	pgresult_update_size(p_copy);
+
+	return rb_copy;
+}
+
+/*
+ * Binary serialization of results
+ *
+ * The data starts with PG_RESULT_DUMP_MAGIC followed by the result status, the name of the
+ * encoding, the command status and the field descriptions. Then all values follow row by row.
+ * Strings and values are stored with a variable length integer prefix (7 bits per byte, least
+ * significant first). It is 0 for NULL values and the length + 1 otherwise.
+ * Other integers are stored in network byte order.
+ */
+#define PG_RESULT_DUMP_MAGIC "PGR\001"
+
+static void
+pgresult_dump_uint( VALUE str, uint32_t value, int bytes )
+{
+	char buf[4];
+	int i;
+
+	for( i = bytes - 1; i >= 0; i-- ){
+		buf[i] = value & 0xff;
+		value >>= 8;
+	}
+	rb_str_buf_cat( str, buf, bytes );
+}
+
+static void
+pgresult_dump_varint( VALUE str, size_t value )
+{
+	char buf[10];
+	int n = 0;
+
+	do {
+		buf[n] = value & 0x7f;
+		value >>= 7;
+		if( value ) buf[n] |= 0x80;
+		n++;
+	} while( value );
+	rb_str_buf_cat( str, buf, n );
+}
+
+static void
+pgresult_dump_string( VALUE str, const char *ptr, long len )
+{
+	if( ptr == NULL ){
+		pgresult_dump_varint( str, 0 );
+	} else {
+		pgresult_dump_varint( str, (size_t)len + 1 );
+		rb_str_buf_cat( str, ptr, len );
+	}
+}
+
+/*
+ * call-seq:
+ *    res.dump_binary_raw -> String
+ *
+ * Serialize the result without compression. See #dump_binary .
+ */
+static VALUE
+pgresult_dump_binary_raw( VALUE self )
+{
+	t_pg_result *this = pgresult_get_this_safe(self);
+	PGresult *result = this->pgresult;
+	int nfields = PQnfields(result);
+	int ntuples = PQntuples(result);
+	const char *encname = rb_enc_name(rb_enc_from_index(this->enc_idx));
+	const char *cmd_status;
+	int tuple, field;
+	VALUE str;
+
+	switch( PQresultStatus(result) ){
+		case PGRES_TUPLES_OK:
+		case PGRES_SINGLE_TUPLE:
+		case PGRES_COMMAND_OK:
+			break;
+		default:
+			rb_raise( rb_eInvalidResultStatus, "only results of successful commands can be dumped, but status is %s",
+					PQresStatus(PQresultStatus(result)) );
+	}
+	if( !NIL_P(this->mat_values) )
+		rb_raise( rb_ePGerror, "the values of a materialized result can't be dumped" );
+
+	str = rb_str_buf_new( this->result_size );
+	rb_str_buf_cat( str, PG_RESULT_DUMP_MAGIC, 4 );
+	pgresult_dump_uint( str, PQresultStatus(result), 1 );
+	pgresult_dump_string( str, encname, strlen(encname) );
+	cmd_status = NIL_P(this->cmd_status) ? PQcmdStatus(result) : RSTRING_PTR(this->cmd_status);
+	pgresult_dump_string( str, cmd_status, strlen(cmd_status) );
+
+	pgresult_dump_varint( str, nfields );
+	for( field = 0; field < nfields; field++ ){
+		const char *fname = PQfname(result, field);
+		pgresult_dump_string( str, fname, strlen(fname) );
+		pgresult_dump_uint( str, PQftable(result, field), 4 );
+		pgresult_dump_uint( str, PQftablecol(result, field), 2 );
+		pgresult_dump_uint( str, PQfformat(result, field), 1 );
+		pgresult_dump_uint( str, PQftype(result, field), 4 );
+		pgresult_dump_uint( str, (uint16_t)PQfsize(result, field), 2 );
+		pgresult_dump_uint( str, (uint32_t)PQfmod(result, field), 4 );
+	}
+
+	pgresult_dump_varint( str, ntuples );
+	for( tuple = 0; tuple < ntuples; tuple++ ){
+		for( field = 0; field < nfields; field++ ){
+			if( PQgetisnull(result, tuple, field) )
+				pgresult_dump_string( str, NULL, 0 );
+			else
+				pgresult_dump_string( str, PQgetvalue(result, tuple, field), PQgetlength(result, tuple, field) );
+		}
+	}
+
+	return str;
+}
+
+struct pgresult_loader {
+	const char *ptr;
+	const char *end;
+	PGresult *result;
+	PGresAttDesc *attrs;
+	VALUE data;
+	VALUE connection;
+};
+
+static void
+pgresult_load_need( struct pgresult_loader *l, size_t len )
+{
+	if( (size_t)(l->end - l->ptr) < len )
+		rb_raise( rb_eArgError, "binary result data is truncated" );
+}
+
+static uint32_t
+pgresult_load_uint( struct pgresult_loader *l, int bytes )
+{
+	uint32_t value = 0;
+	int i;
+
+	pgresult_load_need( l, bytes );
+	for( i = 0; i < bytes; i++ )
+		value = (value << 8) | (unsigned char)*l->ptr++;
+	return value;
+}
+
+static size_t
+pgresult_load_varint( struct pgresult_loader *l )
+{
+	size_t value = 0;
+	int shift = 0;
+	unsigned char byte;
+
+	do {
+		pgresult_load_need( l, 1 );
+		if( shift > 63 )
+			rb_raise( rb_eArgError, "invalid length in binary result data" );
+		byte = *l->ptr++;
+		value |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while( byte & 0x80 );
+	return value;
+}
+
+/* Read a string or value. Returns its length or -1 for NULL. */
+static long
+pgresult_load_string( struct pgresult_loader *l, const char **ptr )
+{
+	size_t len = pgresult_load_varint( l );
+
+	if( len == 0 )
+		return -1;
+	if( len - 1 > INT_MAX )
+		rb_raise( rb_eArgError, "invalid length in binary result data" );
+	pgresult_load_need( l, len - 1 );
+	*ptr = l->ptr;
+	l->ptr += len - 1;
+	return (long)len - 1;
+}
+
+static VALUE
+pgresult_load_body( VALUE ptr )
+{
+	struct pgresult_loader *l = (struct pgresult_loader *)ptr;
+	PGconn *conn = NIL_P(l->connection) ? NULL : pg_get_pgconn(l->connection);
+	ExecStatusType status;
+	const char *encname, *cmd_status, *value;
+	long encname_len, cmd_status_len, len;
+	size_t nfields, ntuples, tuple, field;
+	VALUE names, rb_pgresult, rb_cmd_status;
+	t_pg_result *this;
+	int enc_idx;
+
+	pgresult_load_need( l, 4 );
+	if( memcmp(l->ptr, PG_RESULT_DUMP_MAGIC, 4) != 0 )
+		rb_raise( rb_eArgError, "no binary result data" );
+	l->ptr += 4;
+
+	status = pgresult_load_uint( l, 1 );
+	switch( status ){
+		case PGRES_TUPLES_OK:
+		case PGRES_SINGLE_TUPLE:
+		case PGRES_COMMAND_OK:
+			break;
+		default:
+			rb_raise( rb_eArgError, "invalid result status %d in binary result data", status );
+	}
+	encname_len = pgresult_load_string( l, &encname );
+	enc_idx = encname_len < 0 ? -1 : rb_enc_find_index( RSTRING_PTR(rb_str_new(encname, encname_len)) );
+	cmd_status_len = pgresult_load_string( l, &cmd_status );
+	rb_cmd_status = rb_str_new( cmd_status_len < 0 ? "" : cmd_status, cmd_status_len < 0 ? 0 : cmd_status_len );
+
+	nfields = pgresult_load_varint( l );
+	/* MaxTupleAttributeNumber of PostgreSQL */
+	if( nfields > 1664 )
+		rb_raise( rb_eArgError, "invalid number of fields in binary result data" );
+	names = rb_ary_new2( nfields );
+	{
+		PGresAttDesc *attrs = l->attrs = ALLOC_N( PGresAttDesc, nfields ? nfields : 1 );
+
+		for( field = 0; field < nfields; field++ ){
+			const char *name;
+			len = pgresult_load_string( l, &name );
+			/* Keep a NUL terminated copy of the name until PQsetResultAttrs() copies it. */
+			rb_ary_push( names, rb_str_new(len < 0 ? "" : name, len < 0 ? 0 : len) );
+			attrs[field].name = RSTRING_PTR( RARRAY_AREF(names, field) );
+			attrs[field].tableid = pgresult_load_uint( l, 4 );
+			attrs[field].columnid = (int16_t)pgresult_load_uint( l, 2 );
+			attrs[field].format = pgresult_load_uint( l, 1 );
+			attrs[field].typid = pgresult_load_uint( l, 4 );
+			attrs[field].typlen = (int16_t)pgresult_load_uint( l, 2 );
+			attrs[field].atttypmod = (int32_t)pgresult_load_uint( l, 4 );
+		}
+
+		l->result = PQmakeEmptyPGresult( conn, status );
+		if( l->result == NULL || (nfields > 0 && !PQsetResultAttrs(l->result, (int)nfields, attrs)) )
+			rb_raise( rb_eNoMemError, "out of memory while loading binary result data" );
+		RB_GC_GUARD( names );
+	}
+
+	ntuples = pgresult_load_varint( l );
+	if( ntuples > INT_MAX || (nfields == 0 && ntuples > 0) )
+		rb_raise( rb_eArgError, "invalid number of tuples in binary result data" );
+	for( tuple = 0; tuple < ntuples; tuple++ ){
+		for( field = 0; field < nfields; field++ ){
+			len = pgresult_load_string( l, &value );
+			if( !PQsetvalue(l->result, (int)tuple, (int)field, len < 0 ? NULL : (char *)value, (int)len) )
+				rb_raise( rb_eNoMemError, "out of memory while loading binary result data" );
+		}
+	}
+	if( l->ptr != l->end )
+		rb_raise( rb_eArgError, "unexpected data after binary result data" );
+
+	rb_pgresult = pg_new_result( l->result, l->connection );
+	l->result = NULL;
+	this = pgresult_get_this( rb_pgresult );
+	if( enc_idx >= 0 )
+		this->enc_idx = enc_idx;
+	if( RSTRING_LEN(rb_cmd_status) > 0 ){
+		PG_ENCODING_SET_NOCHECK( rb_cmd_status, this->enc_idx );
+		this->cmd_status = rb_obj_freeze( rb_cmd_status );
+	}
+	return rb_pgresult;
+}
+
+static VALUE
+pgresult_load_cleanup( VALUE ptr )
+{
+	struct pgresult_loader *l = (struct pgresult_loader *)ptr;
+
+	if( l->result )
+		PQclear( l->result );
+	xfree( l->attrs );
+	RB_GC_GUARD( l->data );
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    PG::Result.load_binary_raw( data, connection ) -> PG::Result
+ *
+ * Restore a result serialized by #dump_binary_raw . See PG::Result.load_binary .
+ */
+static VALUE
+pgresult_s_load_binary_raw( VALUE klass, VALUE data, VALUE connection )
+{
+	struct pgresult_loader l;
+
+	StringValue( data );
+	l.data = data;
+	l.ptr = RSTRING_PTR( data );
+	l.end = l.ptr + RSTRING_LEN( data );
+	l.result = NULL;
+	l.attrs = NULL;
+	l.connection = connection;
+	if( !NIL_P(connection) )
+		pg_get_pgconn( connection );
+
+	return rb_ensure( pgresult_load_body, (VALUE)&l, pgresult_load_cleanup, (VALUE)&l );
+}
+
 /*
  * DATA pointer functions
  */
@@ -412,6 +955,26 @@ pgresult_get(VALUE self)
 	return this->pgresult;
 }
 
+/*
+ * Number of tuples of the result, which are either in the PGresult or materialized.
+ */
+static inline int
+pgresult_ntuples_of( t_pg_result *this )
+{
+	return NIL_P(this->mat_values) ? PQntuples(this->pgresult) : this->mat_ntuples;
+}
+
+/*
+ * Retrieve a result value per type map or from the materialized values.
+ */
+static inline VALUE
+pgresult_value( t_pg_result *this, VALUE self, int tuple, int field )
+{
+	if( !NIL_P(this->mat_values) )
+		return pgresult_materialized_value( this, tuple, field );
+	return pgresult_account_value(this, this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, tuple, field));
+}
+
 static VALUE pg_cstr_to_sym(char *cstr, unsigned int flags, int enc_idx)
 {
 	VALUE fname;
@@ -452,6 +1015,7 @@ static void pgresult_init_fnames(VALUE self)
 			this->nfields = i + 1;
 		}
 		this->nfields = nfields;
+		this->decode_stats.fnames += nfields;
 	}
 }
 
@@ -495,6 +1059,9 @@ static void pgresult_init_fnames(VALUE self)
  * * +PGRES_NONFATAL_ERROR+
  * * +PGRES_FATAL_ERROR+
  * * +PGRES_COPY_BOTH+
+ * * +PGRES_SINGLE_TUPLE+
+ * * +PGRES_PIPELINE_SYNC+
+ * * +PGRES_PIPELINE_ABORTED+
  */
 static VALUE
 pgresult_result_status(VALUE self)
@@ -632,7 +1199,7 @@ pgresult_error_field(VALUE self, VALUE field)
 static VALUE
 pgresult_ntuples(VALUE self)
 {
-	return INT2FIX(PQntuples(pgresult_get(self)));
+	return INT2FIX(pgresult_ntuples_of(pgresult_get_this_safe(self)));
 }
 
 static VALUE
@@ -874,13 +1441,13 @@ pgresult_getvalue(VALUE self, VALUE tup_num, VALUE field_num)
 	int i = NUM2INT(tup_num);
 	int j = NUM2INT(field_num);
 
-	if(i < 0 || i >= PQntuples(this->pgresult)) {
+	if(i < 0 || i >= pgresult_ntuples_of(this)) {
 		rb_raise(rb_eArgError,"invalid tuple number %d", i);
 	}
 	if(j < 0 || j >= PQnfields(this->pgresult)) {
 		rb_raise(rb_eArgError,"invalid field number %d", j);
 	}
-	return this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, i, j);
+	return pgresult_value(this, self, i, j);
 }
 
 /*
@@ -892,18 +1459,19 @@ pgresult_getvalue(VALUE self, VALUE tup_num, VALUE field_num)
 static VALUE
 pgresult_getisnull(VALUE self, VALUE tup_num, VALUE field_num)
 {
-	PGresult *result;
+	t_pg_result *this = pgresult_get_this_safe(self);
 	int i = NUM2INT(tup_num);
 	int j = NUM2INT(field_num);
 
-	result = pgresult_get(self);
-	if (i < 0 || i >= PQntuples(result)) {
+	if (i < 0 || i >= pgresult_ntuples_of(this)) {
 		rb_raise(rb_eArgError,"invalid tuple number %d", i);
 	}
-	if (j < 0 || j >= PQnfields(result)) {
+	if (j < 0 || j >= PQnfields(this->pgresult)) {
 		rb_raise(rb_eArgError,"invalid field number %d", j);
 	}
-	return PQgetisnull(result, i, j) ? Qtrue : Qfalse;
+	if( !NIL_P(this->mat_values) )
+		return NIL_P(pgresult_materialized_value(this, i, j)) ? Qtrue : Qfalse;
+	return PQgetisnull(this->pgresult, i, j) ? Qtrue : Qfalse;
 }
 
 /*
@@ -913,22 +1481,31 @@ pgresult_getisnull(VALUE self, VALUE tup_num, VALUE field_num)
  * Returns the (String) length of the field in bytes.
  *
  * Equivalent to <tt>res.value(<i>tup_num</i>,<i>field_num</i>).length</tt>.
+ *
+ * After #materialize! the length is only known for values which are retrieved as String.
  */
 static VALUE
 pgresult_getlength(VALUE self, VALUE tup_num, VALUE field_num)
 {
-	PGresult *result;
+	t_pg_result *this = pgresult_get_this_safe(self);
 	int i = NUM2INT(tup_num);
 	int j = NUM2INT(field_num);
 
-	result = pgresult_get(self);
-	if (i < 0 || i >= PQntuples(result)) {
+	if (i < 0 || i >= pgresult_ntuples_of(this)) {
 		rb_raise(rb_eArgError,"invalid tuple number %d", i);
 	}
-	if (j < 0 || j >= PQnfields(result)) {
+	if (j < 0 || j >= PQnfields(this->pgresult)) {
 		rb_raise(rb_eArgError,"invalid field number %d", j);
 	}
-	return INT2FIX(PQgetlength(result, i, j));
+	if( !NIL_P(this->mat_values) ){
+		VALUE value = pgresult_materialized_value(this, i, j);
+		if( NIL_P(value) )
+			return INT2FIX(0);
+		if( !RB_TYPE_P(value, T_STRING) )
+			rb_raise(rb_ePGerror, "the length of type casted values isn't retained by #materialize!");
+		return LONG2NUM(RSTRING_LEN(value));
+	}
+	return INT2FIX(PQgetlength(this->pgresult, i, j));
 }
 
 /*
@@ -973,7 +1550,11 @@ static VALUE
 pgresult_cmd_status(VALUE self)
 {
 	t_pg_result *this = pgresult_get_this_safe(self);
-	VALUE ret = rb_str_new2(PQcmdStatus(this->pgresult));
+	VALUE ret;
+
+	if( !NIL_P(this->cmd_status) )
+		return rb_str_dup(this->cmd_status);
+	ret = rb_str_new2(PQcmdStatus(this->pgresult));
 	PG_ENCODING_SET_NOCHECK(ret, this->enc_idx);
 	return ret;
 }
@@ -1001,8 +1582,17 @@ pgresult_cmd_status(VALUE self)
 static VALUE
 pgresult_cmd_tuples(VALUE self)
 {
+	t_pg_result *this = pgresult_get_this_safe(self);
 	long n;
-	n = strtol(PQcmdTuples(pgresult_get(self)),NULL, 10);
+
+	if( !NIL_P(this->cmd_status) ){
+		/* The number of tuples is the last word of the command status, like libpq does. */
+		const char *status = RSTRING_PTR(this->cmd_status);
+		const char *word = strrchr(status, ' ');
+		n = word ? strtol(word + 1, NULL, 10) : 0;
+		return LONG2NUM(n);
+	}
+	n = strtol(PQcmdTuples(this->pgresult),NULL, 10);
 	return INT2NUM(n);
 }
 
@@ -1037,7 +1627,7 @@ pgresult_aref(VALUE self, VALUE index)
 	t_pg_result *this = pgresult_get_this_safe(self);
 	int tuple_num = NUM2INT(index);
 	int field_num;
-	int num_tuples = PQntuples(this->pgresult);
+	int num_tuples = pgresult_ntuples_of(this);
 	VALUE tuple;
 
 	if( this->nfields == -1 )
@@ -1050,12 +1640,14 @@ pgresult_aref(VALUE self, VALUE index)
 	 * This is somewhat faster than populating an empty Hash object. */
 	tuple = NIL_P(this->tuple_hash) ? rb_hash_new() : this->tuple_hash;
 	for ( field_num = 0; field_num < this->nfields; field_num++ ) {
-		VALUE val = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, tuple_num, field_num);
+		VALUE val = pgresult_value(this, self, tuple_num, field_num);
 		rb_hash_aset( tuple, this->fnames[field_num], val );
 	}
 	/* Store a copy of the filled hash for use at the next row. */
 	if( num_tuples > 10 )
 		this->tuple_hash = rb_hash_dup(tuple);
+	/* Either the returned Hash or its copy was allocated. */
+	this->decode_stats.hashes++;
 
 	return tuple;
 }
@@ -1078,7 +1670,7 @@ pgresult_each_row(VALUE self)
 	RETURN_SIZED_ENUMERATOR(self, 0, NULL, pgresult_ntuples_for_enum);
 
 	this = pgresult_get_this_safe(self);
-	num_rows = PQntuples(this->pgresult);
+	num_rows = pgresult_ntuples_of(this);
 	num_fields = PQnfields(this->pgresult);
 
 	for ( row = 0; row < num_rows; row++ ) {
@@ -1086,8 +1678,9 @@ pgresult_each_row(VALUE self)
 
 		/* populate the row */
 		for ( field = 0; field < num_fields; field++ ) {
-			row_values[field] = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, row, field);
+			row_values[field] = pgresult_value(this, self, row, field);
 		}
+		this->decode_stats.arrays++;
 		rb_yield( rb_ary_new4( num_fields, row_values ));
 	}
 
@@ -1106,16 +1699,17 @@ pgresult_values(VALUE self)
 	t_pg_result *this = pgresult_get_this_safe(self);
 	int row;
 	int field;
-	int num_rows = PQntuples(this->pgresult);
+	int num_rows = pgresult_ntuples_of(this);
 	int num_fields = PQnfields(this->pgresult);
 	VALUE results = rb_ary_new2( num_rows );
 
+	this->decode_stats.arrays += num_rows + 1;
 	for ( row = 0; row < num_rows; row++ ) {
 		PG_VARIABLE_LENGTH_ARRAY(VALUE, row_values, num_fields, PG_MAX_COLUMNS)
 
 		/* populate the row */
 		for ( field = 0; field < num_fields; field++ ) {
-			row_values[field] = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, row, field);
+			row_values[field] = pgresult_value(this, self, row, field);
 		}
 		rb_ary_store( results, row, rb_ary_new4( num_fields, row_values ) );
 	}
@@ -1131,15 +1725,16 @@ static VALUE
 make_column_result_array( VALUE self, int col )
 {
 	t_pg_result *this = pgresult_get_this_safe(self);
-	int rows = PQntuples( this->pgresult );
+	int rows = pgresult_ntuples_of( this );
 	int i;
 	VALUE results = rb_ary_new2( rows );
 
 	if ( col >= PQnfields(this->pgresult) )
 		rb_raise( rb_eIndexError, "no column %d in result", col );
 
+	this->decode_stats.arrays++;
 	for ( i=0; i < rows; i++ ) {
-		VALUE val = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, i, col);
+		VALUE val = pgresult_value(this, self, i, col);
 		rb_ary_store( results, i, val );
 	}
 
@@ -1205,7 +1800,7 @@ pgresult_tuple_values(VALUE self, VALUE index)
 	int num_fields;
 
 	this = pgresult_get_this_safe(self);
-	num_tuples = PQntuples(this->pgresult);
+	num_tuples = pgresult_ntuples_of(this);
 	num_fields = PQnfields(this->pgresult);
 
 	if ( tuple_num < 0 || tuple_num >= num_tuples )
@@ -1216,8 +1811,9 @@ pgresult_tuple_values(VALUE self, VALUE index)
 
 		/* populate the row */
 		for ( field = 0; field < num_fields; field++ ) {
-			row_values[field] = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, tuple_num, field);
+			row_values[field] = pgresult_value(this, self, tuple_num, field);
 		}
+		this->decode_stats.arrays++;
 		return rb_ary_new4( num_fields, row_values );
 	}
 }
@@ -1238,6 +1834,7 @@ static void ensure_init_for_tuple(VALUE self)
 		}
 		rb_obj_freeze(field_map);
 		this->field_map = field_map;
+		this->decode_stats.hashes++;
 	}
 }
 
@@ -1256,12 +1853,13 @@ pgresult_tuple(VALUE self, VALUE index)
 	int num_tuples;
 
 	this = pgresult_get_this_safe(self);
-	num_tuples = PQntuples(this->pgresult);
+	num_tuples = pgresult_ntuples_of(this);
 
 	if ( tuple_num < 0 || tuple_num >= num_tuples )
 		rb_raise( rb_eIndexError, "Index %d is out of range", tuple_num );
 
 	ensure_init_for_tuple(self);
+	this->decode_stats.tuples++;
 
   return pg_tuple_new(self, tuple_num);
 }
@@ -1276,14 +1874,14 @@ pgresult_tuple(VALUE self, VALUE index)
 static VALUE
 pgresult_each(VALUE self)
 {
-	PGresult *result;
+	t_pg_result *this;
 	int tuple_num;
 
 	RETURN_SIZED_ENUMERATOR(self, 0, NULL, pgresult_ntuples_for_enum);
 
-	result = pgresult_get(self);
+	this = pgresult_get_this_safe(self);
 
-	for(tuple_num = 0; tuple_num < PQntuples(result); tuple_num++) {
+	for(tuple_num = 0; tuple_num < pgresult_ntuples_of(this); tuple_num++) {
 		rb_yield(pgresult_aref(self, INT2NUM(tuple_num)));
 	}
 	return self;
@@ -1303,6 +1901,7 @@ pgresult_fields(VALUE self)
 	if( this->nfields == -1 )
 		pgresult_init_fnames( self );
 
+	this->decode_stats.arrays++;
 	return rb_ary_new4( this->nfields, this->fnames );
 }
 
@@ -1325,11 +1924,14 @@ pgresult_type_map_set(VALUE self, VALUE typemap)
 	t_pg_result *this = pgresult_get_this(self);
 	t_typemap *p_typemap;
 
+	rb_check_frozen( self );
 	if ( !rb_obj_is_kind_of(typemap, rb_cTypeMap) ) {
 		rb_raise( rb_eTypeError, "wrong argument type %s (expected kind of PG::TypeMap)",
 				rb_obj_classname( typemap ) );
 	}
 	Data_Get_Struct(typemap, t_typemap, p_typemap);
+	if( !NIL_P(this->mat_values) )
+		rb_raise( rb_ePGerror, "the type map of a materialized result can't be changed" );
 
 	this->typemap = p_typemap->funcs.fit_to_result( typemap, self );
 	this->p_typemap = DATA_PTR( this->typemap );
@@ -1379,8 +1981,9 @@ yield_array(VALUE self, int ntuples, int nfields)
 
 		/* populate the row */
 		for ( field = 0; field < nfields; field++ ) {
-			row_values[field] = this->p_typemap->funcs.typecast_result_value(this->p_typemap, self, row, field);
+			row_values[field] = pgresult_value(this, self, row, field);
 		}
+		this->decode_stats.arrays++;
 		rb_yield( rb_ary_new4( nfields, row_values ));
 	}
 
@@ -1407,20 +2010,18 @@ yield_tuple(VALUE self, int ntuples, int nfields)
 	}
 }
 
-static VALUE
-pgresult_stream_any(VALUE self, void (*yielder)(VALUE, int, int))
+static PGresult *
+stream_next_result( void *pgconn )
 {
-	t_pg_result *this;
-	int nfields;
-	PGconn *pgconn;
-	PGresult *pgresult;
-
-	RETURN_ENUMERATOR(self, 0, NULL);
+	return gvl_PQgetResult( (PGconn *)pgconn );
+}
 
-	this = pgresult_get_this_safe(self);
-	pgconn = pg_get_pgconn(this->connection);
-	pgresult = this->pgresult;
-	nfields = PQnfields(pgresult);
+static VALUE
+pgresult_stream_loop(VALUE self, void (*yielder)(VALUE, int, int), PGresult *(*next_result)(void *), void *data)
+{
+	t_pg_result *this = pgresult_get_this_safe(self);
+	PGresult *pgresult = this->pgresult;
+	int nfields = PQnfields(pgresult);
 
 	for(;;){
 		int ntuples = PQntuples(pgresult);
@@ -1438,7 +2039,7 @@ pgresult_stream_any(VALUE self, void (*yielder)(VALUE, int, int))
 
 		yielder( self, ntuples, nfields );
 
-		pgresult = gvl_PQgetResult(pgconn);
+		pgresult = next_result(data);
 		if( pgresult == NULL )
 			rb_raise( rb_eNoResultError, "no result received - possibly an intersection with another result retrieval");
 
@@ -1452,6 +2053,284 @@ pgresult_stream_any(VALUE self, void (*yielder)(VALUE, int, int))
 	return self;
 }
 
+#ifdef PG_HAVE_READ_AHEAD
+
+#define READ_AHEAD_QUEUE_SIZE 1024
+
+/*
+ * Read-ahead of single row results.
+ *
+ * While a result is streamed, a helper thread receives the following rows from the
+ * socket, parses them per PQgetResult() and queues them, so that network transfer and
+ * type casting in the Ruby thread overlap. The helper thread is the only user of the
+ * PGconn until it has queued the last result of the query or is stopped.
+ */
+struct read_ahead {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	t_pg_connection *conn;
+	PGconn *pgconn;
+	/* Ring buffer of received results and their memory sizes */
+	PGresult *queue[READ_AHEAD_QUEUE_SIZE];
+	size_t sizes[READ_AHEAD_QUEUE_SIZE];
+	/* Next entry to be retrieved by the Ruby thread */
+	int head;
+	/* Next entry to be filled by the helper thread */
+	int tail;
+	/* Number of queued results and their memory size, protected by the lock */
+	int count;
+	size_t bytes;
+	size_t max_bytes;
+	/* Results which the Ruby thread may retrieve without locking and which it already
+	 * retrieved since it last updated count and bytes */
+	int avail;
+	int taken;
+	size_t taken_bytes;
+	/* Threads waiting on the condition variable */
+	int helper_waiting;
+	int ruby_waiting;
+	/* Set by the helper thread when the query is complete or the connection failed */
+	int done;
+	/* Set by the Ruby thread to stop the helper thread */
+	int stop;
+	/* Set by the unblocking function to process interrupts */
+	int interrupted;
+};
+
+static void *
+read_ahead_thread( void *ptr )
+{
+	struct read_ahead *ra = ptr;
+	int last = 0;
+
+	while( !last ){
+		PGresult *pgresult;
+		size_t size;
+
+		pthread_mutex_lock( &ra->lock );
+		if( ra->bytes >= ra->max_bytes || ra->count == READ_AHEAD_QUEUE_SIZE ){
+			/* Wait until half of the queue is retrieved, to avoid a ping-pong per row. */
+			ra->helper_waiting = 1;
+			while( !ra->stop && (ra->bytes > ra->max_bytes / 2 || ra->count > READ_AHEAD_QUEUE_SIZE / 2) )
+				pthread_cond_wait( &ra->cond, &ra->lock );
+			ra->helper_waiting = 0;
+		}
+		if( ra->stop ){
+			pthread_mutex_unlock( &ra->lock );
+			break;
+		}
+		pthread_mutex_unlock( &ra->lock );
+
+		if( PQisBusy(ra->pgconn) ){
+			struct pollfd pfd;
+			pfd.fd = PQsocket( ra->pgconn );
+			pfd.events = POLLIN;
+			/* Check the stop flag at least every 100 ms */
+			poll( &pfd, 1, 100 );
+			if( !PQconsumeInput(ra->pgconn) && PQstatus(ra->pgconn) == CONNECTION_BAD )
+				break;
+			continue;
+		}
+
+		pgresult = PQgetResult( ra->pgconn );
+		size = pgresult ? pgresult_approx_size( pgresult ) : 0;
+		/* The stream ends with a result other than PGRES_SINGLE_TUPLE. Results of following queries are not touched. */
+		last = pgresult == NULL || PQresultStatus(pgresult) != PGRES_SINGLE_TUPLE;
+
+		ra->queue[ra->tail] = pgresult;
+		ra->sizes[ra->tail] = size;
+		ra->tail = (ra->tail + 1) % READ_AHEAD_QUEUE_SIZE;
+
+		pthread_mutex_lock( &ra->lock );
+		ra->count++;
+		ra->bytes += size;
+		if( ra->ruby_waiting )
+			pthread_cond_broadcast( &ra->cond );
+		pthread_mutex_unlock( &ra->lock );
+	}
+
+	pthread_mutex_lock( &ra->lock );
+	ra->done = 1;
+	pthread_cond_broadcast( &ra->cond );
+	pthread_mutex_unlock( &ra->lock );
+	return NULL;
+}
+
+static void *
+read_ahead_wait( void *ptr )
+{
+	struct read_ahead *ra = ptr;
+
+	pthread_mutex_lock( &ra->lock );
+	ra->ruby_waiting = 1;
+	while( ra->count == 0 && !ra->done && !ra->interrupted )
+		pthread_cond_wait( &ra->cond, &ra->lock );
+	ra->ruby_waiting = 0;
+	pthread_mutex_unlock( &ra->lock );
+	return NULL;
+}
+
+static void
+read_ahead_ubf( void *ptr )
+{
+	struct read_ahead *ra = ptr;
+
+	pthread_mutex_lock( &ra->lock );
+	ra->interrupted = 1;
+	pthread_cond_broadcast( &ra->cond );
+	pthread_mutex_unlock( &ra->lock );
+}
+
+/* Return the next queued result. Waits without the GVL, if the queue is empty. */
+static PGresult *
+read_ahead_next_result( void *ptr )
+{
+	struct read_ahead *ra = ptr;
+
+	for(;;){
+		int done;
+
+		if( ra->avail > 0 ){
+			/* The entries up to avail are not touched by the helper thread. */
+			PGresult *pgresult = ra->queue[ra->head];
+			ra->taken_bytes += ra->sizes[ra->head];
+			ra->taken++;
+			ra->avail--;
+			ra->head = (ra->head + 1) % READ_AHEAD_QUEUE_SIZE;
+			return pgresult;
+		}
+
+		/* Release the retrieved entries and take over all newly queued ones. */
+		pthread_mutex_lock( &ra->lock );
+		ra->count -= ra->taken;
+		ra->bytes -= ra->taken_bytes;
+		ra->taken = 0;
+		ra->taken_bytes = 0;
+		if( ra->helper_waiting && ra->bytes <= ra->max_bytes / 2 && ra->count <= READ_AHEAD_QUEUE_SIZE / 2 )
+			pthread_cond_broadcast( &ra->cond );
+		ra->avail = ra->count;
+		done = ra->done;
+		pthread_mutex_unlock( &ra->lock );
+
+		if( ra->avail > 0 )
+			continue;
+		if( done ){
+			/* The connection failed, so that no more data can be received. */
+			return PQgetResult( ra->pgconn );
+		}
+
+		rb_thread_call_without_gvl( read_ahead_wait, ra, read_ahead_ubf, ra );
+
+		if( ra->interrupted ){
+			ra->interrupted = 0;
+			rb_thread_check_ints();
+		}
+	}
+}
+
+struct read_ahead_args {
+	VALUE self;
+	void (*yielder)(VALUE, int, int);
+	struct read_ahead *ra;
+};
+
+static VALUE
+read_ahead_body( VALUE ptr )
+{
+	struct read_ahead_args *args = (struct read_ahead_args *)ptr;
+	return pgresult_stream_loop( args->self, args->yielder, read_ahead_next_result, args->ra );
+}
+
+static void *
+read_ahead_join( void *ptr )
+{
+	struct read_ahead *ra = ptr;
+	pthread_join( ra->thread, NULL );
+	return NULL;
+}
+
+/* Stop the helper thread and free all results which were not retrieved. */
+static VALUE
+read_ahead_cleanup( VALUE ptr )
+{
+	struct read_ahead_args *args = (struct read_ahead_args *)ptr;
+	struct read_ahead *ra = args->ra;
+
+	pthread_mutex_lock( &ra->lock );
+	ra->stop = 1;
+	pthread_cond_broadcast( &ra->cond );
+	pthread_mutex_unlock( &ra->lock );
+	rb_thread_call_without_gvl( read_ahead_join, ra, RUBY_UBF_IO, 0 );
+	ra->conn->in_read_ahead = 0;
+
+	ra->count -= ra->taken;
+	while( ra->count > 0 ){
+		PQclear( ra->queue[ra->head] );
+		ra->head = (ra->head + 1) % READ_AHEAD_QUEUE_SIZE;
+		ra->count--;
+	}
+	pthread_cond_destroy( &ra->cond );
+	pthread_mutex_destroy( &ra->lock );
+	xfree( ra );
+	return Qnil;
+}
+
+static VALUE
+pgresult_stream_read_ahead(VALUE self, void (*yielder)(VALUE, int, int), t_pg_connection *conn)
+{
+	struct read_ahead_args args;
+	struct read_ahead *ra = ZALLOC( struct read_ahead );
+	int err;
+
+	ra->conn = conn;
+	ra->pgconn = conn->pgconn;
+	ra->max_bytes = conn->read_ahead;
+	pthread_mutex_init( &ra->lock, NULL );
+	pthread_cond_init( &ra->cond, NULL );
+	/* pthread_create() returns the error number instead of setting errno. */
+	err = pthread_create( &ra->thread, NULL, read_ahead_thread, ra );
+	if( err != 0 ){
+		pthread_cond_destroy( &ra->cond );
+		pthread_mutex_destroy( &ra->lock );
+		xfree( ra );
+		rb_syserr_fail( err, "pthread_create of the read-ahead thread" );
+	}
+	/* Other methods of the connection must not use the PGconn concurrently. */
+	conn->in_read_ahead = 1;
+
+	args.self = self;
+	args.yielder = yielder;
+	args.ra = ra;
+	return rb_ensure( read_ahead_body, (VALUE)&args, read_ahead_cleanup, (VALUE)&args );
+}
+
+#endif /* PG_HAVE_READ_AHEAD */
+
+static VALUE
+pgresult_stream_any(VALUE self, void (*yielder)(VALUE, int, int))
+{
+	t_pg_result *this;
+	PGconn *pgconn;
+
+	RETURN_ENUMERATOR(self, 0, NULL);
+
+	this = pgresult_get_this_safe(self);
+	pgconn = pg_get_pgconn(this->connection);
+
+#ifdef PG_HAVE_READ_AHEAD
+	{
+		t_pg_connection *conn = pg_get_connection(this->connection);
+		/* Notice callbacks would be called by the helper thread without the GVL. */
+		if( conn->read_ahead > 0 && PQresultStatus(this->pgresult) == PGRES_SINGLE_TUPLE &&
+				NIL_P(conn->notice_receiver) && NIL_P(conn->notice_processor) )
+			return pgresult_stream_read_ahead(self, yielder, conn);
+	}
+#endif
+
+	return pgresult_stream_loop(self, yielder, stream_next_result, pgconn);
+}
+
 
 /*
  * call-seq:
@@ -1548,6 +2427,7 @@ static VALUE
 pgresult_field_name_type_set(VALUE self, VALUE sym)
 {
 	t_pg_result *this = pgresult_get_this(self);
+	rb_check_frozen( self );
 	if( this->nfields != -1 ) rb_raise(rb_eArgError, "field names are already materialized");
 
 	this->flags &= ~PG_RESULT_FIELD_NAMES_MASK;
@@ -1580,6 +2460,149 @@ pgresult_field_name_type_get(VALUE self)
 	}
 }
 
+/*
+ * call-seq:
+ *    res.decode_stats -> Hash
+ *
+ * Returns counters of the objects created by value retrieval methods of this result.
+ *
+ * The Hash contains the following keys:
+ * * +:values+ - number of values type casted by the type map
+ * * +:value_objects+ - number of non-immediate objects returned by the type casts
+ * * +:string_bytes+ - bytes of String objects returned by the type casts
+ * * +:fnames+ - number of field name objects
+ * * +:hashes+ - number of Hash objects created for tuples by #[] , #each and #stream_each
+ * * +:arrays+ - number of Array objects created for rows, columns and #fields
+ * * +:tuples+ - number of PG::Tuple objects
+ *
+ * Objects allocated within the decoders (like the elements of an Array decoded by
+ * PG::TextDecoder::Array) are not counted separately.
+ * The counters are useful to attribute allocations to the retrieval methods in use.
+ * See also PG::Connection#alloc_stats .
+ */
+static VALUE
+pgresult_decode_stats(VALUE self)
+{
+	t_pg_result *this = pgresult_get_this(self);
+	VALUE hash = rb_hash_new();
+
+	rb_hash_aset(hash, ID2SYM(rb_intern("values")), SIZET2NUM(this->decode_stats.values));
+	rb_hash_aset(hash, ID2SYM(rb_intern("value_objects")), SIZET2NUM(this->decode_stats.value_objects));
+	rb_hash_aset(hash, ID2SYM(rb_intern("string_bytes")), SIZET2NUM(this->decode_stats.string_bytes));
+	rb_hash_aset(hash, ID2SYM(rb_intern("fnames")), SIZET2NUM(this->decode_stats.fnames));
+	rb_hash_aset(hash, ID2SYM(rb_intern("hashes")), SIZET2NUM(this->decode_stats.hashes));
+	rb_hash_aset(hash, ID2SYM(rb_intern("arrays")), SIZET2NUM(this->decode_stats.arrays));
+	rb_hash_aset(hash, ID2SYM(rb_intern("tuples")), SIZET2NUM(this->decode_stats.tuples));
+
+	return hash;
+}
+
+/*
+ * call-seq:
+ *    PG::Result.build( fields, types, rows [, formats] ) -> PG::Result
+ *
+ * Builds a PG::Result with status PGRES_TUPLES_OK in memory, without any database connection.
+ *
+ * +fields+ is an Array of column names, +types+ an Array of type OIDs of the same length.
+ * +rows+ is an Array of rows, each of them an Array of raw values in PostgreSQL's wire format
+ * as String objects or +nil+ for SQL NULL.
+ * The optional +formats+ Array specifies the format (0 for text, 1 for binary) of each column.
+ * All columns are text format per default.
+ *
+ * The result values are not verified in any way, so that the built result behaves like one
+ * retrieved by a query, including type casts by #type_map= .
+ * This is primary useful to exercise decoders, type maps and PG::Tuple in benchmarks or tests
+ * without a running PostgreSQL server.
+ *
+ * Example:
+ *    res = PG::Result.build( ["a", "b"], [23, 25], [["1", "x"], ["2", nil]] )
+ *    res.map_types!(PG::BasicTypeMapForResults.new(conn)).values  # => [[1, "x"], [2, nil]]
+ */
+static VALUE
+pgresult_s_build(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE fields, types, rows, formats, names, self;
+	PGresult *pgresult;
+	t_pg_result *this;
+	int nfields, ntuples, i, j;
+
+	rb_scan_args(argc, argv, "31", &fields, &types, &rows, &formats);
+	Check_Type(fields, T_ARRAY);
+	Check_Type(types, T_ARRAY);
+	Check_Type(rows, T_ARRAY);
+	nfields = RARRAY_LENINT(fields);
+	ntuples = RARRAY_LENINT(rows);
+
+	if( RARRAY_LEN(types) != nfields )
+		rb_raise(rb_eArgError, "number of types (%ld) doesn't match number of fields (%d)", RARRAY_LEN(types), nfields);
+	if( !NIL_P(formats) ){
+		Check_Type(formats, T_ARRAY);
+		if( RARRAY_LEN(formats) != nfields )
+			rb_raise(rb_eArgError, "number of formats (%ld) doesn't match number of fields (%d)", RARRAY_LEN(formats), nfields);
+	}
+
+	/* Retrieve all field names before the PGresult is allocated, so that it can't leak on exceptions. */
+	names = rb_ary_new2(nfields);
+	for( i = 0; i < nfields; i++ ){
+		VALUE name = rb_obj_as_string(rb_ary_entry(fields, i));
+		StringValueCStr(name);
+		rb_ary_push(names, name);
+	}
+
+	{
+		PG_VARIABLE_LENGTH_ARRAY(PGresAttDesc, attrs, nfields, PG_MAX_COLUMNS)
+
+		for( i = 0; i < nfields; i++ ){
+			attrs[i].name = RSTRING_PTR(rb_ary_entry(names, i));
+			attrs[i].tableid = InvalidOid;
+			attrs[i].columnid = 0;
+			attrs[i].format = NIL_P(formats) ? 0 : NUM2INT(rb_ary_entry(formats, i));
+			attrs[i].typid = NUM2UINT(rb_ary_entry(types, i));
+			attrs[i].typlen = -1;
+			attrs[i].atttypmod = -1;
+		}
+
+		pgresult = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+		if( !pgresult )
+			rb_raise(rb_eNoMemError, "unable to allocate PGresult");
+		if( nfields > 0 && !PQsetResultAttrs(pgresult, nfields, attrs) ){
+			PQclear(pgresult);
+			rb_raise(rb_eNoMemError, "unable to set result attributes");
+		}
+	}
+	RB_GC_GUARD(names);
+
+	/* From now on the PGresult is owned by the PG::Result object. */
+	self = pg_new_result(pgresult, Qnil);
+	this = pgresult_get_this(self);
+
+	for( i = 0; i < ntuples; i++ ){
+		VALUE row = rb_ary_entry(rows, i);
+
+		Check_Type(row, T_ARRAY);
+		if( RARRAY_LEN(row) != nfields )
+			rb_raise(rb_eArgError, "row %d has %ld values but %d fields are defined", i, RARRAY_LEN(row), nfields);
+
+		for( j = 0; j < nfields; j++ ){
+			VALUE value = rb_ary_entry(row, j);
+			int ok;
+
+			if( NIL_P(value) ){
+				ok = PQsetvalue(pgresult, i, j, NULL, -1);
+			} else {
+				StringValue(value);
+				ok = PQsetvalue(pgresult, i, j, RSTRING_PTR(value), RSTRING_LENINT(value));
+			}
+			if( !ok )
+				rb_raise(rb_eNoMemError, "unable to set value of tuple %d field %d", i, j);
+		}
+	}
+
+	pgresult_update_size(this);
+
+	return self;
+}
+
 void
 init_pg_result()
 {
@@ -1591,6 +2614,9 @@ init_pg_result()
 	rb_include_module(rb_cPGresult, rb_mEnumerable);
 	rb_include_module(rb_cPGresult, rb_mPGconstants);
 
+	/******     PG::Result CLASS METHODS     ******/
+	rb_define_singleton_method(rb_cPGresult, "build", pgresult_s_build, -1);
+
 	/******     PG::Result INSTANCE METHODS: libpq     ******/
 	rb_define_method(rb_cPGresult, "result_status", pgresult_result_status, 0);
 	rb_define_method(rb_cPGresult, "res_status", pgresult_res_status, 1);
@@ -1602,7 +2628,7 @@ init_pg_result()
 #endif
 	rb_define_method(rb_cPGresult, "error_field", pgresult_error_field, 1);
 	rb_define_alias( rb_cPGresult, "result_error_field", "error_field" );
-	rb_define_method(rb_cPGresult, "clear", pg_result_clear, 0);
+	rb_define_method(rb_cPGresult, "clear", pgresult_clear_m, 0);
 	rb_define_method(rb_cPGresult, "check", pg_result_check, 0);
 	rb_define_alias (rb_cPGresult, "check_result", "check");
 	rb_define_method(rb_cPGresult, "ntuples", pgresult_ntuples, 0);
@@ -1639,6 +2665,12 @@ init_pg_result()
 	rb_define_method(rb_cPGresult, "tuple", pgresult_tuple, 1);
 	rb_define_method(rb_cPGresult, "cleared?", pgresult_cleared_p, 0);
 	rb_define_method(rb_cPGresult, "autoclear?", pgresult_autoclear_p, 0);
+	rb_define_method(rb_cPGresult, "memsize", pgresult_memsize_get, 0);
+	rb_define_method(rb_cPGresult, "materialize!", pgresult_materialize_bang, 0);
+	rb_define_method(rb_cPGresult, "materialized?", pgresult_materialized_p, 0);
+	rb_define_method(rb_cPGresult, "dup", pgresult_dup, 0);
+	rb_define_private_method(rb_cPGresult, "dump_binary_raw", pgresult_dump_binary_raw, 0);
+	rb_define_singleton_method(rb_cPGresult, "load_binary_raw", pgresult_s_load_binary_raw, 2);
 
 	rb_define_method(rb_cPGresult, "type_map=", pgresult_type_map_set, 1);
 	rb_define_method(rb_cPGresult, "type_map", pgresult_type_map_get, 0);
@@ -1650,4 +2682,6 @@ init_pg_result()
 
 	rb_define_method(rb_cPGresult, "field_name_type=", pgresult_field_name_type_set, 1 );
 	rb_define_method(rb_cPGresult, "field_name_type", pgresult_field_name_type_get, 0 );
+
+	rb_define_method(rb_cPGresult, "decode_stats", pgresult_decode_stats, 0);
 }
@@ -0,0 +1,856 @@
+/*
+ * pg_spilled_result.c - PG::SpilledResult class extension
+ *
+ * A query result, which is stored in a memory mapped temporary file instead of the memory of libpq.
+ */
+
+#include "pg.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MKSTEMP) && defined(HAVE_UNISTD_H)
+#define PG_HAVE_SPILLED_RESULT
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef PG_HAVE_SPILLED_RESULT
+
+/* Every n'th tuple gets an entry in the offset index. */
+#define PG_SPILL_INDEX_INTERVAL 16
+/* Size of the write buffer of the spill file */
+#define PG_SPILL_BUFFER_SIZE (256 * 1024)
+
+static VALUE rb_cPG_SpilledResult;
+
+/*
+ * The spill file holds the tuples one after the other. Each value is stored as
+ * a variable length integer (7 bits per byte, least significant first), which is
+ * 0 for NULL and the length + 1 otherwise, followed by the bytes of the value
+ * in the wire format of the field.
+ */
+typedef struct {
+	/* PG::Result with the field descriptions and the command status, but without tuples */
+	VALUE description;
+	/* Field names as returned by PG::Result#fields of the description */
+	VALUE fields;
+	/* The TypeMap used to type cast values */
+	VALUE typemap;
+	t_typemap *p_typemap;
+	int enc_idx;
+	int nfields;
+	long ntuples;
+
+	/* The mmap'ed spill file or NULL if it's empty or cleared */
+	const char *data;
+	size_t size;
+
+	/* Offset of every PG_SPILL_INDEX_INTERVAL'th tuple in data */
+	size_t *index;
+
+	/* Last located tuple and its offset, to make sequential access fast */
+	long cur_tuple;
+	size_t cur_offset;
+} t_pg_spilled_result;
+
+
+static void
+pg_spilled_result_gc_mark( t_pg_spilled_result *this )
+{
+	rb_gc_mark( this->description );
+	rb_gc_mark( this->fields );
+	rb_gc_mark( this->typemap );
+}
+
+static void
+pg_spilled_result_clear( t_pg_spilled_result *this )
+{
+	if( this->data )
+		munmap( (void *)this->data, this->size );
+	this->data = NULL;
+	xfree( this->index );
+	this->index = NULL;
+	this->ntuples = 0;
+	this->cur_tuple = -1;
+}
+
+static void
+pg_spilled_result_gc_free( t_pg_spilled_result *this )
+{
+	pg_spilled_result_clear( this );
+	xfree( this );
+}
+
+static size_t
+pg_spilled_result_memsize( t_pg_spilled_result *this )
+{
+	/* The mmap'ed file is held by the page cache and not accounted. */
+	return sizeof(*this) + sizeof(*this->index) * ((this->ntuples + PG_SPILL_INDEX_INTERVAL - 1) / PG_SPILL_INDEX_INTERVAL);
+}
+
+static const rb_data_type_t pg_spilled_result_type = {
+	"PG::SpilledResult",
+	{
+		(void (*)(void*))pg_spilled_result_gc_mark,
+		(void (*)(void*))pg_spilled_result_gc_free,
+		(size_t (*)(const void *))pg_spilled_result_memsize,
+	},
+	0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static VALUE
+pg_spilled_result_s_allocate( VALUE klass )
+{
+	t_pg_spilled_result *this;
+	VALUE self = TypedData_Make_Struct( klass, t_pg_spilled_result, &pg_spilled_result_type, this );
+
+	this->description = Qnil;
+	this->fields = Qnil;
+	this->typemap = pg_typemap_all_strings;
+	this->p_typemap = DATA_PTR( this->typemap );
+	this->cur_tuple = -1;
+	return self;
+}
+
+static t_pg_spilled_result *
+pg_spilled_result_get_this( VALUE self )
+{
+	t_pg_spilled_result *this;
+	TypedData_Get_Struct( self, t_pg_spilled_result, &pg_spilled_result_type, this );
+	if( NIL_P(this->description) )
+		rb_raise( rb_ePGerror, "result has been cleared" );
+	return this;
+}
+
+
+/*
+ * Writing of the spill file
+ */
+
+struct spill_writer {
+	VALUE self;
+	VALUE connection;
+	PGconn *pgconn;
+	const char *dir;
+	int fd;
+	/* The single row result in process */
+	PGresult *cur;
+
+	char *buf;
+	size_t buflen;
+	/* Bytes written to the file before buf */
+	size_t written;
+
+	size_t *index;
+	size_t index_cap;
+	long ntuples;
+	int nfields;
+
+	/* For writes without GVL */
+	const char *wptr;
+	size_t wlen;
+	int error;
+};
+
+static void *
+spill_write_nogvl( void *ptr )
+{
+	struct spill_writer *w = ptr;
+
+	while( w->wlen > 0 ){
+		ssize_t ret = write( w->fd, w->wptr, w->wlen );
+		if( ret < 0 ){
+			if( errno == EINTR ) continue;
+			w->error = errno;
+			break;
+		}
+		w->wptr += ret;
+		w->wlen -= ret;
+	}
+	return NULL;
+}
+
+static void
+spill_write( struct spill_writer *w, const char *ptr, size_t len )
+{
+	w->wptr = ptr;
+	w->wlen = len;
+	w->error = 0;
+	rb_thread_call_without_gvl( spill_write_nogvl, w, RUBY_UBF_IO, 0 );
+	if( w->error )
+		rb_syserr_fail( w->error, "write of spill file" );
+	w->written += len;
+}
+
+static void
+spill_flush( struct spill_writer *w )
+{
+	if( w->buflen > 0 ){
+		spill_write( w, w->buf, w->buflen );
+		w->buflen = 0;
+	}
+}
+
+static void
+spill_append( struct spill_writer *w, const char *ptr, size_t len )
+{
+	if( w->buflen + len > PG_SPILL_BUFFER_SIZE ){
+		spill_flush( w );
+		/* Large values are written without copy. */
+		if( len > PG_SPILL_BUFFER_SIZE / 2 ){
+			spill_write( w, ptr, len );
+			return;
+		}
+	}
+	memcpy( w->buf + w->buflen, ptr, len );
+	w->buflen += len;
+}
+
+static void
+spill_append_varint( struct spill_writer *w, size_t value )
+{
+	char bytes[10];
+	int n = 0;
+
+	do {
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if( value ) bytes[n] |= 0x80;
+		n++;
+	} while( value );
+	spill_append( w, bytes, n );
+}
+
+static void
+spill_append_tuple( struct spill_writer *w, const PGresult *res )
+{
+	int field;
+
+	if( w->ntuples % PG_SPILL_INDEX_INTERVAL == 0 ){
+		long entry = w->ntuples / PG_SPILL_INDEX_INTERVAL;
+		if( (size_t)entry >= w->index_cap ){
+			w->index_cap = w->index_cap ? w->index_cap * 2 : 1024;
+			REALLOC_N( w->index, size_t, w->index_cap );
+		}
+		w->index[entry] = w->written + w->buflen;
+	}
+
+	for( field = 0; field < w->nfields; field++ ){
+		if( PQgetisnull(res, 0, field) ){
+			spill_append_varint( w, 0 );
+		} else {
+			size_t len = PQgetlength( res, 0, field );
+			spill_append_varint( w, len + 1 );
+			spill_append( w, PQgetvalue(res, 0, field), len );
+		}
+	}
+	w->ntuples++;
+}
+
+static VALUE
+spill_receive_body( VALUE ptr )
+{
+	struct spill_writer *w = (struct spill_writer *)ptr;
+	t_pg_spilled_result *this = RTYPEDDATA_DATA( w->self );
+	VALUE template;
+
+	template = rb_str_new2( w->dir );
+	rb_str_cat2( template, "/pg_spill.XXXXXX" );
+	w->fd = mkstemp( RSTRING_PTR(template) );
+	if( w->fd < 0 )
+		rb_syserr_fail_str( errno, template );
+	rb_fd_fix_cloexec( w->fd );
+	/* The file is only accessed through the descriptor and the mapping. */
+	unlink( RSTRING_PTR(template) );
+	w->buf = xmalloc( PG_SPILL_BUFFER_SIZE );
+
+	while( (w->cur = gvl_PQgetResult(w->pgconn)) != NULL ){
+		VALUE rb_pgresult;
+
+		if( PQresultStatus(w->cur) == PGRES_SINGLE_TUPLE ){
+			if( w->ntuples == 0 )
+				w->nfields = PQnfields( w->cur );
+			spill_append_tuple( w, w->cur );
+			PQclear( w->cur );
+			w->cur = NULL;
+			continue;
+		}
+
+		/* The final result carries the field descriptions and the command status. */
+		rb_pgresult = pg_new_result( w->cur, w->connection );
+		w->cur = NULL;
+		pg_result_check( rb_pgresult );
+		if( !NIL_P(this->description) )
+			rb_raise( rb_eArgError, "a spilled result can only be retrieved from one statement" );
+		this->description = rb_pgresult;
+	}
+	if( NIL_P(this->description) )
+		rb_raise( rb_ePGerror, "no result received" );
+
+	spill_flush( w );
+	if( w->written > 0 ){
+		void *map = mmap( NULL, w->written, PROT_READ, MAP_SHARED, w->fd, 0 );
+		if( map == MAP_FAILED )
+			rb_sys_fail( "mmap of spill file" );
+		this->data = map;
+		this->size = w->written;
+	}
+	this->index = w->index;
+	w->index = NULL;
+	this->ntuples = w->ntuples;
+	this->nfields = PQnfields( pgresult_get(this->description) );
+	this->enc_idx = pg_get_connection( w->connection )->enc_idx;
+	this->fields = rb_funcall( this->description, rb_intern("fields"), 0 );
+
+	return w->self;
+}
+
+static VALUE
+spill_receive_cleanup( VALUE ptr )
+{
+	struct spill_writer *w = (struct spill_writer *)ptr;
+
+	if( w->cur ) PQclear( w->cur );
+	if( w->fd >= 0 ) close( w->fd );
+	xfree( w->buf );
+	xfree( w->index );
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    conn.receive_spilled_result( dir ) -> PG::SpilledResult
+ *
+ * Receive the result of a query sent in single row mode into a PG::SpilledResult .
+ * The tuples are written into a temporary file in the directory _dir_ .
+ *
+ * This is used by PG::Connection#exec_spilled .
+ */
+static VALUE
+pgconn_receive_spilled_result( VALUE self, VALUE dir )
+{
+	struct spill_writer w;
+
+	memset( &w, 0, sizeof(w) );
+	w.self = pg_spilled_result_s_allocate( rb_cPG_SpilledResult );
+	w.connection = self;
+	w.pgconn = pg_get_pgconn( self );
+	w.dir = StringValueCStr( dir );
+	w.fd = -1;
+
+	return rb_ensure( spill_receive_body, (VALUE)&w, spill_receive_cleanup, (VALUE)&w );
+}
+
+
+/*
+ * Reading of the spill file
+ */
+
+static inline size_t
+spill_read_varint( const char *data, size_t *pos )
+{
+	size_t value = 0;
+	int shift = 0;
+	unsigned char byte;
+
+	do {
+		byte = data[(*pos)++];
+		value |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while( byte & 0x80 );
+	return value;
+}
+
+/* Return the offset behind the fields of a tuple or field starting at _pos_ . */
+static size_t
+spill_skip_fields( const char *data, size_t pos, int nfields )
+{
+	int field;
+	for( field = 0; field < nfields; field++ ){
+		size_t len = spill_read_varint( data, &pos );
+		if( len ) pos += len - 1;
+	}
+	return pos;
+}
+
+static size_t
+spill_tuple_offset( t_pg_spilled_result *this, long tuple )
+{
+	long cur;
+	size_t pos;
+
+	if( this->cur_tuple >= 0 && this->cur_tuple <= tuple && tuple - this->cur_tuple < PG_SPILL_INDEX_INTERVAL ){
+		cur = this->cur_tuple;
+		pos = this->cur_offset;
+	} else {
+		cur = tuple - tuple % PG_SPILL_INDEX_INTERVAL;
+		pos = this->index[tuple / PG_SPILL_INDEX_INTERVAL];
+	}
+	for( ; cur < tuple; cur++ )
+		pos = spill_skip_fields( this->data, pos, this->nfields );
+
+	this->cur_tuple = tuple;
+	this->cur_offset = pos;
+	return pos;
+}
+
+/* Locate a value. Returns its length or -1 for NULL. */
+static long
+spill_locate_value( t_pg_spilled_result *this, long tuple, int field, const char **ptr )
+{
+	size_t pos = spill_tuple_offset( this, tuple );
+	size_t len;
+
+	pos = spill_skip_fields( this->data, pos, field );
+	len = spill_read_varint( this->data, &pos );
+	*ptr = this->data + pos;
+	return (long)len - 1;
+}
+
+static VALUE
+spill_typecast_value( t_pg_spilled_result *this, const char *ptr, long len, int field )
+{
+	VALUE str;
+
+	if( len < 0 )
+		return Qnil;
+	str = rb_str_new( ptr, len );
+	return this->p_typemap->funcs.typecast_copy_get( this->p_typemap, str, field,
+			PQfformat(pgresult_get(this->description), field), this->enc_idx );
+}
+
+/*
+ * A type map written in Ruby might have cleared the result while decoding a value.
+ * The spill file is never mapped again, so that comparing the address is sufficient.
+ */
+static inline void
+spill_check_data( t_pg_spilled_result *this, const char *data )
+{
+	if( this->data != data )
+		rb_raise( rb_ePGerror, "result has been cleared" );
+}
+
+/* Type cast all values of a tuple into _values_ . */
+static void
+spill_tuple_values( t_pg_spilled_result *this, long tuple, VALUE *values )
+{
+	const char *data = this->data;
+	size_t pos = spill_tuple_offset( this, tuple );
+	int field;
+
+	for( field = 0; field < this->nfields; field++ ){
+		long len = (long)spill_read_varint( data, &pos ) - 1;
+		values[field] = spill_typecast_value( this, data + pos, len, field );
+		spill_check_data( this, data );
+		if( len > 0 ) pos += len;
+	}
+	/* The next tuple follows directly. */
+	if( tuple + 1 < this->ntuples ){
+		this->cur_tuple = tuple + 1;
+		this->cur_offset = pos;
+	}
+}
+
+static long
+spill_check_tuple( t_pg_spilled_result *this, VALUE tuple_num )
+{
+	long tuple = NUM2LONG( tuple_num );
+	if( tuple < 0 || tuple >= this->ntuples )
+		rb_raise( rb_eIndexError, "Index %ld is out of range", tuple );
+	return tuple;
+}
+
+static int
+spill_check_field( t_pg_spilled_result *this, VALUE field_num )
+{
+	int field = NUM2INT( field_num );
+	if( field < 0 || field >= this->nfields )
+		rb_raise( rb_eArgError, "invalid field number %d", field );
+	return field;
+}
+
+static VALUE
+spill_values_to_hash( t_pg_spilled_result *this, VALUE *values )
+{
+	VALUE hash = rb_hash_new();
+	int field;
+
+	for( field = 0; field < this->nfields; field++ )
+		rb_hash_aset( hash, RARRAY_AREF(this->fields, field), values[field] );
+	return hash;
+}
+
+/*
+ * call-seq:
+ *    res.ntuples -> Integer
+ *
+ * Returns the number of tuples in the result.
+ */
+static VALUE
+pg_spilled_result_ntuples( VALUE self )
+{
+	return LONG2NUM( pg_spilled_result_get_this(self)->ntuples );
+}
+
+static VALUE
+pg_spilled_result_ntuples_for_enum( VALUE self, VALUE args, VALUE eobj )
+{
+	return pg_spilled_result_ntuples( self );
+}
+
+/*
+ * call-seq:
+ *    res.nfields -> Integer
+ *
+ * Returns the number of columns in the result.
+ */
+static VALUE
+pg_spilled_result_nfields( VALUE self )
+{
+	return INT2NUM( pg_spilled_result_get_this(self)->nfields );
+}
+
+/*
+ * call-seq:
+ *    res.description -> PG::Result
+ *
+ * Returns the final PG::Result of the query.
+ * It has no tuples, but the field descriptions and the command status.
+ */
+static VALUE
+pg_spilled_result_description( VALUE self )
+{
+	return pg_spilled_result_get_this( self )->description;
+}
+
+/*
+ * call-seq:
+ *    res.bytesize -> Integer
+ *
+ * Returns the size of the spill file in bytes.
+ */
+static VALUE
+pg_spilled_result_bytesize( VALUE self )
+{
+	return SIZET2NUM( pg_spilled_result_get_this(self)->size );
+}
+
+/*
+ * call-seq:
+ *    res.getvalue( tup_num, field_num ) -> value
+ *
+ * Returns the value in tuple number _tup_num_, field _field_num_,
+ * or +nil+ if the field is +NULL+.
+ */
+static VALUE
+pg_spilled_result_getvalue( VALUE self, VALUE tup_num, VALUE field_num )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	long tuple = spill_check_tuple( this, tup_num );
+	int field = spill_check_field( this, field_num );
+	const char *ptr;
+	long len = spill_locate_value( this, tuple, field, &ptr );
+
+	return spill_typecast_value( this, ptr, len, field );
+}
+
+/*
+ * call-seq:
+ *    res.getisnull( tup_num, field_num ) -> Boolean
+ *
+ * Returns +true+ if the specified value is +NULL+; +false+ otherwise.
+ */
+static VALUE
+pg_spilled_result_getisnull( VALUE self, VALUE tup_num, VALUE field_num )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	long tuple = spill_check_tuple( this, tup_num );
+	int field = spill_check_field( this, field_num );
+	const char *ptr;
+
+	return spill_locate_value( this, tuple, field, &ptr ) < 0 ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *    res.getlength( tup_num, field_num ) -> Integer
+ *
+ * Returns the length of the field in bytes of the wire format.
+ */
+static VALUE
+pg_spilled_result_getlength( VALUE self, VALUE tup_num, VALUE field_num )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	long tuple = spill_check_tuple( this, tup_num );
+	int field = spill_check_field( this, field_num );
+	const char *ptr;
+	long len = spill_locate_value( this, tuple, field, &ptr );
+
+	return LONG2NUM( len < 0 ? 0 : len );
+}
+
+/*
+ * call-seq:
+ *    res.tuple_values( n ) -> Array
+ *
+ * Returns an Array of the field values of the nth tuple.
+ */
+static VALUE
+pg_spilled_result_tuple_values( VALUE self, VALUE index )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	long tuple = spill_check_tuple( this, index );
+	PG_VARIABLE_LENGTH_ARRAY(VALUE, values, this->nfields, PG_MAX_COLUMNS)
+
+	spill_tuple_values( this, tuple, values );
+	return rb_ary_new4( this->nfields, values );
+}
+
+/*
+ * call-seq:
+ *    res[ n ] -> Hash
+ *
+ * Returns tuple _n_ as a Hash of field names and values.
+ */
+static VALUE
+pg_spilled_result_aref( VALUE self, VALUE index )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	long tuple = spill_check_tuple( this, index );
+	PG_VARIABLE_LENGTH_ARRAY(VALUE, values, this->nfields, PG_MAX_COLUMNS)
+
+	spill_tuple_values( this, tuple, values );
+	return spill_values_to_hash( this, values );
+}
+
+/*
+ * call-seq:
+ *    res.each{ |tuple| ... }
+ *
+ * Yields each tuple as a Hash of field names and values.
+ */
+static VALUE
+pg_spilled_result_each( VALUE self )
+{
+	t_pg_spilled_result *this;
+	long tuple;
+
+	RETURN_SIZED_ENUMERATOR( self, 0, NULL, pg_spilled_result_ntuples_for_enum );
+
+	for( tuple = 0; tuple < pg_spilled_result_get_this(self)->ntuples; tuple++ ){
+		this = pg_spilled_result_get_this( self );
+		{
+			PG_VARIABLE_LENGTH_ARRAY(VALUE, values, this->nfields, PG_MAX_COLUMNS)
+			spill_tuple_values( this, tuple, values );
+			rb_yield( spill_values_to_hash(this, values) );
+		}
+	}
+	return self;
+}
+
+/*
+ * call-seq:
+ *    res.each_row{ |row| ... }
+ *
+ * Yields each tuple as an Array of values.
+ */
+static VALUE
+pg_spilled_result_each_row( VALUE self )
+{
+	t_pg_spilled_result *this;
+	long tuple;
+
+	RETURN_SIZED_ENUMERATOR( self, 0, NULL, pg_spilled_result_ntuples_for_enum );
+
+	for( tuple = 0; tuple < pg_spilled_result_get_this(self)->ntuples; tuple++ ){
+		this = pg_spilled_result_get_this( self );
+		{
+			PG_VARIABLE_LENGTH_ARRAY(VALUE, values, this->nfields, PG_MAX_COLUMNS)
+			spill_tuple_values( this, tuple, values );
+			rb_yield( rb_ary_new4(this->nfields, values) );
+		}
+	}
+	return self;
+}
+
+/*
+ * call-seq:
+ *    res.values -> Array
+ *
+ * Returns all tuples as an Array of Arrays.
+ * Keep in mind that this loads the whole result into the Ruby heap.
+ */
+static VALUE
+pg_spilled_result_values( VALUE self )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	VALUE rows = rb_ary_new2( this->ntuples );
+	long tuple, ntuples = this->ntuples;
+	PG_VARIABLE_LENGTH_ARRAY(VALUE, values, this->nfields, PG_MAX_COLUMNS)
+
+	for( tuple = 0; tuple < ntuples; tuple++ ){
+		spill_tuple_values( this, tuple, values );
+		rb_ary_store( rows, tuple, rb_ary_new4(this->nfields, values) );
+	}
+	return rows;
+}
+
+/*
+ * call-seq:
+ *    res.column_values( n ) -> Array
+ *
+ * Returns an Array of the values of the nth column of each tuple.
+ */
+static VALUE
+pg_spilled_result_column_values( VALUE self, VALUE index )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	int field = NUM2INT( index );
+	const char *data = this->data;
+	VALUE column;
+	size_t pos = 0;
+	long tuple, ntuples = this->ntuples;
+
+	if( field < 0 || field >= this->nfields )
+		rb_raise( rb_eIndexError, "no column %d in result", field );
+
+	column = rb_ary_new2( ntuples );
+	for( tuple = 0; tuple < ntuples; tuple++ ){
+		long len;
+
+		/* The tuples are walked through sequentially. */
+		pos = spill_skip_fields( data, pos, field );
+		len = (long)spill_read_varint( data, &pos ) - 1;
+		rb_ary_store( column, tuple, spill_typecast_value(this, data + pos, len, field) );
+		spill_check_data( this, data );
+		if( len > 0 ) pos += len;
+		pos = spill_skip_fields( data, pos, this->nfields - field - 1 );
+	}
+	return column;
+}
+
+/*
+ * call-seq:
+ *    res.type_map = typemap
+ *
+ * Set the TypeMap that is used for type casts of the values to Ruby objects.
+ *
+ * The values are type casted like values of COPY per PG::TypeMap::DefaultTypeMappable .
+ * A PG::TypeMapByOid like PG::BasicTypeMapForResults is converted to a PG::TypeMapByColumn
+ * per PG::TypeMapByOid#build_column_map with the field types of the result.
+ */
+static VALUE
+pg_spilled_result_type_map_set( VALUE self, VALUE typemap )
+{
+	t_pg_spilled_result *this = pg_spilled_result_get_this( self );
+	t_typemap *p_typemap;
+
+	if( rb_respond_to(typemap, rb_intern("build_column_map")) )
+		typemap = rb_funcall( typemap, rb_intern("build_column_map"), 1, this->description );
+	if( !rb_obj_is_kind_of(typemap, rb_cTypeMap) ){
+		rb_raise( rb_eTypeError, "wrong argument type %s (expected kind of PG::TypeMap)",
+				rb_obj_classname( typemap ) );
+	}
+	p_typemap = DATA_PTR( typemap );
+	p_typemap->funcs.fit_to_copy_get( typemap );
+
+	this->typemap = typemap;
+	this->p_typemap = p_typemap;
+	return typemap;
+}
+
+/*
+ * call-seq:
+ *    res.type_map -> PG::TypeMap
+ *
+ * Returns the TypeMap that is used for type casts of the values.
+ */
+static VALUE
+pg_spilled_result_type_map_get( VALUE self )
+{
+	return pg_spilled_result_get_this( self )->typemap;
+}
+
+/*
+ * call-seq:
+ *    res.clear -> nil
+ *
+ * Unmap the spill file, which releases the disk space.
+ * Afterwards the result can't be used any longer.
+ */
+static VALUE
+pg_spilled_result_clear_m( VALUE self )
+{
+	t_pg_spilled_result *this;
+	TypedData_Get_Struct( self, t_pg_spilled_result, &pg_spilled_result_type, this );
+
+	pg_spilled_result_clear( this );
+	if( !NIL_P(this->description) )
+		pg_result_clear( this->description );
+	this->description = Qnil;
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *    res.cleared? -> Boolean
+ *
+ * Returns +true+ if the result was cleared.
+ */
+static VALUE
+pg_spilled_result_cleared_p( VALUE self )
+{
+	t_pg_spilled_result *this;
+	TypedData_Get_Struct( self, t_pg_spilled_result, &pg_spilled_result_type, this );
+	return NIL_P(this->description) ? Qtrue : Qfalse;
+}
+
+#endif /* PG_HAVE_SPILLED_RESULT */
+
+void
+init_pg_spilled_result()
+{
+#ifdef PG_HAVE_SPILLED_RESULT
+	/*
+	 * Document-class: PG::SpilledResult
+	 *
+	 * A query result, which is stored in a temporary file instead of the memory of libpq.
+	 * It is retrieved by PG::Connection#exec_spilled .
+	 *
+	 * The tuples are received in single row mode and written to the file in the wire
+	 * format of the values, preceded by their length. The file is memory mapped, so that
+	 * the page cache holds the data rather than the Ruby heap or libpq. An index of the
+	 * offset of every 16th tuple allows random access.
+	 *
+	 * The values are type casted on demand each time they are retrieved. Methods like
+	 * #each , #each_row , #column_values and #getvalue work like those of PG::Result .
+	 */
+	rb_cPG_SpilledResult = rb_define_class_under( rb_mPG, "SpilledResult", rb_cObject );
+	rb_undef_alloc_func( rb_cPG_SpilledResult );
+	rb_include_module( rb_cPG_SpilledResult, rb_mEnumerable );
+
+	rb_define_method( rb_cPG_SpilledResult, "ntuples", pg_spilled_result_ntuples, 0 );
+	rb_define_alias( rb_cPG_SpilledResult, "num_tuples", "ntuples" );
+	rb_define_method( rb_cPG_SpilledResult, "nfields", pg_spilled_result_nfields, 0 );
+	rb_define_alias( rb_cPG_SpilledResult, "num_fields", "nfields" );
+	rb_define_method( rb_cPG_SpilledResult, "description", pg_spilled_result_description, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "bytesize", pg_spilled_result_bytesize, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "getvalue", pg_spilled_result_getvalue, 2 );
+	rb_define_method( rb_cPG_SpilledResult, "getisnull", pg_spilled_result_getisnull, 2 );
+	rb_define_method( rb_cPG_SpilledResult, "getlength", pg_spilled_result_getlength, 2 );
+	rb_define_method( rb_cPG_SpilledResult, "[]", pg_spilled_result_aref, 1 );
+	rb_define_method( rb_cPG_SpilledResult, "each", pg_spilled_result_each, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "each_row", pg_spilled_result_each_row, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "values", pg_spilled_result_values, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "column_values", pg_spilled_result_column_values, 1 );
+	rb_define_method( rb_cPG_SpilledResult, "tuple_values", pg_spilled_result_tuple_values, 1 );
+	rb_define_method( rb_cPG_SpilledResult, "type_map=", pg_spilled_result_type_map_set, 1 );
+	rb_define_method( rb_cPG_SpilledResult, "type_map", pg_spilled_result_type_map_get, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "clear", pg_spilled_result_clear_m, 0 );
+	rb_define_method( rb_cPG_SpilledResult, "cleared?", pg_spilled_result_cleared_p, 0 );
+
+	rb_define_method( rb_cPGconn, "receive_spilled_result", pgconn_receive_spilled_result, 1 );
+#endif
+}
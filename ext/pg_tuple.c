@@ -10,6 +10,7 @@
  * All field values of the tuple are retrieved on demand from the underlying PGresult object and converted to a Ruby object.
  * Subsequent access to the same field returns the same object, since they are cached when materialized.
  * Each PG::Tuple holds a reference to the related PG::Result object, but gets detached, when all fields are materialized.
+ * PG::Tuple#compact! replaces this reference by a copy of the tuple's values, so that a retained tuple doesn't keep the whole result alive.
  *
  * Example:
  *    require 'pg'
@@ -173,9 +174,15 @@ pg_tuple_materialize_field(t_pg_tuple *this, int col)
 
 	if( value == Qundef ){
 		t_typemap *p_typemap = DATA_PTR( this->typemap );
+		t_pg_result *p_result = pgresult_get_this(this->result);
 
 		pgresult_get(this->result); /* make sure we have a valid PGresult object */
-		value = p_typemap->funcs.typecast_result_value(p_typemap, this->result, this->row_num, col);
+		if( !NIL_P(p_result->mat_values) ){
+			value = pgresult_materialized_value(p_result, this->row_num, col);
+		} else {
+			value = p_typemap->funcs.typecast_result_value(p_typemap, this->result, this->row_num, col);
+			pgresult_account_value(p_result, value);
+		}
 		this->values[col] = value;
 	}
 
@@ -201,6 +208,60 @@ pg_tuple_materialize(t_pg_tuple *this)
 	pg_tuple_detach(this);
 }
 
+static void
+pg_tuple_compact(t_pg_tuple *this)
+{
+	t_pg_result *p_result;
+	int field_num;
+
+	if( NIL_P(this->result) )
+		return;
+
+	p_result = pgresult_get_this(this->result);
+	pgresult_get(this->result); /* make sure we have a valid PGresult object */
+
+	/* Retrieving the remaining values is cheap, if they are already decoded. */
+	if( !NIL_P(p_result->mat_values) ){
+		pg_tuple_materialize(this);
+		return;
+	}
+	for(field_num = 0; field_num < this->num_fields; field_num++) {
+		if( this->values[field_num] == Qundef )
+			break;
+	}
+	if( field_num == this->num_fields ){
+		pg_tuple_detach(this);
+		return;
+	}
+
+	this->result = pg_result_copy_tuple(this->result, this->row_num, this->typemap, this->values);
+	this->row_num = 0;
+}
+
+/*
+ * call-seq:
+ *    tup.compact! -> self
+ *
+ * Release the reference to the PG::Result object this tuple was retrieved from.
+ *
+ * The values of the fields, that are not yet retrieved, are copied in their wire format
+ * into a result with just this one tuple.
+ * They are still type casted on demand per the type map of the original result.
+ * So retaining a compacted tuple doesn't prevent the memory of a large result
+ * from being released.
+ *
+ * The copy is a PGresult of its own, which carries the field descriptions, so
+ * that it takes some kilobytes per tuple, even for a few small values.
+ * Compact only the tuples which outlive a large result, not every tuple retrieved.
+ */
+static VALUE
+pg_tuple_compact_bang(VALUE self)
+{
+	t_pg_tuple *this = pg_tuple_get_this(self);
+	pg_tuple_compact(this);
+	return self;
+}
+
 /*
  * call-seq:
  *    tup.fetch(key) → value
@@ -539,6 +600,7 @@ init_pg_tuple()
 	rb_define_method(rb_cPG_Tuple, "length", pg_tuple_length, 0);
 	rb_define_alias(rb_cPG_Tuple, "size", "length");
 	rb_define_method(rb_cPG_Tuple, "index", pg_tuple_index, 1);
+	rb_define_method(rb_cPG_Tuple, "compact!", pg_tuple_compact_bang, 0);
 
 	rb_define_private_method(rb_cPG_Tuple, "field_map", pg_tuple_field_map, 0);
 	rb_define_private_method(rb_cPG_Tuple, "field_names", pg_tuple_field_names, 0);
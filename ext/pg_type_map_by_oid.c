@@ -87,6 +87,43 @@ pg_tmbo_build_type_map_for_result2( t_tmbo *this, PGresult *pgresult )
 	return colmap;
 }
 
+/*
+ * Build a TypeMapByColumn for columns of the given type OIDs.
+ *
+ * Returns nil if +self+ is no TypeMapByOid.
+ * This is used to decode values which are not received as PGresult, like tuples of logical replication.
+ */
+VALUE
+pg_tmbo_build_type_map_for_oids( VALUE self, int nfields, const Oid *oids, int format )
+{
+	t_tmbo *this;
+	t_tmbc *p_colmap;
+	int i;
+	VALUE colmap;
+
+	if( !rb_obj_is_kind_of(self, rb_cTypeMapByOid) )
+		return Qnil;
+	this = DATA_PTR( self );
+
+	p_colmap = xmalloc(sizeof(t_tmbc) + sizeof(struct pg_tmbc_converter) * nfields);
+	/* Set nfields to 0 at first, so that GC mark function doesn't access uninitialized memory. */
+	p_colmap->nfields = 0;
+	p_colmap->typemap.funcs = pg_tmbc_funcs;
+	p_colmap->typemap.default_typemap = this->typemap.default_typemap;
+
+	colmap = pg_tmbc_allocate();
+	DATA_PTR(colmap) = p_colmap;
+
+	for(i=0; i<nfields; i++)
+	{
+		p_colmap->convs[i].cconv = pg_tmbo_lookup_oid( this, format, oids[i] );
+	}
+
+	p_colmap->nfields = nfields;
+
+	return colmap;
+}
+
 static VALUE
 pg_tmbo_result_value(t_typemap *p_typemap, VALUE result, int tuple, int field)
 {
@@ -69,6 +69,16 @@ module PG
 	require 'pg/type_map_by_column'
 	require 'pg/connection'
 	require 'pg/result'
+	require 'pg/spilled_result'
 	require 'pg/tuple'
+	require 'pg/parallel_copy'
+	require 'pg/parallel_export'
+	require 'pg/connection_pool'
+	require 'pg/connection_group'
+	require 'pg/multiplexed_connection'
+	require 'pg/query_key'
+	require 'pg/singleflight'
+	require 'pg/query_cache'
+	require 'pg/logical_replication'
 
 end # module PG
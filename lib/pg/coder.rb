@@ -94,6 +94,20 @@ module PG
 		end
 	end
 
+	# Attributes shared by PG::TextEncoder::CsvRow and PG::TextDecoder::CsvRow .
+	module CsvCoder
+		def to_h
+			super.merge!({
+				quote: quote,
+				escape: escape,
+				force_quote: force_quote,
+				header: header,
+			})
+		end
+	end
+	TextEncoder::CsvRow.include( CsvCoder )
+	TextDecoder::CsvRow.include( CsvCoder )
+
 	class RecordCoder < Coder
 		def to_h
 			super.merge!({
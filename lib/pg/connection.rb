@@ -3,6 +3,7 @@
 
 require 'pg' unless defined?( PG )
 require 'uri'
+require 'tmpdir'
 
 # The PostgreSQL connection class. The interface for this class is based on
 # {libpq}[http://www.postgresql.org/docs/9.2/interactive/libpq.html], the C
@@ -209,6 +210,416 @@ class PG::Connection
 		end
 	end
 
+	# call-seq:
+	#    conn.cursor_each( sql, params=nil, fetch_rows: 1000, fetch_bytes: nil, max_fetch_rows: 100000, prefetch: false, batches: false ) {|row| ... } -> Integer
+	#
+	# Executes _sql_ per server side cursor and yields the rows batch by batch.
+	#
+	# Unlike single row mode (see #set_single_row_mode) other queries can be sent on the
+	# same connection within the block, since each batch is retrieved by a separate +FETCH+ .
+	# The cursor is declared, fetched from and closed by this method.
+	# A transaction is started, if the connection isn't in a transaction block already.
+	# _params_ are passed to the +DECLARE+ command like to #exec_params .
+	#
+	# Each row is yielded as Hash like by PG::Result#each .
+	# With <tt>batches: true</tt> the PG::Result of each +FETCH+ is yielded instead.
+	#
+	# Options:
+	# [fetch_rows]  Number of rows of the first +FETCH+ and of all others, if _fetch_bytes_ isn't given.
+	# [fetch_bytes]  Target memory size of each batch. The number of rows per +FETCH+ is then
+	#                adapted to the memory size (PG::Result#memsize) of the previous batch.
+	# [max_fetch_rows]  Upper limit of the adapted number of rows per +FETCH+ .
+	# [prefetch]  Send the +FETCH+ of the next batch before the current batch is yielded, so
+	#             that the server processes it while the rows are decoded. The connection can
+	#             not be used for other queries within the block in this mode.
+	#
+	# Returns the number of rows.
+	#
+	# Example:
+	#   conn.cursor_each( "SELECT * FROM events WHERE created_at > $1", [since], fetch_bytes: 4 * 1024 * 1024 ) do |row|
+	#     conn.exec_params( "INSERT INTO event_log VALUES ($1, $2)", [row["id"], row["kind"]] )
+	#   end
+	def cursor_each( sql, params=nil, fetch_rows: 1000, fetch_bytes: nil, max_fetch_rows: 100_000, prefetch: false, batches: false, &block )
+		unless block
+			return enum_for( __method__, sql, params, fetch_rows: fetch_rows, fetch_bytes: fetch_bytes,
+					max_fetch_rows: max_fetch_rows, prefetch: prefetch, batches: batches )
+		end
+		args = [sql, params, fetch_rows, fetch_bytes, max_fetch_rows, prefetch, batches]
+
+		if transaction_status == PQTRANS_IDLE
+			transaction { cursor_fetch_all( *args, &block ) }
+		else
+			cursor_fetch_all( *args, &block )
+		end
+	end
+
+	### Declare a cursor and yield all rows or batches of it.
+	def cursor_fetch_all( sql, params, fetch_rows, fetch_bytes, max_fetch_rows, prefetch, batches )
+		@cursor_count = (@cursor_count || 0) + 1
+		name = quote_ident( "pg_cursor_#{@cursor_count}" )
+		declare = "DECLARE #{name} NO SCROLL CURSOR FOR #{sql}"
+		params ? exec_params( declare, params ) : exec( declare )
+
+		count = requested = fetch_rows
+		pending = false
+		rows = 0
+		begin
+			loop do
+				unless pending
+					send_query( "FETCH #{count} FROM #{name}" )
+					requested = count
+					pending = true
+				end
+				res = get_last_result
+				pending = false
+				fetched = res.ntuples
+				rows += fetched
+				eof = fetched < requested
+
+				if fetch_bytes && fetched > 0
+					# Grow by at most factor 4, so that a batch of unusually small rows doesn't
+					# result in a huge next batch.
+					count = (fetch_bytes * fetched / [res.memsize, 1].max).clamp( 1, [count * 4, max_fetch_rows].min )
+				end
+				if prefetch && !eof
+					send_query( "FETCH #{count} FROM #{name}" )
+					requested = count
+					pending = true
+				end
+
+				if batches
+					yield res
+				else
+					res.each {|row| yield row }
+					res.clear
+				end
+				break if eof
+			end
+		ensure
+			discard_results if pending
+			exec( "CLOSE #{name}" ) if transaction_status == PQTRANS_INTRANS
+		end
+		rows
+	end
+	private :cursor_fetch_all
+
+	# call-seq:
+	#    conn.exec_spilled( sql, params=nil, dir: Dir.tmpdir ) -> PG::SpilledResult
+	#
+	# Executes _sql_ and stores the result in a memory mapped temporary file in _dir_ .
+	#
+	# This is meant for results, which are too large to be held in memory, but must be
+	# iterated multiple times or accessed randomly.
+	# The rows are received in single row mode and written to the file as they arrive.
+	# The file is unlinked at once, so that its disk space is released, when the
+	# PG::SpilledResult is cleared or garbage collected.
+	# _params_ are passed like to #exec_params .
+	#
+	# The #type_map_for_results of the connection is applied to the PG::SpilledResult .
+	#
+	# Example:
+	#   res = conn.exec_spilled( "SELECT * FROM measurements" )
+	#   res.column_values( 2 ).sum
+	#   res.each_row {|id, time, value| ... }
+	#   res.clear
+	def exec_spilled( sql, params=nil, dir: Dir.tmpdir )
+		raise NotImplementedError, "spilled results aren't supported on this platform" unless respond_to?( :receive_spilled_result )
+
+		discard_results
+		params ? send_query_params( sql, params ) : send_query( sql )
+		begin
+			set_single_row_mode
+			res = receive_spilled_result( dir )
+		rescue Exception
+			cancel
+			discard_results
+			raise
+		end
+		res.type_map = type_map_for_results unless PG::TypeMapAllStrings === type_map_for_results
+		res
+	end
+
+	# call-seq:
+	#    conn.lo_copy_to( io, lo_desc, chunk: 65536, window: nil ) -> Integer
+	#
+	# Streams the content of the opened large object _lo_desc_ into _io_,
+	# starting at the current position of the large object.
+	#
+	# _io_ can be any object responding to +write+ or an Integer file descriptor.
+	# The data is transferred in pieces of _chunk_ bytes through one reused
+	# String buffer, so that objects of arbitrary size can be exported to the
+	# client filesystem without holding them in memory.
+	# Returns the number of bytes copied.
+	#
+	# Each #lo_read is a round trip to the server.
+	# If _window_ is given, the chunks are instead retrieved per SQL function +loread()+ with
+	# _window_ chunks per query in single row mode, so that only one round trip per
+	# _window_ chunks is required.
+	# This is much faster on high latency connections.
+	# The connection must not be used for other queries while the transfer is running.
+	#
+	# Example:
+	#   conn.transaction do
+	#     lo_desc = conn.lo_open( oid, PG::INV_READ )
+	#     File.open( "document.pdf", "wb" ) {|f| conn.lo_copy_to( f, lo_desc ) }
+	#     conn.lo_close( lo_desc )
+	#   end
+	def lo_copy_to( io, lo_desc, chunk: 65536, window: nil )
+		if io.kind_of?( Integer )
+			io = IO.for_fd( io, autoclose: false )
+			# Write through to the file descriptor, since the IO object is dropped afterwards.
+			io.sync = true
+		end
+		bytes = 0
+		if window
+			lo_read_windowed( lo_desc, chunk, window ) do |data|
+				io.write( data )
+				bytes += data.bytesize
+			end
+		else
+			buffer = String.new( capacity: chunk )
+			while lo_read_into( lo_desc, chunk, buffer )
+				io.write( buffer )
+				bytes += buffer.bytesize
+			end
+		end
+		bytes
+	end
+
+	# call-seq:
+	#    conn.lo_copy_from( io, lo_desc, chunk: 65536, window: nil ) -> Integer
+	#
+	# Streams all data readable from _io_ into the large object _lo_desc_,
+	# which must be opened with PG::INV_WRITE.
+	#
+	# _io_ can be any object responding to <tt>read(length, buffer)</tt>
+	# or an Integer file descriptor.
+	# The data is transferred in pieces of _chunk_ bytes through one reused String buffer.
+	# Returns the number of bytes copied.
+	#
+	# If _window_ is given, up to _window_ chunks are sent per query as binary
+	# parameters of the SQL function +lowrite()+ , so that only one round trip
+	# per _window_ chunks is required.
+	#
+	# Example:
+	#   conn.transaction do
+	#     oid = conn.lo_creat
+	#     lo_desc = conn.lo_open( oid, PG::INV_WRITE )
+	#     File.open( "document.pdf", "rb" ) {|f| conn.lo_copy_from( f, lo_desc ) }
+	#     conn.lo_close( lo_desc )
+	#   end
+	def lo_copy_from( io, lo_desc, chunk: 65536, window: nil )
+		io = IO.for_fd( io, autoclose: false ) if io.kind_of?( Integer )
+		bytes = 0
+		if window
+			buffers = Array.new( window ) { String.new( capacity: chunk ) }
+			type_map = PG::TypeMapAllStrings.new
+			loop do
+				nbuffers = 0
+				nbuffers += 1 while nbuffers < window && io.read( chunk, buffers[nbuffers] )
+				break if nbuffers == 0
+
+				values = (2..nbuffers+1).map{|i| "($#{i}::bytea)" }.join(",")
+				params = buffers.first( nbuffers ).map{|b| { value: b, format: 1 } }
+				res = exec_params( "SELECT sum(lowrite($1, d)) FROM (VALUES #{values}) AS v(d)",
+						[lo_desc, *params], 0, type_map )
+				bytes += res.getvalue( 0, 0 ).to_i
+			end
+		else
+			buffer = String.new( capacity: chunk )
+			while io.read( chunk, buffer )
+				bytes += lo_write( lo_desc, buffer )
+			end
+		end
+		bytes
+	end
+
+	### Yield the content of the large object _lo_desc_ in pieces of _chunk_ bytes,
+	### requesting _window_ pieces per query.
+	def lo_read_windowed( lo_desc, chunk, window )
+		type_map = PG::TypeMapAllStrings.new
+		loop do
+			send_query_params( "SELECT loread($1, $2) FROM generate_series(1, $3)",
+					[lo_desc, chunk, window], 1, type_map )
+			set_single_row_mode
+			res = get_result
+			res.type_map = type_map
+			eof = false
+			begin
+				res.stream_each_row do |(data)|
+					next if eof
+					yield data unless data.empty?
+					# A short read marks the end of the large object
+					eof = true if data.bytesize < chunk
+				end
+			rescue Exception
+				cancel
+				while get_result
+				end
+				raise
+			end
+			while get_result
+			end
+			break if eof
+		end
+	end
+	private :lo_read_windowed
+
+	# call-seq:
+	#    conn.stream_wal( dir, slot: nil, start_lsn: nil, timeline: nil, fsync_bytes: 1048576, status_interval: 10 ) {|path| ... } -> Hash
+	#
+	# Receives WAL per <tt>START_REPLICATION ... PHYSICAL</tt> and stores it in segment files of _dir_ ,
+	# in the same way as +pg_receivewal+ does.
+	# The connection must be opened with <tt>replication: true</tt> .
+	#
+	# Streaming is continued after the last segment in _dir_ , if there is one.
+	# Otherwise it starts at the current WAL position of the server or at _start_lsn_ .
+	# An incomplete segment is written to a file with the suffix <tt>.partial</tt> and
+	# renamed when it is complete. The block is called with the path of each completed segment.
+	#
+	# Receiving, writing and the standby status updates are done in C without the GVL.
+	# Data is fsync'ed after _fsync_bytes_ and before its position is reported as flushed
+	# to the server, which happens at least every _status_interval_ seconds.
+	# If a replication _slot_ is used, the server keeps all WAL which isn't flushed.
+	#
+	# The method returns when the server ends the stream, for instance at the end of the timeline.
+	# It returns a Hash with the +:timeline+ , the +:written_lsn+ and +:flushed_lsn+ and
+	# the +:next_timeline+ , if the server switched to a new timeline.
+	#
+	# Example:
+	#   conn = PG.connect( dbname: "postgres", replication: true )
+	#   conn.stream_wal( "/archive/wal", slot: "archiver" ) do |path|
+	#     puts "archived #{path}"
+	#   end
+	def stream_wal( dir, slot: nil, start_lsn: nil, timeline: nil, fsync_bytes: 1024 * 1024, status_interval: 10, &block )
+		raise NotImplementedError, "physical replication isn't supported on this platform" unless respond_to?( :receive_wal )
+
+		ident = exec( "IDENTIFY_SYSTEM" )
+		timeline ||= ident.getvalue( 0, 1 ).to_i
+		segment_size = wal_segment_size
+		start_lsn ||= wal_resume_lsn( dir, timeline, segment_size ) ||
+			PG::LogicalReplication.parse_lsn( ident.getvalue(0, 2) )
+		# Segments are always written from their beginning.
+		start_lsn -= start_lsn % segment_size
+
+		sql = +"START_REPLICATION"
+		sql << " SLOT #{quote_ident(slot)}" if slot
+		sql << " PHYSICAL #{PG::LogicalReplication.lsn_to_s(start_lsn)} TIMELINE #{timeline}"
+		exec( sql )
+		begin
+			res = receive_wal( dir, start_lsn, timeline, segment_size, fsync_bytes, status_interval, &block )
+			res[:timeline] = timeline
+			# At the end of a timeline the server sends the next one.
+			while result = get_result
+				result.check
+				res[:next_timeline] = result.getvalue( 0, 0 ).to_i if result.ntuples > 0
+			end
+		ensure
+			discard_results
+		end
+		res
+	end
+
+	# call-seq:
+	#    conn.base_backup( dir, format: :tar, label: "pg base backup", fast_checkpoint: true, wal: true, max_rate: nil ) -> Hash
+	#
+	# Takes a base backup of the server per +BASE_BACKUP+ and stores it in the existing directory _dir_ .
+	# The connection must be opened with <tt>replication: true</tt> .
+	#
+	# With <tt>format: :tar</tt> one tar file is written per tablespace, like +pg_basebackup+ does.
+	# With <tt>format: :plain</tt> the archives are extracted, so that _dir_ can be used as data
+	# directory of a replica. Tablespaces are then extracted to <tt>dir/tablespaces/<oid></tt> and
+	# the symlinks in +pg_tblspc+ point to them.
+	# The archives are received and written in C without the GVL.
+	#
+	# Options:
+	# [label]  Label of the backup.
+	# [fast_checkpoint]  Request an immediate checkpoint instead of a spread one.
+	# [wal]  Include the WAL which is required to make the backup consistent.
+	# [max_rate]  Maximum transfer rate in kB per second.
+	#
+	# Returns a Hash with +:start_lsn+ , +:end_lsn+ , +:timeline+ and the names of the +:archives+ .
+	#
+	# Example:
+	#   conn = PG.connect( dbname: "postgres", replication: true )
+	#   Dir.mkdir( "/var/lib/replica" )
+	#   conn.base_backup( "/var/lib/replica", format: :plain )
+	def base_backup( dir, format: :tar, label: "pg base backup", fast_checkpoint: true, wal: true, max_rate: nil )
+		raise NotImplementedError, "physical replication isn't supported on this platform" unless respond_to?( :receive_base_backup )
+		plain = case format
+			when :tar then false
+			when :plain then true
+			else raise ArgumentError, "invalid format #{format.inspect}"
+		end
+		# The messages of the archive stream are framed since PostgreSQL-15.
+		framed = server_version >= 150000
+
+		if framed
+			options = [ "LABEL #{escape_literal(label)}", "WAIT false" ]
+			options << "CHECKPOINT 'fast'" if fast_checkpoint
+			options << "WAL" if wal
+			options << "MAX_RATE #{Integer(max_rate)}" if max_rate
+			sql = "BASE_BACKUP (#{options.join(", ")})"
+		else
+			sql = +"BASE_BACKUP LABEL #{escape_literal(label)} NOWAIT"
+			sql << " FAST" if fast_checkpoint
+			sql << " WAL" if wal
+			sql << " MAX_RATE #{Integer(max_rate)}" if max_rate
+		end
+
+		send_query( sql )
+		begin
+			res = get_result.check
+			start_lsn = res.getvalue( 0, 0 )
+			timeline = res.getvalue( 0, 1 ).to_i
+			tablespaces = get_result.check
+
+			archives = []
+			if framed
+				get_result.check
+				archives.concat receive_base_backup( dir, plain, true )
+			else
+				tablespaces.each_row do |oid, _location, _size|
+					get_result.check
+					archives.concat receive_base_backup( dir, plain, false, oid ? "#{oid}.tar" : "base.tar" )
+				end
+			end
+
+			res = get_result.check
+			if res.result_status == PG::PGRES_COPY_OUT
+				# PostgreSQL-13 and 14 send the backup manifest separately.
+				archives.concat receive_base_backup( dir, plain, false, "backup_manifest" )
+				res = get_result.check
+			end
+			end_lsn = res.getvalue( 0, 0 )
+		ensure
+			discard_results
+		end
+
+		{ start_lsn: start_lsn, end_lsn: end_lsn, timeline: timeline, archives: archives }
+	end
+
+	### Return the WAL segment size of the server in bytes.
+	def wal_segment_size
+		value = exec( "SHOW wal_segment_size" ).getvalue( 0, 0 )
+		num, unit = value.match( /\A(\d+)\s*(\w*)\z/ ).captures
+		num.to_i * { "" => 1, "B" => 1, "kB" => 1024, "MB" => 1024 ** 2, "GB" => 1024 ** 3 }.fetch( unit )
+	end
+	private :wal_segment_size
+
+	### Return the position after the last complete segment in _dir_ or the start of
+	### a partial segment.
+	def wal_resume_lsn( dir, timeline, segment_size )
+		segs_per_id = 0x100000000 / segment_size
+		lsns = Dir.children( dir ).map do |name|
+			next unless name =~ /\A(\h{8})(\h{8})(\h{8})(\.partial)?\z/ && $1.hex == timeline
+			segno = $2.hex * segs_per_id + $3.hex
+			($4 ? segno : segno + 1) * segment_size
+		end
+		lsns.compact.max
+	end
+	private :wal_resume_lsn
+
 	# Backward-compatibility aliases for stuff that's moved into PG.
 	class << self
 		define_method( :isthreadsafe, &PG.method(:isthreadsafe) )
@@ -0,0 +1,341 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# Run the same query on several connections at once.
+#
+# PG::ConnectionGroup sends a query to all of its connections per
+# PG::Connection#send_query_params and waits for the results of all of them in
+# one event loop on their sockets. So the latency of a query spanning several
+# servers, like the shards of a partitioned database, is that of the slowest
+# server rather than the sum of all of them, without a thread per connection.
+#
+# Example:
+#   shards = 32.times.map {|i| PG.connect(dbname: "shard#{i}") }
+#   group = PG::ConnectionGroup.new( shards )
+#   counts = group.exec_params_all( "SELECT count(*) FROM orders WHERE customer = $1", [42] )
+#   counts.sum {|res| res.getvalue(0, 0).to_i }
+#
+#   group.stream_each_all( "SELECT * FROM orders WHERE customer = $1", [42] ) do |row, shard|
+#     # the rows of all shards in the order they arrive
+#   end
+class PG::ConnectionGroup
+
+	# Raised by #exec_params_all when the query failed on at least one connection.
+	# #errors is a Hash of connection index => exception.
+	class Error < PG::MultiError
+		# Array of the results of all connections in order, with +nil+ for the failed ones.
+		attr_reader :results
+
+		def initialize( errors, results )
+			@results = results
+			super( errors, "the query failed on #{errors.size} of #{results.size} connections", "connection" )
+		end
+	end
+
+	# OIDs of the types whose values may be merged as Strings:
+	# char, name, text, bpchar, varchar and uuid.
+	STRING_KEY_TYPES = [18, 19, 25, 1042, 1043, 2950].freeze
+
+	# The connections of the group.
+	attr_reader :connections
+
+	### Create a group of +connections+ . They must not be used by other threads meanwhile.
+	def initialize( connections )
+		raise ArgumentError, "at least one connection is required" if connections.empty?
+		@connections = connections
+	end
+
+	### Run +sql+ on all connections at once and return the results in the order of the connections.
+	#
+	# The arguments are the same as of PG::Connection#exec_params .
+	# If the query fails on some of the connections, the others are processed to the end
+	# and a PG::ConnectionGroup::Error is raised, which contains the errors and the
+	# results of the successful connections.
+	def exec_params_all( sql, params=[], result_format=0, type_map=nil )
+		send_all( :send_query_params, sql, params, result_format, type_map )
+		gather
+	end
+
+	### Run the prepared statement +name+ on all connections at once and return the
+	### results in the order of the connections.
+	### The statement must be prepared on each connection.
+	###
+	### See #exec_params_all for details.
+	def exec_prepared_all( name, params=[], result_format=0, type_map=nil )
+		send_all( :send_query_prepared, name, params, result_format, type_map )
+		gather
+	end
+
+	### Run +sql+ on all connections at once and yield the rows of all of them in the
+	### order they arrive, together with the index of the connection.
+	#
+	# The rows are received in single row mode, so that the results are never held in
+	# memory as a whole. Each row is an Array of values type casted per the
+	# PG::Connection#type_map_for_results of its connection.
+	# The first error is raised at once. The queries on the other connections are then
+	# cancelled, as well as when the block is left early.
+	#
+	# Returns the total number of rows or an Enumerator if no block is given.
+	def stream_each_all( sql, params=[], result_format=0, type_map=nil )
+		return to_enum( :stream_each_all, sql, params, result_format, type_map ) unless block_given?
+
+		send_all( :send_query_params, sql, params, result_format, type_map ) do |conn|
+			conn.set_single_row_mode
+		end
+
+		nrows = 0
+		completed = false
+		begin
+			event_loop do |idx, res|
+				raise res if Exception === res
+				res.check
+				next unless res.result_status == PG::PGRES_SINGLE_TUPLE
+				yield res.values.first, idx
+				nrows += 1
+			end
+			completed = true
+		ensure
+			abort_all unless completed
+		end
+		nrows
+	end
+
+	### Run +sql+ , which must be sorted by +key+ , on all connections at once and yield
+	### the rows of all of them in global order, together with the index of the connection.
+	#
+	# This is a k-way merge of sorted streams, like the rows of
+	# <tt>SELECT ... ORDER BY ... LIMIT n</tt> over several shards.
+	# The rows are received in single row mode and only the +key+ columns are
+	# decoded to drive the merge. Each yielded row is an Array of values type casted
+	# per the PG::Connection#type_map_for_results of its connection.
+	#
+	# Options:
+	# [key]  Column number or name or an Array of them, which the query is ordered by.
+	# [key_decoders]  Array of PG::Coder objects decoding the key columns, so that they can
+	#                 be compared. They are used for the yielded rows as well.
+	#                 Default is the PG::Connection#type_map_for_results , which must then
+	#                 decode the keys to comparable objects, like numbers instead of Strings.
+	#                 An ArgumentError is raised if it returns Strings for keys of another
+	#                 type than text, since "10" would be sorted before "9" .
+	# [descending]  +true+ if the rows are sorted in descending order.
+	# [nulls_first]  +true+ if NULL keys are sorted before all other values, +false+ if after them.
+	#                Default is PostgreSQL's default: NULLS LAST in ascending and NULLS FIRST
+	#                in descending order.
+	# [limit]  Maximum number of rows to yield. The queries are cancelled when the limit is reached.
+	#
+	# Returns the number of yielded rows or an Enumerator if no block is given.
+	def merge_each( sql, params=[], key:, key_decoders: nil, descending: false, nulls_first: nil, limit: nil, type_map: nil )
+		return to_enum( :merge_each, sql, params, key: key, key_decoders: key_decoders, descending: descending, nulls_first: nulls_first, limit: limit, type_map: type_map ) unless block_given?
+
+		send_all( :send_query_params, sql, params, 0, type_map ) do |conn|
+			conn.set_single_row_mode
+		end
+
+		keys = Array( key )
+		cmp = merge_comparator( descending, nulls_first.nil? ? descending : nulls_first )
+		key_maps = []
+		heap = []
+		nrows = 0
+		completed = false
+		begin
+			# The queries run concurrently, so waiting for the first row of one after the other
+			# takes the time of the slowest connection only.
+			@connections.each_with_index do |conn, idx|
+				res = next_row( conn ) or next
+				heap_push( heap, merge_entry( res, idx, keys, key_decoders, key_maps ), cmp )
+			end
+
+			until heap.empty? || (limit && nrows >= limit)
+				_, idx, res = heap_pop( heap, cmp )
+				yield res.values.first, idx
+				nrows += 1
+
+				if res = next_row( @connections[idx] )
+					heap_push( heap, merge_entry( res, idx, keys, key_decoders, key_maps ), cmp )
+				end
+			end
+			completed = heap.empty?
+		ensure
+			abort_all unless completed
+		end
+		nrows
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the next single row result of +conn+ or +nil+ at the end of the rows.
+	def next_row( conn )
+		while res = conn.get_result
+			res.check
+			return res if res.result_status == PG::PGRES_SINGLE_TUPLE
+		end
+		nil
+	end
+
+	### Build the heap entry of the row in +res+ : the decoded key, the connection index and the row.
+	def merge_entry( res, idx, keys, decoders, key_maps )
+		cols = keys.map {|col| Integer === col ? col : res.fnumber( col.to_s ) }
+		if decoders
+			key_maps[idx] ||= begin
+				coders = Array.new( res.nfields )
+				cols.each_with_index {|col, i| coders[col] = decoders[i] }
+				PG::TypeMapByColumn.new( coders ).with_default_type_map( @connections[idx].type_map_for_results )
+			end
+			res.type_map = key_maps[idx]
+		end
+		values = cols.map {|col| res.getvalue( 0, col ) }
+		key_maps[idx] ||= check_merge_keys( res, cols, values ) unless decoders
+		[values, idx, res]
+	end
+
+	### Raise an ArgumentError if a key was decoded to a String, which wouldn't sort like
+	### its type. Returns +true+ if all keys could be checked, which needs non-NULL values.
+	def check_merge_keys( res, cols, values )
+		cols.zip( values ).all? do |col, val|
+			next false if val.nil?
+			if String === val && !STRING_KEY_TYPES.include?( res.ftype(col) )
+				raise ArgumentError, "key column #{res.fname(col).inspect} of type #{res.ftype(col)} " \
+					"is decoded to a String, which is sorted differently; use key_decoders"
+			end
+			true
+		end
+	end
+
+	### Return a Proc comparing two heap entries.
+	### Ties are resolved by the connection index for a stable merge.
+	def merge_comparator( descending, nulls_first )
+		sign = descending ? -1 : 1
+		null_sign = nulls_first ? -1 : 1
+		lambda do |a, b|
+			a[0].each_with_index do |va, i|
+				vb = b[0][i]
+				c = if va.nil? || vb.nil?
+					((va.nil? ? 1 : 0) - (vb.nil? ? 1 : 0)) * null_sign
+				else
+					(va <=> vb or raise ArgumentError, "keys #{va.inspect} and #{vb.inspect} can't be compared") * sign
+				end
+				return c if c != 0
+			end
+			a[1] <=> b[1]
+		end
+	end
+
+	def heap_push( heap, entry, cmp )
+		heap << entry
+		i = heap.size - 1
+		while i > 0
+			parent = (i - 1) / 2
+			break if cmp.call( heap[parent], entry ) <= 0
+			heap[i] = heap[parent]
+			i = parent
+		end
+		heap[i] = entry
+	end
+
+	def heap_pop( heap, cmp )
+		top = heap.first
+		last = heap.pop
+		return top if heap.empty?
+
+		i = 0
+		size = heap.size
+		loop do
+			child = 2 * i + 1
+			break if child >= size
+			child += 1 if child + 1 < size && cmp.call( heap[child + 1], heap[child] ) < 0
+			break if cmp.call( last, heap[child] ) <= 0
+			heap[i] = heap[child]
+			i = child
+		end
+		heap[i] = last
+		top
+	end
+
+	def send_all( method, *args )
+		@connections.each_with_index do |conn, idx|
+			begin
+				conn.__send__( method, *args )
+				yield conn if block_given?
+			rescue Exception
+				# Don't leave the previously started queries running.
+				abort_all
+				raise
+			end
+		end
+	end
+
+	### Collect the last result of each connection.
+	def gather
+		results = Array.new( @connections.size )
+		errors = {}
+		completed = false
+
+		begin
+			event_loop do |idx, res|
+				next if errors[idx]
+				begin
+					raise res if Exception === res
+					results[idx] = res.check
+				rescue PG::Error => err
+					errors[idx] = err
+					results[idx] = nil
+				end
+			end
+			completed = true
+		ensure
+			abort_all unless completed
+		end
+
+		raise Error.new( errors.sort.to_h, results ) unless errors.empty?
+		results
+	end
+
+	### Wait for the results of all connections at once and yield each result
+	### with the index of its connection.
+	### A broken connection yields the exception instead of a result.
+	def event_loop
+		running = {}
+		@connections.each_with_index {|conn, idx| running[conn.socket_io] = [conn, idx] }
+
+		until running.empty?
+			readable, = IO.select( running.keys )
+			readable.each do |io|
+				conn, idx = running[io]
+				begin
+					conn.consume_input
+				rescue PG::Error => err
+					running.delete( io )
+					yield idx, err
+					next
+				end
+				until conn.is_busy
+					res = conn.get_result
+					unless res
+						running.delete( io )
+						break
+					end
+					yield idx, res
+				end
+			end
+		end
+	end
+
+	def abort_all
+		@connections.each do |conn|
+			next if conn.finished? || conn.transaction_status != PG::PQTRANS_ACTIVE
+			begin
+				conn.cancel
+				conn.discard_results
+			rescue PG::Error
+				# The connection is broken and has nothing to discard.
+			end
+		end
+	end
+
+end # class PG::ConnectionGroup
@@ -0,0 +1,343 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# A thread safe pool of connections to one database.
+#
+# Idle connections are kept in a Thread::Queue, so that a checkout of an idle
+# connection and the checkin don't take any further lock.
+# Only threads which have to wait for a connection, because all connections
+# are in use, synchronize on a mutex.
+#
+# New connections are set up by the block given to #new , which is the place
+# to assign type maps or to prepare statements. With <tt>warmup: true</tt> all
+# connections are established and set up in parallel before #new returns.
+#
+# A background thread checks the idle connections every +health_check_interval+
+# seconds per PG::Connection#status and PG::Connection#consume_input, which
+# detects connections closed by the server without a round trip.
+# Broken connections are reset and set up again, either by the health check or
+# when they are checked out.
+#
+# Example:
+#   pool = PG::ConnectionPool.new( {dbname: 'test'}, size: 20, warmup: true ) do |conn|
+#     conn.type_map_for_results = PG::BasicTypeMapForResults.new( conn )
+#     conn.prepare( "user", "SELECT * FROM users WHERE id = $1" )
+#   end
+#
+#   pool.with do |conn|
+#     conn.exec_prepared( "user", [42] ).to_a
+#   end
+#   pool.stats  # => {size: 20, connections: 20, idle: 20, busy: 0, waiting: 0, checkouts: 1, ...}
+class PG::ConnectionPool
+
+	# Raised by #checkout when no connection got available within +checkout_timeout+ .
+	class TimeoutError < PG::Error; end
+
+	# Raised when the pool is used after #shutdown .
+	class ShutdownError < PG::Error; end
+
+	# Maximum number of connections.
+	attr_reader :size
+	# Seconds to wait for a connection or +nil+ to wait forever.
+	attr_reader :checkout_timeout
+
+	### Create a pool of up to +size+ connections established per PG.connect( conninfo ) .
+	#
+	# +conninfo+ is a connection String or Hash as accepted by PG.connect .
+	# The optional block is called with every new or reset connection.
+	#
+	# Options:
+	# [size]  Maximum number of connections.
+	# [checkout_timeout]  Seconds to wait for a free connection in #checkout .
+	# [health_check_interval]  Seconds between checks of the idle connections.
+	#                          +nil+ disables the background check.
+	# [warmup]  Establish all connections before returning.
+	def initialize( conninfo, size: 5, checkout_timeout: 5, health_check_interval: 30, warmup: false, &setup )
+		raise ArgumentError, "size must be positive" unless size > 0
+
+		@conninfo = conninfo
+		@size = size
+		@checkout_timeout = checkout_timeout
+		@setup = setup
+
+		@idle = Thread::Queue.new
+		@mutex = Thread::Mutex.new
+		@available = Thread::ConditionVariable.new
+		@connections = 0
+		@waiting = 0
+		@shutdown = false
+		@stats = {
+			checkouts: 0, timeouts: 0, reconnects: 0,
+			wait_time: 0.0, max_wait_time: 0.0, checkout_time: 0.0, max_checkout_time: 0.0,
+		}
+
+		self.warmup if warmup
+		start_health_check( health_check_interval ) if health_check_interval
+	end
+
+	### Establish the missing connections in parallel.
+	def warmup
+		missing = @mutex.synchronize do
+			n = @size - @connections
+			@connections = @size
+			n
+		end
+
+		threads = missing.times.map do
+			Thread.new do
+				begin
+					@idle.push( new_connection )
+				rescue Exception
+					@mutex.synchronize { @connections -= 1 }
+					raise
+				end
+			end
+		end
+		threads.each( &:value )
+		nil
+	end
+
+	### Check out a connection, yield it and check it in again.
+	### Returns the result of the block.
+	def with
+		conn = checkout
+		started = now
+		begin
+			yield conn
+		ensure
+			checkin( conn, now - started )
+		end
+	end
+
+	### Take a connection out of the pool.
+	#
+	# The connection must be returned per #checkin . Prefer #with , which does it
+	# automatically.
+	#
+	# Raises a PG::ConnectionPool::TimeoutError if no connection got available within
+	# +checkout_timeout+ seconds.
+	def checkout
+		raise ShutdownError, "connection pool is shut down" if @shutdown
+
+		# Don't overtake waiting threads, to avoid their starvation.
+		conn = begin
+			@idle.pop( true ) if @waiting == 0
+		rescue ThreadError
+		end
+		verify( conn || wait_for_connection )
+	end
+
+	### Return a connection taken per #checkout to the pool.
+	#
+	# A pending query or transaction is aborted, so that the next user gets a
+	# connection in idle state.
+	def checkin( conn, duration=nil )
+		if duration
+			@mutex.synchronize do
+				@stats[:checkouts] += 1
+				@stats[:checkout_time] += duration
+				@stats[:max_checkout_time] = duration if duration > @stats[:max_checkout_time]
+			end
+		end
+
+		if @shutdown
+			conn.finish unless conn.finished?
+			@mutex.synchronize { @connections -= 1 }
+			return nil
+		end
+
+		cleanup( conn )
+		@idle.push( conn )
+		@mutex.synchronize { @available.signal } if @waiting > 0
+		nil
+	end
+
+	### Check all idle connections and reset the broken ones.
+	### This is done by the background thread periodically.
+	def health_check
+		@idle.size.times do
+			conn = begin
+				@idle.pop( true )
+			rescue ThreadError
+				break
+			end
+
+			begin
+				conn = verify( conn )
+			rescue StandardError
+				# The connection is dropped and established again on demand.
+				next
+			end
+			checkin( conn )
+		end
+		nil
+	end
+
+	### Returns a Hash with the current number of +:connections+ , +:idle+ and +:busy+
+	### connections and +:waiting+ threads, and the accumulated metrics:
+	### [checkouts]  Number of completed #with blocks.
+	### [timeouts]  Number of failed checkouts because of +checkout_timeout+ .
+	### [reconnects]  Number of connection resets.
+	### [wait_time, max_wait_time]  Total and maximum seconds threads waited for a connection.
+	### [checkout_time, max_checkout_time]  Total and maximum seconds connections were checked out.
+	def stats
+		@mutex.synchronize do
+			idle = @idle.size
+			{
+				size: @size,
+				connections: @connections,
+				idle: idle,
+				busy: @connections - idle,
+				waiting: @waiting,
+			}.merge( @stats )
+		end
+	end
+
+	### Close all idle connections and stop the health check.
+	### Connections in use are closed when they are checked in.
+	def shutdown
+		@shutdown = true
+		if @health_thread
+			@health_thread.kill
+			@health_thread.join
+		end
+		@mutex.synchronize { @available.broadcast }
+
+		until @idle.empty?
+			conn = @idle.pop( true ) rescue break
+			conn.finish unless conn.finished?
+			@mutex.synchronize { @connections -= 1 }
+		end
+		nil
+	end
+
+
+	#########
+	protected
+	#########
+
+	def now
+		Process.clock_gettime( Process::CLOCK_MONOTONIC )
+	end
+
+	def new_connection
+		conn = PG.connect( @conninfo )
+		begin
+			@setup.call( conn ) if @setup
+		rescue Exception
+			conn.finish
+			raise
+		end
+		conn
+	end
+
+	### Establish a new connection if the pool isn't full or wait for a checkin.
+	def wait_for_connection
+		started = now
+		deadline = @checkout_timeout && started + @checkout_timeout
+
+		@mutex.synchronize do
+			if @connections < @size
+				@connections += 1
+			else
+				@waiting += 1
+				begin
+					# A checkin might have happened between the first pop and here.
+					until conn = (@idle.pop( true ) rescue nil)
+						raise ShutdownError, "connection pool is shut down" if @shutdown
+						# A dropped connection or a failed connection attempt makes room for a new one.
+						if @connections < @size
+							@connections += 1
+							break
+						end
+						remaining = deadline && deadline - now
+						if remaining && remaining <= 0
+							@stats[:timeouts] += 1
+							raise TimeoutError, "no connection available within #{@checkout_timeout} seconds"
+						end
+						@available.wait( @mutex, remaining )
+					end
+				ensure
+					@waiting -= 1
+				end
+
+				waited = now - started
+				@stats[:wait_time] += waited
+				@stats[:max_wait_time] = waited if waited > @stats[:max_wait_time]
+				return conn if conn
+			end
+		end
+
+		begin
+			new_connection
+		rescue Exception
+			@mutex.synchronize do
+				@connections -= 1
+				@available.signal
+			end
+			raise
+		end
+	end
+
+	### Return +conn+ or a reset version of it, if it's broken.
+	### A connection which can't be reset is dropped from the pool and the error is raised.
+	def verify( conn )
+		return conn if healthy?( conn )
+
+		begin
+			if conn.finished?
+				conn = new_connection
+			else
+				conn.reset
+				@setup.call( conn ) if @setup
+			end
+			@mutex.synchronize { @stats[:reconnects] += 1 }
+			conn
+		rescue Exception
+			conn.finish unless conn.finished?
+			@mutex.synchronize do
+				@connections -= 1
+				@available.signal
+			end
+			raise
+		end
+	end
+
+	def healthy?( conn )
+		return false if conn.finished? || conn.status != PG::CONNECTION_OK
+		# Read pending data without blocking, to notice a connection closed by the server.
+		conn.consume_input
+		conn.status == PG::CONNECTION_OK
+	rescue PG::Error
+		false
+	end
+
+	### Abort whatever the previous user left behind on +conn+ .
+	def cleanup( conn )
+		return if conn.finished?
+		case conn.transaction_status
+		when PG::PQTRANS_ACTIVE
+			conn.cancel
+			conn.discard_results
+			conn.exec( "ROLLBACK" ) if conn.transaction_status != PG::PQTRANS_IDLE
+		when PG::PQTRANS_INTRANS, PG::PQTRANS_INERROR
+			conn.exec( "ROLLBACK" )
+		end
+	rescue PG::Error
+		# The connection is reset at the next checkout.
+	end
+
+	def start_health_check( interval )
+		@health_thread = Thread.new do
+			loop do
+				sleep interval
+				health_check
+			end
+		end
+		@health_thread.name = "pg connection pool health check" if @health_thread.respond_to?( :name= )
+	end
+
+end # class PG::ConnectionPool
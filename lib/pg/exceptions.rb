@@ -8,5 +8,20 @@ module PG
 
 	class Error < StandardError; end
 
+	# Base class of the errors raised by operations on several connections or streams
+	# at once, which collect the exceptions of all failed ones.
+	class MultiError < Error
+		# Hash of index => exception of all failed connections, streams or parts.
+		attr_reader :errors
+
+		### Build the message out of +summary+ and one line per exception, which starts
+		### with +label+ and the index.
+		def initialize( errors, summary, label )
+			@errors = errors
+			msgs = errors.map {|idx, err| "#{label} #{idx}: #{err.class}: #{err.message.chomp}" }
+			super( "#{summary}:\n" + msgs.join("\n") )
+		end
+	end
+
 end # module PG
 
@@ -0,0 +1,210 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# A client of PostgreSQL's logical replication with the built-in +pgoutput+ plugin.
+#
+# It opens a replication connection, starts streaming from a replication slot
+# and yields the decoded changes. Standby status updates are sent automatically,
+# so that the server can release the WAL which was consumed.
+#
+# The messages of the replication protocol and of +pgoutput+ are parsed in C by
+# PG::Replication.parse_copy_data and PG::Replication::PgoutputDecoder .
+# Column values are decoded per PG::TypeMap , typically a PG::BasicTypeMapForResults .
+#
+# Example:
+#   repl = PG::LogicalReplication.new( "dbname=test", slot: "cdc", publications: ["all_tables"], create_slot: true )
+#   repl.each do |change|
+#     case change[:type]
+#     when :insert then p [change[:relation][:name], change[:new]]
+#     when :update then p [change[:relation][:name], change[:old], change[:new]]
+#     when :delete then p [change[:relation][:name], change[:old]]
+#     end
+#   end
+#
+# Each change is a Hash as described in PG::Replication::PgoutputDecoder#decode plus
+# the +:lsn+ of the message.
+#
+# By default the position of each transaction is acknowledged to the server, when the
+# block returns from its Commit message. With <tt>auto_acknowledge: false</tt> the
+# application must call #acknowledge itself, for instance after the changes
+# were stored persistently.
+class PG::LogicalReplication
+
+	### Format the Integer +lsn+ in PostgreSQL's notation like <tt>"16/B374D848"</tt>.
+	def self::lsn_to_s( lsn )
+		"%X/%X" % [lsn >> 32, lsn & 0xffffffff]
+	end
+
+	### Parse an LSN in PostgreSQL's notation into an Integer.
+	def self::parse_lsn( str )
+		high, low = str.split( "/", 2 ).map {|part| Integer(part, 16) }
+		(high << 32) | low
+	end
+
+	# The replication connection.
+	attr_reader :connection
+	# The PG::Replication::PgoutputDecoder in use.
+	attr_reader :decoder
+	# The name of the replication slot.
+	attr_reader :slot
+	# The last WAL position received from the server.
+	attr_reader :received_lsn
+	# The last WAL position acknowledged to the server.
+	attr_reader :flushed_lsn
+
+	### Create a logical replication client.
+	#
+	# +conninfo+ are the connection parameters as accepted by PG.connect or
+	# a PG::Connection which was opened with <tt>replication: "database"</tt> .
+	#
+	# Options:
+	# [slot]  Name of the logical replication slot.
+	# [publications]  Array of publication names to subscribe to.
+	# [start_lsn]  WAL position to start from. Default is the confirmed position of the slot.
+	# [create_slot]  Create the slot before streaming starts.
+	# [temporary]  Create the slot as temporary slot, which is dropped at disconnect.
+	# [type_map]  PG::TypeMap to decode column values. Default is to return Strings.
+	# [messages]  Receive logical decoding messages of <tt>pg_logical_emit_message()</tt>.
+	# [status_interval]  Seconds between standby status updates.
+	# [auto_acknowledge]  Acknowledge each transaction after its Commit message was yielded.
+	def initialize( conninfo, slot:, publications:, start_lsn: 0, create_slot: false, temporary: false,
+			type_map: nil, messages: false, status_interval: 10, auto_acknowledge: true )
+		@connection = PG::Connection === conninfo ? conninfo : PG.connect( conninfo, replication: "database" )
+		@slot = slot
+		@publications = publications
+		@start_lsn = start_lsn
+		@create_slot = create_slot
+		@temporary = temporary
+		@messages = messages
+		@status_interval = status_interval
+		@auto_acknowledge = auto_acknowledge
+		@decoder = PG::Replication::PgoutputDecoder.new( type_map, @connection.internal_encoding )
+
+		@received_lsn = @flushed_lsn = start_lsn
+		@in_transaction = false
+		@streaming = false
+	end
+
+	### Start streaming from the slot. This is done by #each implicitly.
+	def start
+		conn = @connection
+		if @create_slot
+			res = conn.exec( "CREATE_REPLICATION_SLOT #{conn.quote_ident(@slot)}#{" TEMPORARY" if @temporary} LOGICAL pgoutput" )
+			@start_lsn = self.class.parse_lsn( res.getvalue(0, 1) ) if @start_lsn == 0
+			@create_slot = false
+		end
+
+		options = [
+			"proto_version '1'",
+			"publication_names #{conn.escape_literal(@publications.join(","))}",
+		]
+		options << "messages 'true'" if @messages
+		conn.exec( "START_REPLICATION SLOT #{conn.quote_ident(@slot)} LOGICAL " \
+			"#{self.class.lsn_to_s(@start_lsn)} (#{options.join(", ")})" )
+		@streaming = true
+		@next_status = now + @status_interval
+	end
+
+	### Yield each change received from the server until #stop is called or the
+	### server ends the stream.
+	def each
+		return enum_for( :each ) unless block_given?
+		start unless @streaming
+
+		while @streaming && (data = receive)
+			msg = PG::Replication.parse_copy_data( data )
+
+			if msg[:type] == :keepalive
+				@received_lsn = msg[:wal_end] if msg[:wal_end] > @received_lsn
+				# Nothing is pending outside of a transaction, so that the server position can be confirmed.
+				@flushed_lsn = @received_lsn if @auto_acknowledge && !@in_transaction
+				send_status( false ) if msg[:reply_requested]
+				next
+			end
+
+			change = @decoder.decode( msg[:data] )
+			change[:lsn] = msg[:wal_start]
+			@received_lsn = msg[:wal_start] if msg[:wal_start] > @received_lsn
+
+			case change[:type]
+			when :begin then @in_transaction = true
+			when :commit then @in_transaction = false
+			end
+
+			yield change
+
+			acknowledge( change[:end_lsn] ) if change[:type] == :commit && @auto_acknowledge
+		end
+
+		finish_stream
+	end
+
+	### Confirm that all changes up to +lsn+ are processed. The position is sent with the
+	### next standby status update and the server may then release the related WAL.
+	def acknowledge( lsn )
+		@flushed_lsn = lsn if lsn > @flushed_lsn
+	end
+
+	### Stop streaming. #each returns after the current change.
+	def stop
+		@streaming = false
+	end
+
+	### Stop streaming and close the connection.
+	def close
+		finish_stream if @streaming
+		@connection.close
+	end
+
+
+	#########
+	protected
+	#########
+
+	def now
+		Process.clock_gettime( Process::CLOCK_MONOTONIC )
+	end
+
+	### Return the next CopyData message or +nil+ if the stream was ended by the server.
+	### Standby status updates are sent when due, even while data arrives continuously.
+	def receive
+		loop do
+			timeout = @next_status - now
+			if timeout <= 0
+				send_status( false )
+				timeout = @status_interval
+			end
+
+			data = @connection.get_copy_data( true )
+			return data if data
+			return nil if data.nil?
+
+			@connection.socket_io.wait_readable( timeout )
+			@connection.consume_input
+		end
+	end
+
+	def send_status( reply_requested )
+		@connection.put_copy_data( PG::Replication.standby_status_update(@received_lsn, @flushed_lsn, @flushed_lsn, reply_requested) )
+		@connection.flush
+		@next_status = now + @status_interval
+	end
+
+	### Send the final position and end the COPY BOTH mode.
+	def finish_stream
+		@streaming = false
+		return unless @connection.transaction_status == PG::PQTRANS_ACTIVE
+
+		send_status( false )
+		@connection.put_copy_end
+		@connection.flush
+		# Discard the changes which are in flight.
+		while @connection.get_copy_data
+		end
+		@connection.get_last_result
+	end
+
+end # class PG::LogicalReplication
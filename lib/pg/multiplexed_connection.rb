@@ -0,0 +1,216 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# Share a few connections between many threads per pipeline mode.
+#
+# Each thread calling #exec_params or #exec_prepared submits its query to one of
+# the connections and waits for the result. The queries of all threads are
+# sent back to back through the libpq pipeline of the connection, each one
+# followed by a sync point, so that they don't wait for the round trip of each
+# other and a failing query doesn't affect the others.
+# A dedicated thread per connection sends the queries and routes the results
+# back to the waiting callers in the order of submission.
+#
+# Each query runs in its own implicit transaction, so that this is suitable for
+# autocommit traffic like short reads only. Transaction blocks spanning several
+# calls are not possible, since consecutive calls may run on different connections
+# and are interleaved with the queries of other threads.
+#
+# The connections are put into pipeline mode and must not be used otherwise
+# until #close is called. Results are type casted per the
+# PG::Connection#type_map_for_results of the connection.
+#
+# Example:
+#   conns = 4.times.map { PG.connect(dbname: 'test') }
+#   mconn = PG::MultiplexedConnection.new( conns )
+#   100.times.map do |i|
+#     Thread.new { mconn.exec_params( "SELECT $1::int * 2", [i] ).getvalue(0, 0) }
+#   end.map( &:value )
+#   mconn.close
+#
+# Pipeline mode requires libpq of PostgreSQL-14 or newer.
+class PG::MultiplexedConnection
+
+	# Raised when the connection of a pending query failed or was closed.
+	class ClosedError < PG::Error; end
+
+	Request = Struct.new( :method, :args, :reply, :result, :error )
+
+	### One connection in pipeline mode and the thread driving it.
+	class Channel
+		# Approximated number of submitted but not yet answered requests.
+		attr_reader :load
+
+		def initialize( conn )
+			raise NotImplementedError, "pipeline mode requires PostgreSQL-14 or newer" unless conn.respond_to?( :enter_pipeline_mode )
+
+			@conn = conn
+			@submissions = Thread::Queue.new
+			@pending = []
+			@load = 0
+			@wake_r, @wake_w = IO.pipe
+			@closed = nil
+
+			@conn.setnonblocking( true )
+			@conn.enter_pipeline_mode
+			@thread = Thread.new { run }
+			@thread.name = "pg multiplexed connection" if @thread.respond_to?( :name= )
+		end
+
+		def submit( method, args )
+			req = Request.new( method, args, Thread::Queue.new )
+			@load += 1
+			begin
+				begin
+					@submissions.push( req )
+				rescue ClosedQueueError
+					raise @closed || ClosedError.new( "multiplexed connection is closed" )
+				end
+				wakeup
+				res = req.reply.pop
+			ensure
+				# Also when the waiting thread is killed or gets Thread#raise .
+				@load -= 1
+			end
+			raise res if Exception === res
+			res
+		end
+
+		def close
+			@submissions.close
+			wakeup
+			@thread.join
+			@wake_r.close
+			@wake_w.close
+			nil
+		end
+
+		protected
+
+		def wakeup
+			@wake_w.write_nonblock( "x" )
+		rescue IO::WaitWritable, IOError
+			# A wakeup is pending already respectively the channel is closed.
+		end
+
+		def run
+			socket = @conn.socket_io
+			until @submissions.closed? && @submissions.empty? && @pending.empty?
+				send_submissions
+				writable = @conn.flush ? nil : [socket]
+				readable, = IO.select( [socket, @wake_r], writable )
+				if readable.include?( @wake_r )
+					@wake_r.read_nonblock( 4096 ) rescue IO::WaitReadable
+				end
+				if readable.include?( socket )
+					@conn.consume_input
+					receive_results
+				end
+			end
+			@conn.exit_pipeline_mode
+			@conn.setnonblocking( false )
+		rescue Exception => err
+			fail_all( err )
+		end
+
+		def send_submissions
+			while req = (@submissions.pop( true ) rescue nil)
+				@pending << req
+				begin
+					@conn.__send__( req.method, *req.args )
+				rescue StandardError => err
+					# Invalid parameters fail the request only, a broken connection all of them.
+					raise unless @conn.status == PG::CONNECTION_OK
+					@pending.pop
+					req.reply.push( err )
+					next
+				end
+				@conn.pipeline_sync
+			end
+		end
+
+		### Route the available results to the pending requests.
+		def receive_results
+			last_nil = false
+			until @conn.is_busy
+				res = @conn.get_result
+				if res.nil?
+					# One nil ends the results of a query, two mean there are no more results.
+					break if last_nil
+					last_nil = true
+					next
+				end
+				last_nil = false
+
+				req = @pending.first
+				case res.result_status
+				when PG::PGRES_PIPELINE_SYNC
+					@pending.shift
+					req.reply.push( req.error || req.result )
+				else
+					begin
+						res.check
+						req.result = res
+					rescue PG::Error => err
+						req.error ||= err
+					end
+				end
+			end
+		end
+
+		def fail_all( err )
+			@closed = ClosedError.new( "connection of the multiplexed connection failed: #{err.message}" )
+			@submissions.close
+			@pending.each {|req| req.reply.push( @closed ) }
+			@pending.clear
+			while req = (@submissions.pop( true ) rescue nil)
+				req.reply.push( @closed )
+			end
+		end
+	end
+
+	### Create a multiplexer over +connections+ , which is a PG::Connection or an Array of them.
+	def initialize( connections )
+		connections = Array( connections )
+		raise ArgumentError, "at least one connection is required" if connections.empty?
+		@channels = connections.map {|conn| Channel.new( conn ) }
+	end
+
+	### Execute +sql+ per PG::Connection#send_query_params on the least busy connection
+	### and wait for the result.
+	def exec_params( sql, params=nil, result_format=0, type_map=nil )
+		channel.submit( :send_query_params, [sql, params || [], result_format, type_map] )
+	end
+
+	### Execute the prepared statement +name+ per PG::Connection#send_query_prepared on
+	### the least busy connection and wait for the result.
+	### The statement must be prepared on all connections.
+	def exec_prepared( name, params=nil, result_format=0, type_map=nil )
+		channel.submit( :send_query_prepared, [name, params || [], result_format, type_map] )
+	end
+
+	### Returns the number of queries in flight per connection.
+	def loads
+		@channels.map( &:load )
+	end
+
+	### Finish the pending queries and take the connections out of pipeline mode.
+	### The connections are not closed.
+	def close
+		@channels.each( &:close )
+		nil
+	end
+
+
+	#########
+	protected
+	#########
+
+	def channel
+		@channels.min_by( &:load )
+	end
+
+end # class PG::MultiplexedConnection
@@ -0,0 +1,235 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# Bulk load data into one table through several COPY streams at once.
+#
+# A single COPY stream is processed by one backend process, which saturates one
+# CPU core of the server long before disks or network are the limit.
+# PG::ParallelCopy spreads the rows over several connections, so that the load
+# scales across backend cores.
+#
+# The rows are partitioned either round-robin or by a key into one buffer per
+# connection. Full buffers are sent by one thread per connection, which releases
+# the GVL while writing to the socket.
+# Each stream runs in its own transaction. The transactions are committed only
+# after the COPY of all streams succeeded. If any stream fails, the remaining
+# streams are aborted and rolled back and a PG::ParallelCopy::Error is raised,
+# which lists the failures of all streams.
+# Only the failure of a COMMIT itself, like of a deferred constraint, can leave
+# other streams committed. They are listed in PG::ParallelCopy::Error#committed .
+#
+# A stream which waits for a lock held by the uncommitted transaction of another
+# stream, like for a key which is loaded twice, can't proceed until the other stream
+# commits, which in turn waits for all streams. Therefore each stream sets a
+# +lock_timeout+ of 30 seconds by default, which fails the blocked stream and aborts
+# the load. Note that this applies to locks held by other sessions as well, which
+# would be waited for without limit per PostgreSQL's default.
+#
+# Example:
+#   conns = 4.times.map { PG.connect(dbname: 'test') }
+#   copy = PG::ParallelCopy.new( conns, "measurements", columns: %w[id value] )
+#   copy.load( 1_000_000.times.lazy.map {|i| [i, rand] } )
+#   # => {rows: 1000000, bytes: 24888890, streams: [{rows: 250140, bytes: 6225446}, ...]}
+#
+# Instead of an Enumerable of rows, a file name or an IO object can be given.
+# Its lines are then sent as they are, so they must be valid COPY data in the
+# format given by +copy_options+ with one row per line.
+class PG::ParallelCopy
+
+	# Raised by #load when at least one COPY stream failed.
+	# #errors is a Hash of stream index => exception.
+	class Error < PG::MultiError
+		# Indices of the streams which were committed before the failure.
+		attr_reader :committed
+
+		def initialize( errors, committed )
+			@committed = committed
+			super( errors, "#{errors.size} of the COPY streams failed", "stream" )
+		end
+	end
+
+	# Raised within the streams which are aborted because of the failure of another stream.
+	class Aborted < PG::Error; end
+
+	# The default size of the per connection buffers in bytes.
+	DEFAULT_BUFFER_SIZE = 256 * 1024
+
+	# The default lock timeout of the streams in seconds.
+	DEFAULT_LOCK_TIMEOUT = 30
+
+	# The connections in use.
+	attr_reader :connections
+	# The COPY command sent on each connection.
+	attr_reader :sql
+
+	### Create a loader for +table+ running one COPY stream on each of +connections+ .
+	#
+	# Options:
+	# [columns]  Array of column names to be loaded. Default is all columns of the table.
+	# [encoder]  PG::Coder to encode the rows of an Enumerable source.
+	#            Default is a PG::TextEncoder::CopyRow .
+	# [copy_options]  String with options appended to the COPY command, like <tt>"(FORMAT csv)"</tt>.
+	# [partition_by]  Proc which returns a key for each row. Rows with the same key are sent
+	#                 through the same stream. Default is to fill the buffers round-robin.
+	# [buffer_size]  Number of bytes collected per stream before they are sent.
+	# [queue_depth]  Number of full buffers which may be pending per stream.
+	# [lock_timeout]  Seconds a stream may wait for a lock. +nil+ keeps the
+	#                 +lock_timeout+ setting of the connections.
+	def initialize( connections, table, columns: nil, encoder: nil, copy_options: nil,
+			partition_by: nil, buffer_size: DEFAULT_BUFFER_SIZE, queue_depth: 4,
+			lock_timeout: DEFAULT_LOCK_TIMEOUT )
+		raise ArgumentError, "at least one connection is required" if connections.empty?
+
+		@connections = connections
+		@encoder = encoder || PG::TextEncoder::CopyRow.new
+		@partition_by = partition_by
+		@buffer_size = buffer_size
+		@queue_depth = queue_depth
+		@lock_timeout = lock_timeout
+
+		conn = connections.first
+		target = conn.quote_ident( table )
+		target += " (#{ columns.map {|c| conn.quote_ident(c) }.join(", ") })" if columns
+		@sql = "COPY #{target} FROM STDIN #{copy_options}".rstrip
+	end
+
+	### Load all rows of +source+ and return a Hash with the number of rows and bytes
+	### sent in total (+:rows+, +:bytes+) and per stream (+:streams+).
+	#
+	# +source+ can be an Enumerable of rows, which are encoded by the encoder,
+	# a file name or an IO object.
+	def load( source )
+		case source
+		when String
+			File.open( source, 'rb' ) {|fd| run( fd.each_line ) }
+		when IO
+			source.binmode
+			run( source.each_line )
+		else
+			run( source )
+		end
+	end
+
+	### Convenience method for PG::ParallelCopy.new(connections, table, **options).load(source)
+	def self::load( connections, table, source, **options )
+		return new( connections, table, **options ).load( source )
+	end
+
+
+	#########
+	protected
+	#########
+
+	def run( rows )
+		nstreams = @connections.size
+		@failed = false
+		queues = Array.new( nstreams ) { SizedQueue.new(@queue_depth) }
+		stats = Array.new( nstreams ) { {rows: 0, bytes: 0} }
+		errors = {}
+		committed = []
+		@lock = Mutex.new
+		@copied = ConditionVariable.new
+		@ncopied = 0
+
+		threads = @connections.each_with_index.map do |conn, idx|
+			Thread.new do
+				begin
+					run_stream( conn, queues[idx] )
+					@lock.synchronize { committed << idx }
+				rescue Exception => err
+					@lock.synchronize { errors[idx] = err unless Aborted === err }
+					abort_streams( queues )
+				end
+			end
+		end
+
+		begin
+			partition( rows, queues, stats )
+		rescue ClosedQueueError
+			# A stream failed and the remaining streams are aborted.
+		rescue Exception
+			abort_streams( queues )
+			threads.each( &:join )
+			raise
+		ensure
+			queues.each( &:close )
+		end
+
+		threads.each( &:join )
+		raise Error.new( errors.sort.to_h, committed.sort ) unless errors.empty?
+
+		return {
+			rows: stats.sum {|st| st[:rows] },
+			bytes: stats.sum {|st| st[:bytes] },
+			streams: stats,
+		}
+	end
+
+	### Distribute the rows to the per stream buffers and pass full buffers to the streams.
+	def partition( rows, queues, stats )
+		nstreams = queues.size
+		buffers = Array.new( nstreams ) { new_buffer }
+		current = 0
+
+		rows.each do |row|
+			idx = @partition_by ? @partition_by.call( row ).hash % nstreams : current
+			data = String === row ? row : @encoder.encode( row ).force_encoding( Encoding::BINARY )
+			buffer = buffers[idx]
+			buffer << data
+			stats[idx][:rows] += 1
+			stats[idx][:bytes] += data.bytesize
+
+			if buffer.bytesize >= @buffer_size
+				queues[idx].push( buffer )
+				buffers[idx] = new_buffer
+				current = (current + 1) % nstreams
+			end
+		end
+
+		buffers.each_with_index do |buffer, idx|
+			queues[idx].push( buffer ) unless buffer.empty?
+		end
+	end
+
+	def new_buffer
+		String.new( capacity: @buffer_size + 1024, encoding: Encoding::BINARY )
+	end
+
+	### Send the buffers of one queue in a transaction of its own.
+	def run_stream( conn, queue )
+		conn.transaction do
+			conn.exec( "SET LOCAL lock_timeout = #{(@lock_timeout * 1000).ceil}" ) if @lock_timeout
+			conn.copy_data( @sql ) do
+				while buffer = queue.pop
+					break if @failed
+					conn.put_copy_data( buffer )
+				end
+				raise Aborted, "aborted due to the failure of another stream" if @failed
+			end
+			raise Aborted, "aborted due to the failure of another stream" unless wait_for_all_streams
+		end
+	end
+
+	### Wait until the COPY of all streams is finished, so that all of them are committed
+	### or none. Returns +false+ if a stream failed.
+	def wait_for_all_streams
+		@lock.synchronize do
+			@ncopied += 1
+			@copied.broadcast
+			@copied.wait( @lock ) until @failed || @ncopied == @connections.size
+			!@failed
+		end
+	end
+
+	def abort_streams( queues )
+		@lock.synchronize do
+			@failed = true
+			@copied.broadcast
+		end
+		queues.each( &:close )
+	end
+
+end # class PG::ParallelCopy
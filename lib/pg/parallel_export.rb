@@ -0,0 +1,263 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+require 'tempfile'
+
+
+# Export one table through several COPY TO streams at once.
+#
+# A single COPY TO stream is processed by one backend process, which limits the
+# throughput of a dump of a huge table. PG::ParallelExport splits the table into
+# ranges and exports them concurrently on several connections.
+#
+# All connections share one snapshot: the first connection exports its snapshot per
+# <tt>pg_export_snapshot()</tt> and the other connections import it per
+# <tt>SET TRANSACTION SNAPSHOT</tt>, so that the parts form a consistent image of the
+# table, as if it were exported by one COPY command.
+#
+# The table is split into ranges of physical pages (+ctid+), or into ranges of an
+# integer key column, if +key+ is given. Each range is exported per
+# PG::Connection#copy_to_io , which releases the GVL during the whole transfer.
+#
+# Example:
+#   conns = 4.times.map { PG.connect(dbname: 'test') }
+#   export = PG::ParallelExport.new( conns, "measurements", copy_options: "(FORMAT csv)" )
+#
+#   # Write one file per range:
+#   export.export_to_files( "/backup/measurements.%03d.csv" )
+#   # => [{path: "/backup/measurements.000.csv", rows: 250123, bytes: 6225446}, ...]
+#
+#   # Or write all ranges in order into one stream:
+#   File.open( "/backup/measurements.csv", "wb" ) {|io| export.export( io ) }
+#   # => {rows: 1000000, bytes: 24888890, parts: 4}
+#
+# The +HEADER+ option of COPY must not be used, since it would be repeated for each range.
+class PG::ParallelExport
+
+	# Raised when the export of at least one range failed.
+	# #errors is a Hash of range index => exception.
+	class Error < PG::MultiError
+		def initialize( errors )
+			super( errors, "#{errors.size} parts of the export failed", "part" )
+		end
+	end
+
+	# Marker for ranges which were skipped because of the failure of another range.
+	class Aborted < PG::Error; end
+
+	# The connections in use.
+	attr_reader :connections
+
+	### Create an exporter for +table+ using all of +connections+ .
+	#
+	# Options:
+	# [columns]  Array of column names to be exported. Default is all columns.
+	# [key]  Name of an integer column (typically the primary key) to split the table by.
+	#        The rows of each range are ordered by this column, so that the merged stream of
+	#        #export is ordered by it, too. Default is to split by physical pages (ctid).
+	# [parts]  Number of ranges. Default is the number of connections.
+	# [copy_options]  String with options appended to the COPY command, like <tt>"(FORMAT csv)"</tt>.
+	# [tmpdir]  Directory for the temporary files of #export .
+	def initialize( connections, table, columns: nil, key: nil, parts: nil, copy_options: nil, tmpdir: nil )
+		raise ArgumentError, "at least one connection is required" if connections.empty?
+
+		@connections = connections
+		@key = key
+		@parts = parts || connections.size
+		@copy_options = copy_options
+		@tmpdir = tmpdir
+
+		conn = connections.first
+		@table = conn.quote_ident( table )
+		@select_list = columns ? columns.map {|c| conn.quote_ident(c) }.join(", ") : "*"
+	end
+
+	### Export the table into one file per range.
+	#
+	# +path_pattern+ is a format string, which gets the index of the range, like
+	# <tt>"dump.%03d.csv"</tt>.
+	# Returns an Array with a Hash of +:path+, +:rows+ and +:bytes+ per range.
+	def export_to_files( path_pattern )
+		with_snapshot do |conditions|
+			export_part = proc do |idx, conn, sql|
+				path = format( path_pattern, idx )
+				File.open( path, 'wb' ) {|fd| {path: path}.merge!( conn.copy_to_io(sql, fd) ) }
+			end
+			run_parts( conditions, export_part ) {|done| wait_for( done ) }
+		end
+	end
+
+	### Export the table into +io+ .
+	#
+	# The ranges are exported into temporary files concurrently and appended to +io+ in
+	# the order of the ranges, as soon as all preceding ranges are written.
+	# Returns a Hash with the number of +:rows+ and +:bytes+ and the number of +:parts+ .
+	def export( io )
+		with_snapshot do |conditions|
+			export_part = proc do |idx, conn, sql|
+				tmp = Tempfile.new( ["pg_export", ".#{idx}"], @tmpdir, binmode: true )
+				begin
+					stats = conn.copy_to_io( sql, tmp )
+				rescue Exception
+					tmp.close!
+					raise
+				end
+				stats.merge!( file: tmp )
+			end
+
+			total = {rows: 0, bytes: 0, parts: conditions.size}
+			errors = {}
+			done = nil
+			begin
+				run_parts( conditions, export_part ) do |queues|
+					done = queues
+					done.each_with_index do |queue, idx|
+						res = queue.pop
+						if Exception === res
+							errors[idx] = res unless Aborted === res
+						elsif res[:file]
+							begin
+								# Data after a failed part is useless, but the files must be removed anyway.
+								IO.copy_stream( res[:file].path, io ) if errors.empty?
+							ensure
+								res[:file].close!
+							end
+							total[:rows] += res[:rows]
+							total[:bytes] += res[:bytes]
+						end
+					end
+				end
+			ensure
+				# Remove the files of the parts, which weren't appended because of an exception.
+				(done || []).each do |queue|
+					until queue.empty?
+						res = queue.pop
+						res[:file].close! if Hash === res
+					end
+				end
+			end
+			raise Error, errors unless errors.empty?
+			total
+		end
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Start a transaction with a shared snapshot on all connections and yield the
+	### WHERE conditions of the ranges.
+	def with_snapshot
+		leader, *others = @connections
+		begun = []
+
+		leader.exec( "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY" )
+		begun << leader
+		snapshot = leader.exec( "SELECT pg_export_snapshot()" ).getvalue( 0, 0 )
+		others.each do |conn|
+			conn.exec( "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY" )
+			begun << conn
+			conn.exec( "SET TRANSACTION SNAPSHOT #{conn.escape_literal(snapshot)}" )
+		end
+
+		yield( @key ? key_ranges(leader) : ctid_ranges(leader) )
+	ensure
+		# A transaction in error state is rolled back by COMMIT.
+		begun.each {|conn| conn.exec( "COMMIT" ) rescue nil }
+	end
+
+	### Split the table into ranges of physical pages.
+	def ctid_ranges( conn )
+		pages = conn.exec_params( "SELECT pg_relation_size($1::regclass) / current_setting('block_size')::int", [@table] ).getvalue( 0, 0 ).to_i
+		split_range( "ctid", 0, pages ) {|page| "'(#{page},0)'::tid" }
+	end
+
+	### Split the table into ranges of the key column.
+	def key_ranges( conn )
+		key = conn.quote_ident( @key )
+		min, max = conn.exec( "SELECT min(#{key})::bigint, max(#{key})::bigint FROM #{@table}" ).values.first
+		return [nil] unless min
+		split_range( key, min.to_i, max.to_i + 1 ) {|val| val.to_s }
+	end
+
+	### Return WHERE conditions which split +from+ ... +to+ into equal parts.
+	### The first and last ranges are open-ended, so that all rows are covered.
+	def split_range( column, from, to )
+		nparts = [[@parts, to - from].min, 1].max
+		bounds = (1...nparts).map {|i| yield( from + (to - from) * i / nparts ) }
+
+		return [nil] if bounds.empty?
+		[ "#{column} < #{bounds.first}" ] +
+			bounds.each_cons(2).map {|lower, upper| "#{column} >= #{lower} AND #{column} < #{upper}" } +
+			[ "#{column} >= #{bounds.last}" ]
+	end
+
+	def part_sql( condition )
+		sql = +"SELECT #{@select_list} FROM #{@table}"
+		sql << " WHERE #{condition}" if condition
+		sql << " ORDER BY #{@connections.first.quote_ident(@key)}" if @key
+		"COPY (#{sql}) TO STDOUT #{@copy_options}".rstrip
+	end
+
+	### Export all ranges per +export_part+ with one thread per connection.
+	###
+	### Yields one Queue per range, which receives the return value of +export_part+ ,
+	### or the exception raised while exporting the range.
+	### The threads are finished when this method returns, so that the connections can be
+	### used again. If the block raises an exception, the remaining ranges are skipped and
+	### the running ones are cancelled.
+	def run_parts( conditions, export_part )
+		todo = Queue.new
+		conditions.each_index {|idx| todo << idx }
+		todo.close
+		done = Array.new( conditions.size ) { Queue.new }
+		failed = false
+		completed = false
+
+		threads = @connections.map do |conn|
+			Thread.new do
+				while idx = todo.pop
+					if failed
+						done[idx] << Aborted.new( "aborted due to the failure of another part" )
+						next
+					end
+					begin
+						done[idx] << export_part.call( idx, conn, part_sql(conditions[idx]) )
+					rescue Exception => err
+						# The transaction of this connection is unusable from now on.
+						failed = true
+						done[idx] << err
+					end
+				end
+			end
+		end
+
+		begin
+			res = yield( done )
+			completed = true
+			res
+		ensure
+			unless completed
+				failed = true
+				threads.each_with_index do |thread, i|
+					@connections[i].cancel if thread.alive?
+				end
+			end
+			threads.each( &:join )
+		end
+	end
+
+	def wait_for( done )
+		errors = {}
+		results = done.each_with_index.map do |queue, idx|
+			res = queue.pop
+			errors[idx] = res if Exception === res && !(Aborted === res)
+			res
+		end
+		raise Error, errors unless errors.empty?
+		return results
+	end
+
+end # class PG::ParallelExport
@@ -0,0 +1,272 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# A client side cache of query results.
+#
+# PG::QueryCache executes queries per PG::Connection#exec_params or
+# PG::Connection#exec_prepared and keeps the results in memory, keyed by the SQL
+# string, respectively the statement name, and the query parameters.
+# Subsequent executions of the same query with the same parameters return the
+# cached PG::Result without a round trip to the server.
+#
+# Cached results are shared between all callers, so that they are frozen and
+# can't be cleared or get another type map.
+#
+# Entries are removed when:
+# * they are older than +ttl+ seconds,
+# * the memory of all results exceeds +max_bytes+ (least recently used first),
+# * one of their tags is invalidated per #invalidate , or
+# * one of their tags is received as payload of a notification on +channel+ .
+#
+# Tags are arbitrary Strings given to #exec_params and #exec_prepared , typically
+# the names of the tables read by the query.
+# The notifications are received by a dedicated +listen_connection+ , which is
+# polled without blocking before each lookup. A notification with an empty payload
+# invalidates all entries. If the listen connection fails, the cache is emptied and
+# bypassed until the connection is reestablished.
+#
+# Example:
+#   conn.exec <<-SQL
+#     CREATE FUNCTION notify_query_cache() RETURNS trigger LANGUAGE plpgsql AS $$
+#       BEGIN PERFORM pg_notify('pg_query_cache', TG_TABLE_NAME); RETURN NULL; END $$;
+#     CREATE TRIGGER users_query_cache AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON users
+#       FOR EACH STATEMENT EXECUTE FUNCTION notify_query_cache();
+#   SQL
+#
+#   cache = PG::QueryCache.new( conn, listen_connection: PG.connect(dbname: 'test'), ttl: 300 )
+#   res = cache.exec_params( "SELECT * FROM users WHERE id = $1", [42], tags: ["users"] )
+class PG::QueryCache
+	include PG::QueryKey
+
+	# Default name of the notification channel
+	DEFAULT_CHANNEL = "pg_query_cache"
+
+	# Approximated memory of an entry in addition to the result
+	ENTRY_OVERHEAD = 200
+
+	Entry = Struct.new( :result, :tags, :bytes, :expires_at )
+
+	# The connection used for queries.
+	attr_reader :connection
+	# The connection receiving the invalidation notifications or +nil+ .
+	attr_reader :listen_connection
+	# Memory budget of all cached results in bytes.
+	attr_reader :max_bytes
+	# Seconds an entry stays valid or +nil+ for no expiry.
+	attr_reader :ttl
+	# Memory of all cached results in bytes.
+	attr_reader :bytes
+
+	### Create a cache for queries on +connection+ .
+	#
+	# Options:
+	# [max_bytes]  Memory budget of the cached results as reported by PG::Result#memsize .
+	# [ttl]  Seconds an entry stays valid. +nil+ disables the expiry.
+	# [listen_connection]  A separate PG::Connection which listens to +channel+ .
+	#                      It must not be used for anything else.
+	# [channel]  Name of the notification channel.
+	# [type_map]  PG::TypeMap assigned to each result before it's cached.
+	# [reconnect_interval]  Seconds between attempts to reestablish a failed +listen_connection+ .
+	def initialize( connection, max_bytes: 64 * 1024 * 1024, ttl: 60, listen_connection: nil,
+			channel: DEFAULT_CHANNEL, type_map: nil, reconnect_interval: 5 )
+		@connection = connection
+		@max_bytes = max_bytes
+		@ttl = ttl
+		@listen_connection = listen_connection
+		@channel = channel
+		@type_map = type_map
+		@reconnect_interval = reconnect_interval
+
+		@entries = {}
+		@tags = Hash.new {|h, tag| h[tag] = {} }
+		@bytes = 0
+		@stats = { hits: 0, misses: 0, evictions: 0, invalidations: 0 }
+		# Number of invalidations per tag and of #clear calls, to detect invalidations
+		# while a query is running.
+		@generations = Hash.new( 0 )
+		@clears = 0
+		@mutex = Thread::Mutex.new
+		# Serializes the use of the listen connection.
+		@listen_mutex = Thread::Mutex.new
+		@listening = false
+		@next_reconnect = nil
+
+		listen if @listen_connection
+	end
+
+	### Execute +sql+ per PG::Connection#exec_params or return the cached result.
+	###
+	### +tags+ is an Array of Strings, which invalidate the cached result.
+	def exec_params( sql, params=[], result_format=0, tags: [] )
+		fetch( [:sql, sql, params, result_format], tags ) do
+			@connection.exec_params( sql, params, result_format )
+		end
+	end
+
+	### Execute the prepared statement +name+ per PG::Connection#exec_prepared
+	### or return the cached result.
+	###
+	### +tags+ is an Array of Strings, which invalidate the cached result.
+	def exec_prepared( name, params=[], result_format=0, tags: [] )
+		fetch( [:prepared, name, params, result_format], tags ) do
+			@connection.exec_prepared( name, params, result_format )
+		end
+	end
+
+	### Remove all entries which are tagged with one of +tags+ .
+	def invalidate( *tags )
+		@mutex.synchronize do
+			tags.flatten.each do |tag|
+				@generations[tag.to_s] += 1
+				keys = @tags.delete( tag.to_s ) or next
+				keys.each_key do |key|
+					@stats[:invalidations] += 1 if remove_entry( key )
+				end
+			end
+		end
+		nil
+	end
+
+	### Remove all entries.
+	def clear
+		@mutex.synchronize do
+			@entries.clear
+			@tags.clear
+			@bytes = 0
+			@clears += 1
+		end
+		nil
+	end
+
+	### Number of cached results.
+	def size
+		@entries.size
+	end
+
+	### Returns a Hash with the numbers of cache +:hits+ , +:misses+ , +:evictions+ and
+	### +:invalidations+ and the current +:entries+ and +:bytes+ .
+	def stats
+		@mutex.synchronize do
+			@stats.merge( entries: @entries.size, bytes: @bytes )
+		end
+	end
+
+	### Process the pending notifications of the listen connection without blocking.
+	### This is done before each lookup implicitly.
+	def process_notifications
+		return unless @listen_connection
+
+		@listen_mutex.synchronize do
+			return unless @listening || reconnect
+
+			begin
+				@listen_connection.consume_input
+				while notify = @listen_connection.notifies
+					next unless notify[:relname] == @channel
+					if notify[:extra].empty?
+						clear
+					else
+						invalidate( notify[:extra] )
+					end
+				end
+			rescue PG::Error
+				# Changes might be missed from now on.
+				@listening = false
+				@next_reconnect = now + @reconnect_interval
+				clear
+			end
+		end
+		nil
+	end
+
+
+	#########
+	protected
+	#########
+
+	def now
+		Process.clock_gettime( Process::CLOCK_MONOTONIC )
+	end
+
+	def listen
+		@listen_connection.exec( "LISTEN #{@listen_connection.quote_ident(@channel)}" )
+		@listening = true
+	end
+
+	### Try to reestablish the listen connection. Returns +true+ on success.
+	def reconnect
+		return false if @next_reconnect && now < @next_reconnect
+		@listen_connection.reset
+		listen
+		true
+	rescue PG::Error
+		@next_reconnect = now + @reconnect_interval
+		false
+	end
+
+	def fetch( key, tags )
+		process_notifications
+		# Without notifications the cache can't be kept coherent.
+		return yield if @listen_connection && !@listening
+
+		key = freeze_key( key )
+		tags = tags.map {|tag| tag.to_s.freeze }
+		generations = nil
+		clears = nil
+		@mutex.synchronize do
+			if entry = @entries[key]
+				if entry.expires_at.nil? || now < entry.expires_at
+					# Move the entry to the end of the LRU order.
+					@entries.delete( key )
+					@entries[key] = entry
+					@stats[:hits] += 1
+					return entry.result
+				end
+				remove_entry( key )
+			end
+			@stats[:misses] += 1
+			generations = tags.map {|tag| @generations[tag] }
+			clears = @clears
+		end
+
+		res = yield
+		return res unless res.result_status == PG::PGRES_TUPLES_OK
+
+		res.type_map = @type_map if @type_map
+		res.freeze
+		bytes = res.memsize + ENTRY_OVERHEAD
+		return res if bytes > @max_bytes
+
+		@mutex.synchronize do
+			# The result might be stale, if one of its tags was invalidated meanwhile.
+			return res if @clears != clears || tags.map {|tag| @generations[tag] } != generations
+
+			remove_entry( key )
+			@entries[key] = Entry.new( res, tags, bytes, @ttl && now + @ttl )
+			tags.each {|tag| @tags[tag][key] = true }
+			@bytes += bytes
+
+			while @bytes > @max_bytes
+				remove_entry( @entries.first[0] )
+				@stats[:evictions] += 1
+			end
+		end
+		res
+	end
+
+	### Remove an entry. Must be called with @mutex held.
+	def remove_entry( key )
+		entry = @entries.delete( key ) or return nil
+		@bytes -= entry.bytes
+		entry.tags.each do |tag|
+			keys = @tags[tag]
+			keys.delete( key )
+			@tags.delete( tag ) if keys.empty?
+		end
+		entry
+	end
+
+end # class PG::QueryCache
@@ -0,0 +1,31 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# Keys identifying a query with its parameters, as used by PG::Singleflight and
+# PG::QueryCache to find identical queries.
+module PG::QueryKey
+
+	#########
+	protected
+	#########
+
+	### Return a frozen copy of +key+ , an Array of the query type, the SQL string or
+	### statement name, the parameters and further parts, which are kept as they are.
+	### Mutable parameters are copied, so that later changes of them by the caller
+	### don't change the key.
+	def freeze_key( key )
+		type, name, params, *rest = key
+		params = params.map do |param|
+			if Hash === param
+				param.transform_values {|v| v.frozen? ? v : v.dup.freeze }.freeze
+			else
+				param.frozen? ? param : param.dup.freeze
+			end
+		end
+		[type, name.frozen? ? name : name.dup.freeze, params.freeze, *rest].freeze
+	end
+
+end # module PG::QueryKey
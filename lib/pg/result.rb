@@ -39,5 +39,55 @@ class PG::Result
 		return str
 	end
 
+	# Prefix of data compressed by #dump_binary
+	COMPRESSED_DUMP_MAGIC = "PGZ\x01".b
+
+	# call-seq:
+	#    res.dump_binary( compress: false ) -> String
+	#
+	# Serialize the result into a compact binary String, which can be stored in a
+	# cache and restored per PG::Result.load_binary .
+	#
+	# The field descriptions, the command status and the values in the wire format are
+	# stored, but no decoded Ruby objects. This makes the data smaller and faster to load
+	# than a Marshal dump of the decoded values.
+	# With <tt>compress: true</tt> the data is additionally compressed by Zlib.
+	#
+	# Only results of successful commands can be dumped.
+	#
+	# Example:
+	#   res = conn.exec( "SELECT * FROM countries" )
+	#   cache.set( "countries", res.dump_binary( compress: true ) )
+	#   ...
+	#   res = PG::Result.load_binary( cache.get("countries"), conn )
+	def dump_binary( compress: false )
+		data = dump_binary_raw
+		return data unless compress
+
+		require 'zlib'
+		COMPRESSED_DUMP_MAGIC + Zlib::Deflate.deflate( data )
+	end
+
+	# call-seq:
+	#    PG::Result.load_binary( data, connection=nil, type_map: nil ) -> PG::Result
+	#
+	# Restore a result serialized by #dump_binary .
+	#
+	# If a _connection_ is given, the result gets its PG::Connection#type_map_for_results
+	# and PG::Connection#field_name_type like a result of a query, otherwise it returns
+	# Strings. A _type_map_ given explicitly is assigned per #type_map= .
+	# The values keep the encoding of the dumped result in any case.
+	def self.load_binary( data, connection=nil, type_map: nil )
+		if data.start_with?( COMPRESSED_DUMP_MAGIC )
+			require 'zlib'
+			data = Zlib::Inflate.inflate( data.byteslice(COMPRESSED_DUMP_MAGIC.bytesize..-1) )
+		end
+		res = load_binary_raw( data, connection )
+		res.type_map = type_map if type_map
+		res
+	end
+
+	private_class_method :load_binary_raw
+
 end # class PG::Result
 
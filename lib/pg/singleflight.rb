@@ -0,0 +1,135 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# Coalesce identical queries, which are in flight at the same time.
+#
+# PG::Singleflight wraps a PG::ConnectionPool , a PG::MultiplexedConnection
+# or any other thread safe object responding to +exec_params+ and +exec_prepared+ .
+# A PG::ConnectionPool is used per PG::ConnectionPool#with .
+# When several threads run the same query with the same parameters, result
+# format and type map at the same time, only the first one (the leader) sends
+# it to the server. The others (the followers) wait for the leader and get
+# a copy of its result per PG::Result#dup , so that each caller can clear its
+# result independently. If the query fails, all of them get the error.
+#
+# Queries are not coalesced once the result is received, so that this isn't a
+# cache: each query observes data at least as fresh as the time it was issued.
+# It's therefore meant for read only queries, which are issued by many threads at
+# once, for instance after the expiry of an application level cache.
+#
+# Example:
+#   pool = PG::ConnectionPool.new( {dbname: 'test'}, size: 10 )
+#   db = PG::Singleflight.new( pool )
+#   20.times.map do
+#     Thread.new { db.exec_params( "SELECT * FROM settings WHERE name = $1", ["theme"] ).to_a }
+#   end.each( &:join )
+#   db.stats  # => {leaders: 1, followers: 19}
+class PG::Singleflight
+	include PG::QueryKey
+
+	# Raised in the followers if the leader was terminated without a result or error,
+	# like per Thread#kill .
+	class Aborted < PG::Error; end
+
+	Call = Struct.new( :cond, :followers, :copies, :error, :done )
+
+	# The wrapped connection or pool.
+	attr_reader :target
+
+	### Create a coalescing layer around +target+ .
+	def initialize( target )
+		@target = target
+		@mutex = Thread::Mutex.new
+		@calls = {}
+		@stats = { leaders: 0, followers: 0 }
+	end
+
+	### Run PG::Connection#exec_params on the target or wait for the identical query in flight.
+	def exec_params( sql, params=nil, result_format=0, type_map=nil )
+		params ||= []
+		coalesce( [:sql, sql, params, result_format, type_map], :exec_params, sql, params, result_format, type_map )
+	end
+
+	### Run PG::Connection#exec_prepared on the target or wait for the identical query in flight.
+	def exec_prepared( name, params=nil, result_format=0, type_map=nil )
+		params ||= []
+		coalesce( [:prepared, name, params, result_format, type_map], :exec_prepared, name, params, result_format, type_map )
+	end
+
+	### Returns a Hash with the number of queries sent to the server (+:leaders+) and
+	### the number of queries which waited for them (+:followers+).
+	def stats
+		@mutex.synchronize { @stats.dup }
+	end
+
+
+	#########
+	protected
+	#########
+
+	def coalesce( key, method, *args )
+		key = freeze_key( key )
+		call = nil
+		leader = @mutex.synchronize do
+			if call = @calls[key]
+				call.followers += 1
+				@stats[:followers] += 1
+				false
+			else
+				call = @calls[key] = Call.new( Thread::ConditionVariable.new, 0, [] )
+				@stats[:leaders] += 1
+				true
+			end
+		end
+
+		leader ? lead( key, call, method, args ) : follow( call )
+	end
+
+	def lead( key, call, method, args )
+		completed = false
+		begin
+			res = execute( method, args )
+			completed = true
+		rescue Exception => err
+			call.error = err
+			raise
+		ensure
+			call.error ||= Aborted.new( "the leading query was aborted" ) unless completed
+			# No further followers can join from now on.
+			followers = @mutex.synchronize { @calls.delete( key ); call.followers }
+			begin
+				copies = call.error ? [] : Array.new( followers ) { res.dup }
+			rescue Exception => err
+				call.error = err
+				copies = []
+			end
+			@mutex.synchronize do
+				call.copies = copies
+				call.done = true
+				call.cond.broadcast
+			end
+		end
+		res
+	end
+
+	def follow( call )
+		res = @mutex.synchronize do
+			call.cond.wait( @mutex ) until call.done
+			call.copies.pop
+		end
+		raise call.error.dup if call.error
+		res
+	end
+
+	def execute( method, args )
+		if @target.respond_to?( method )
+			@target.__send__( method, *args )
+		else
+			@target.with {|conn| conn.__send__( method, *args ) }
+		end
+	end
+
+end # class PG::Singleflight
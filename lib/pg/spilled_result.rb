@@ -0,0 +1,77 @@
+# -*- ruby -*-
+# frozen_string_literal: true
+
+require 'pg' unless defined?( PG )
+
+
+# PG::SpilledResult is defined in C, if the platform supports memory mapped files.
+if defined?( PG::SpilledResult )
+	class PG::SpilledResult
+
+		### Returns an Array of the field names.
+		def fields
+			description.fields
+		end
+
+		### Returns the name of the field at index +index+ .
+		def fname( index )
+			description.fname( index )
+		end
+
+		### Returns the index of the field named +name+ or -1 .
+		def fnumber( name )
+			description.fnumber( name )
+		end
+
+		### Returns the type OID of the field at index +index+ .
+		def ftype( index )
+			description.ftype( index )
+		end
+
+		### Returns the type modifier of the field at index +index+ .
+		def fmod( index )
+			description.fmod( index )
+		end
+
+		### Returns the format (0 for text, 1 for binary) of the field at index +index+ .
+		def fformat( index )
+			description.fformat( index )
+		end
+
+		### Returns the status string of the command, like <tt>"SELECT 100"</tt> .
+		def cmd_status
+			description.cmd_status
+		end
+
+		### Returns the number of tuples affected by the command.
+		def cmd_tuples
+			description.cmd_tuples
+		end
+		alias cmdtuples cmd_tuples
+
+		### Returns an Array of the values of the field +name+ of each tuple.
+		def field_values( name )
+			index = fnumber( name.to_s )
+			raise IndexError, "no such field '#{name}' in result" if index < 0
+			column_values( index )
+		end
+
+		### Apply a type map for all value retrieving methods and return self.
+		def map_types!( type_map )
+			self.type_map = type_map
+			return self
+		end
+
+		### Return a String representation of the object suitable for debugging.
+		def inspect
+			str = self.to_s
+			str[-1,0] = if cleared?
+				" cleared"
+			else
+				" ntuples=#{ntuples} nfields=#{nfields} bytesize=#{bytesize}"
+			end
+			return str
+		end
+
+	end # class PG::SpilledResult
+end
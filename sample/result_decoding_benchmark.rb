@@ -0,0 +1,66 @@
+# -*- ruby -*-
+
+require 'pg'
+require 'benchmark'
+
+# Record the raw values of a query result to a file and replay it later,
+# to benchmark or profile type casts of PG::Result without a PostgreSQL server.
+#
+# Record a result set:
+#   ruby result_decoding_benchmark.rb record "dbname=test" "SELECT * FROM logs" logs.dump
+#
+# Replay it (repeatedly, for instance under perf or a ruby profiler):
+#   ruby result_decoding_benchmark.rb replay logs.dump [iterations]
+#
+# The recording contains the column names, types and formats, the raw values
+# in PostgreSQL's wire format and the decoders of PG::BasicTypeMapForResults
+# for each column, so that replaying needs no database connection at all.
+
+def record( conninfo, sql, filename )
+	conn = PG.connect( conninfo )
+	res = conn.exec( sql )
+	decoders = PG::BasicTypeMapForResults.new( conn ).build_column_map( res ).coders
+
+	recording = {
+		fields: res.fields,
+		types: res.nfields.times.map {|i| res.ftype(i) },
+		formats: res.nfields.times.map {|i| res.fformat(i) },
+		# PG::TypeMapAllStrings delivers the raw values of text and binary columns
+		rows: res.values,
+		decoders: decoders,
+	}
+	File.binwrite( filename, Marshal.dump(recording) )
+	$stderr.puts "Recorded #{res.ntuples} rows with #{res.nfields} columns to #{filename}"
+ensure
+	conn&.finish
+end
+
+def replay( filename, iterations )
+	recording = Marshal.load( File.binread(filename) )
+	res = PG::Result.build( *recording.values_at(:fields, :types, :rows, :formats) )
+	type_map = PG::TypeMapByColumn.new( recording[:decoders] )
+	$stderr.puts "Replaying #{res.ntuples} rows with #{res.nfields} columns #{iterations} times"
+
+	Benchmark.bmbm do |x|
+		x.report( "values (strings)" ) { iterations.times { res.map_types!(PG::TypeMapAllStrings.new).values } }
+		x.report( "values (decoded)" ) { iterations.times { res.map_types!(type_map).values } }
+		x.report( "each (hash)" ) { iterations.times { res.map_types!(type_map).each {} } }
+		x.report( "tuple (lazy)" ) do
+			iterations.times { res.map_types!(type_map).ntuples.times {|i| res.tuple(i).values } }
+		end
+		x.report( "column_values" ) do
+			iterations.times { res.map_types!(type_map).nfields.times {|i| res.column_values(i) } }
+		end
+	end
+end
+
+case ARGV.shift
+when 'record'
+	abort "Usage: #$0 record <conninfo> <sql> <file>" unless ARGV.length == 3
+	record( *ARGV )
+when 'replay'
+	abort "Usage: #$0 replay <file> [iterations]" unless (1..2).include?( ARGV.length )
+	replay( ARGV[0], Integer(ARGV[1] || 10) )
+else
+	abort "Usage: #$0 record|replay ..."
+end
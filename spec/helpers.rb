@@ -3,6 +3,7 @@
 require 'pathname'
 require 'rspec'
 require 'shellwords'
+require 'socket'
 require 'pg'
 
 DEFAULT_TEST_DIR_STR = File.join(Dir.pwd, "tmp_test_specs")
@@ -214,7 +215,7 @@ module PG::TestingHelpers
 			end
 
 			trace "Starting postgres"
-			log_and_run @logfile, 'pg_ctl', '-w', '-o', "-k #{TEST_DIRECTORY.to_s.dump}",
+			log_and_run @logfile, 'pg_ctl', '-w', '-o', "-k #{TEST_DIRECTORY.to_s.dump} -c wal_level=logical",
 				'-D', @test_pgdata.to_s, 'start'
 			sleep 2
 
@@ -352,6 +353,126 @@ module PG::TestingHelpers
 		result
 	end
 
+
+	### Run the block and fail if it allocates more than +max_objects+ Ruby objects.
+	### Returns the number of allocated objects.
+	def expect_allocation_budget( max_objects )
+		before = GC.stat( :total_allocated_objects )
+		yield
+		allocated = GC.stat( :total_allocated_objects ) - before
+		expect( allocated ).to be <= max_objects,
+			"expected at most #{max_objects} allocated objects, but got #{allocated}"
+		allocated
+	end
+
+
+	# A TCP proxy to be placed between a PG::Connection and the test server.
+	#
+	# It forwards the PostgreSQL wire protocol unchanged, but delays each
+	# transfer by +latency+ seconds per direction (so a round trip costs
+	# 2 * +latency+), limits the throughput to +bandwidth+ bytes per second
+	# and splits the data stream into TCP writes of at most +chunk_size+ bytes.
+	# This makes the effects of round trips visible on a local server.
+	class LatencyProxy
+
+		attr_reader :port
+		attr_accessor :latency, :bandwidth, :chunk_size
+
+		def initialize( target_port, target_host: 'localhost', latency: 0.0, bandwidth: nil, chunk_size: nil )
+			@target_host = target_host
+			@target_port = target_port
+			@latency = latency
+			@bandwidth = bandwidth
+			@chunk_size = chunk_size
+			@server = TCPServer.new( 'localhost', 0 )
+			@port = @server.addr[1]
+			@threads = []
+			@sockets = []
+			@mutex = Mutex.new
+			@accept_thread = Thread.new { accept_loop }
+		end
+
+		### The connection string to connect through this proxy.
+		def conninfo( dbname: 'test' )
+			"host=localhost port=#{@port} dbname=#{dbname}"
+		end
+
+		### Stop accepting connections and close all proxied connections.
+		def stop
+			@server.close rescue nil
+			@accept_thread.kill.join
+			@mutex.synchronize do
+				@sockets.each {|s| s.close rescue nil }
+				@threads.each(&:kill).each(&:join)
+			end
+		end
+
+		private
+
+		def accept_loop
+			loop do
+				client = @server.accept
+				upstream = TCPSocket.new( @target_host, @target_port )
+				[client, upstream].each {|s| s.setsockopt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY, 1) }
+				@mutex.synchronize do
+					@sockets.push( client, upstream )
+					@threads.concat( pump(client, upstream) )
+					@threads.concat( pump(upstream, client) )
+				end
+			end
+		rescue IOError, SystemCallError
+			# server socket closed
+		end
+
+		### Forward all data read from +from+ to +to+ with the configured delays.
+		### Reading and writing run in separate threads, so that a delayed
+		### chunk doesn't hold back the reception of the following data.
+		def pump( from, to )
+			queue = Queue.new
+			reader = Thread.new do
+				begin
+					loop do
+						data = from.readpartial( 65536 )
+						queue << [ Process.clock_gettime(Process::CLOCK_MONOTONIC) + @latency, data ]
+					end
+				rescue IOError, SystemCallError
+					queue << nil
+				end
+			end
+
+			writer = Thread.new do
+				begin
+					while (item = queue.pop)
+						due, data = item
+						delay = due - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+						sleep delay if delay > 0
+						step = @chunk_size || data.bytesize
+						0.step( data.bytesize - 1, step ) do |offset|
+							chunk = data.byteslice( offset, step )
+							to.write( chunk )
+							sleep( chunk.bytesize.to_f / @bandwidth ) if @bandwidth
+						end
+					end
+				rescue IOError, SystemCallError
+				ensure
+					to.close_write rescue nil
+				end
+			end
+
+			[reader, writer]
+		end
+	end
+
+
+	### Run the block with a LatencyProxy in front of the test server and
+	### stop the proxy afterwards. The proxy is yielded to the block.
+	def with_latency_proxy( **options )
+		proxy = LatencyProxy.new( @port, **options )
+		yield proxy
+	ensure
+		proxy&.stop
+	end
+
 end
 
 
@@ -377,4 +498,5 @@ RSpec.configure do |config|
 	config.filter_run_excluding( :postgresql_96 ) if PG.library_version <  90600
 	config.filter_run_excluding( :postgresql_10 ) if PG.library_version < 100000
 	config.filter_run_excluding( :postgresql_12 ) if PG.library_version < 120000
+	config.filter_run_excluding( :postgresql_14 ) if PG.library_version < 140000
 end
@@ -0,0 +1,104 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+
+describe PG::ConnectionGroup, :without_transaction do
+	let!(:conns) { 4.times.map { PG.connect(@conninfo) } }
+	let(:group) { PG::ConnectionGroup.new( conns ) }
+
+	before :each do
+		# Give each connection its index, so that queries can depend on it.
+		conns.each_with_index {|conn, idx| conn.exec( "SET pg_test.conn_index = #{idx}" ) }
+	end
+
+	after :each do
+		conns.each( &:finish )
+	end
+
+	it "runs a query on all connections at once" do
+		start = Time.now
+		results = group.exec_params_all( "SELECT $1::int, pg_backend_pid(), pg_sleep(0.5)", [7] )
+
+		expect( Time.now - start ).to be < 1.5
+		expect( results.map {|r| r.getvalue(0, 0) } ).to eq( ["7"] * 4 )
+		expect( results.map {|r| r.getvalue(0, 1).to_i } ).to eq( conns.map(&:backend_pid) )
+	end
+
+	it "runs a prepared statement on all connections" do
+		conns.each {|conn| conn.prepare( "double", "SELECT $1::int * 2" ) }
+		expect( group.exec_prepared_all( "double", [21] ).map {|r| r.getvalue(0, 0) } ).to eq( ["42"] * 4 )
+	end
+
+	it "raises the errors of all failed connections" do
+		expect {
+			group.exec_params_all( "SELECT 1 / (current_setting('pg_test.conn_index')::int % 2 + $1::int)", [-1] )
+		}.to raise_error( PG::ConnectionGroup::Error ) {|err|
+			failed = [1, 3]
+			expect( err.errors.keys ).to eq( failed )
+			expect( err.errors.values ).to all( be_kind_of(PG::DivisionByZero) )
+			expect( err.results.each_index.reject {|i| err.results[i] } ).to eq( failed )
+		}
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+	end
+
+	it "streams the rows of all connections" do
+		rows = []
+		n = group.stream_each_all( "SELECT generate_series(1, $1::int)", [100] ) do |row, idx|
+			rows << [row.first.to_i, idx]
+		end
+
+		expect( n ).to eq( 400 )
+		4.times do |idx|
+			expect( rows.select {|_, i| i == idx }.map(&:first) ).to eq( (1..100).to_a )
+		end
+	end
+
+	it "merges sorted rows of all connections" do
+		rows = group.merge_each( "SELECT (g * 4 + current_setting('pg_test.conn_index')::int) AS k, g FROM generate_series(0, 99) g ORDER BY 1", [],
+				key: "k", key_decoders: [PG::TextDecoder::Integer.new] ).map {|row, _| row.first }
+
+		expect( rows.size ).to eq( 400 )
+		expect( rows ).to eq( rows.sort )
+		expect( rows.first ).to be_kind_of( Integer )
+	end
+
+	it "merges rows in descending order up to a limit" do
+		rows = []
+		n = group.merge_each( "SELECT g, pg_backend_pid() FROM generate_series(1000000, 1, -1) g", [],
+				key: 0, key_decoders: [PG::TextDecoder::Integer.new], descending: true, limit: 10 ) do |row, idx|
+			rows << [row.first, idx]
+		end
+
+		expect( n ).to eq( 10 )
+		expect( rows.map(&:first) ).to eq( [1000000, 1000000, 1000000, 1000000, 999999, 999999, 999999, 999999, 999998, 999998] )
+		expect( rows.first(4).map(&:last) ).to eq( [0, 1, 2, 3] )
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+	end
+
+	it "sorts NULL keys like PostgreSQL" do
+		rows = group.merge_each( "SELECT * FROM (VALUES ('a'), (NULL)) v(k) ORDER BY k", [], key: 0 ).map {|row, _| row.first }
+		expect( rows ).to eq( ["a"] * 4 + [nil] * 4 )
+
+		rows = group.merge_each( "SELECT * FROM (VALUES ('a'), (NULL)) v(k) ORDER BY k DESC", [], key: 0, descending: true ).map {|row, _| row.first }
+		expect( rows ).to eq( [nil] * 4 + ["a"] * 4 )
+
+		rows = group.merge_each( "SELECT * FROM (VALUES ('a'), (NULL)) v(k) ORDER BY k NULLS FIRST", [], key: 0, nulls_first: true ).map {|row, _| row.first }
+		expect( rows ).to eq( [nil] * 4 + ["a"] * 4 )
+	end
+
+	it "refuses to merge keys decoded to Strings of non-text columns" do
+		expect {
+			group.merge_each( "SELECT g FROM generate_series(1, 10) g", [], key: 0 ).to_a
+		}.to raise_error( ArgumentError, /decoded to a String/ )
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+	end
+
+	it "cancels the queries when the stream is left early" do
+		rows = group.stream_each_all( "SELECT generate_series(1, 10000000)", [] ).first( 3 )
+		expect( rows.size ).to eq( 3 )
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+		expect( group.exec_params_all( "SELECT 1", [] ).size ).to eq( 4 )
+	end
+end
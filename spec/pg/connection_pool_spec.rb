@@ -0,0 +1,100 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+
+describe PG::ConnectionPool, :without_transaction do
+	let(:pool) { PG::ConnectionPool.new( @conninfo, size: 3, checkout_timeout: 0.2, health_check_interval: nil ) }
+
+	after :each do
+		pool.shutdown
+	end
+
+	it "hands out connections on demand" do
+		expect( pool.stats ).to include( connections: 0, idle: 0 )
+		expect( pool.with {|conn| conn.exec( "SELECT 1" ).getvalue(0, 0) } ).to eq( "1" )
+		expect( pool.stats ).to include( connections: 1, idle: 1, busy: 0, checkouts: 1 )
+	end
+
+	it "establishes and sets up all connections per warmup" do
+		pids = Queue.new
+		pool = PG::ConnectionPool.new( @conninfo, size: 3, warmup: true, health_check_interval: nil ) do |conn|
+			pids << conn.backend_pid
+			conn.prepare( "one", "SELECT 1" )
+		end
+		expect( pids.size ).to eq( 3 )
+		expect( pool.stats ).to include( connections: 3, idle: 3 )
+		expect( pool.with {|conn| conn.exec_prepared( "one" ).getvalue(0, 0) } ).to eq( "1" )
+		pool.shutdown
+	end
+
+	it "shares the connections between many threads" do
+		pids = Queue.new
+		threads = 20.times.map do
+			Thread.new do
+				5.times { pool.with {|conn| pids << conn.exec( "SELECT pg_backend_pid()" ).getvalue(0, 0) } }
+			end
+		end
+		threads.each( &:join )
+
+		expect( pids.size ).to eq( 100 )
+		expect( pids.size.times.map { pids.pop }.uniq.size ).to be <= 3
+		expect( pool.stats ).to include( connections: 3, waiting: 0, checkouts: 100, timeouts: 0 )
+	end
+
+	it "raises a timeout error if all connections are in use" do
+		conns = 3.times.map { pool.checkout }
+		expect{ pool.checkout }.to raise_error( PG::ConnectionPool::TimeoutError )
+		expect( pool.stats ).to include( busy: 3, timeouts: 1 )
+		conns.each {|conn| pool.checkin( conn ) }
+	end
+
+	it "connects a waiting thread when the connection attempt of another thread failed" do
+		attempts = 0
+		pool = PG::ConnectionPool.new( @conninfo, size: 1, checkout_timeout: 2, health_check_interval: nil ) do |conn|
+			attempts += 1
+			if attempts == 1
+				# Let the second thread wait for the connection.
+				sleep 0.3
+				raise "setup failed"
+			end
+		end
+		failing = Thread.new { pool.with {} rescue $! }
+		sleep 0.01 until pool.stats[:connections] == 1
+		waiting = Thread.new { pool.with {|conn| conn.exec( "SELECT 1" ).getvalue(0, 0) } }
+
+		expect( waiting.value ).to eq( "1" )
+		expect( failing.value.message ).to eq( "setup failed" )
+		expect( pool.stats ).to include( connections: 1, timeouts: 0 )
+		pool.shutdown
+	end
+
+	it "rolls back a transaction left open" do
+		pool = PG::ConnectionPool.new( @conninfo, size: 1, health_check_interval: nil )
+		pool.with {|conn| conn.exec( "BEGIN" ) }
+		pool.with {|conn| expect( conn.transaction_status ).to eq( PG::PQTRANS_IDLE ) }
+		pool.shutdown
+	end
+
+	it "replaces broken connections" do
+		pool.with {|conn| conn.finish }
+		expect( pool.with {|conn| conn.exec( "SELECT 1" ).getvalue(0, 0) } ).to eq( "1" )
+		expect( pool.stats ).to include( connections: 1, reconnects: 1 )
+	end
+
+	it "resets connections terminated by the server per health check" do
+		pid = pool.with( &:backend_pid )
+		@conn.exec( "SELECT pg_terminate_backend(#{pid})" )
+		sleep 0.1
+		pool.health_check
+
+		expect( pool.stats ).to include( connections: 1, reconnects: 1 )
+		expect( pool.with( &:backend_pid ) ).not_to eq( pid )
+	end
+
+	it "refuses checkouts after shutdown" do
+		pool.shutdown
+		expect{ pool.checkout }.to raise_error( PG::ConnectionPool::ShutdownError )
+	end
+end
@@ -5,6 +5,7 @@ require_relative '../helpers'
 
 require 'timeout'
 require 'socket'
+require 'stringio'
 require 'pg'
 
 describe PG::Connection do
@@ -440,6 +441,92 @@ describe PG::Connection do
 		end
 	end
 
+	it "reads a large object into a given buffer" do
+		@conn.transaction do
+			oid = @conn.lo_create( 0 )
+			fd = @conn.lo_open( oid, PG::INV_READ|PG::INV_WRITE )
+			@conn.lo_write( fd, "foobar" )
+			@conn.lo_lseek( fd, 0, PG::SEEK_SET )
+			buffer = "previous content".encode("utf-8")
+			expect( @conn.lo_read_into( fd, 4, buffer ) ).to equal( buffer )
+			expect( buffer ).to eq( "foob" )
+			expect( buffer.encoding ).to eq( Encoding::BINARY )
+			expect( @conn.lo_read_into( fd, 10, buffer ) ).to eq( "ar" )
+			expect( @conn.lo_read_into( fd, 10, buffer ) ).to be_nil
+			expect( buffer ).to eq( "" )
+		end
+	end
+
+	it "streams a large object from and to an IO" do
+		data = Random.new(5).bytes( 200_000 )
+		@conn.transaction do
+			oid = @conn.lo_create( 0 )
+			fd = @conn.lo_open( oid, PG::INV_READ|PG::INV_WRITE )
+			expect( @conn.lo_copy_from( StringIO.new(data), fd, chunk: 30000 ) ).to eq( data.bytesize )
+
+			@conn.lo_lseek( fd, 0, PG::SEEK_SET )
+			out = StringIO.new( String.new )
+			expect( @conn.lo_copy_to( out, fd, chunk: 30000 ) ).to eq( data.bytesize )
+			expect( out.string ).to eq( data )
+		end
+	end
+
+	it "streams a large object with several chunks per round trip" do
+		data = Random.new(6).bytes( 100_000 )
+		@conn.transaction do
+			oid = @conn.lo_create( 0 )
+			fd = @conn.lo_open( oid, PG::INV_READ|PG::INV_WRITE )
+			expect( @conn.lo_copy_from( StringIO.new(data), fd, chunk: 7000, window: 4 ) ).to eq( data.bytesize )
+
+			@conn.lo_lseek( fd, 0, PG::SEEK_SET )
+			out = StringIO.new( String.new )
+			expect( @conn.lo_copy_to( out, fd, chunk: 7000, window: 4 ) ).to eq( data.bytesize )
+			expect( out.string ).to eq( data )
+			expect( @conn ).to still_be_usable
+		end
+	end
+
+	it "needs less round trips for large objects with a window", :without_transaction do
+		data = Random.new(7).bytes( 40_000 )
+		oid = @conn.transaction do
+			oid = @conn.lo_create( 0 )
+			fd = @conn.lo_open( oid, PG::INV_WRITE )
+			@conn.lo_write( fd, data )
+			oid
+		end
+
+		with_latency_proxy( latency: 0.02 ) do |proxy|
+			conn = PG.connect( proxy.conninfo )
+			durations = [nil, 20].map do |window|
+				conn.transaction do
+					fd = conn.lo_open( oid, PG::INV_READ )
+					start_time = Time.now
+					out = StringIO.new( String.new )
+					conn.lo_copy_to( out, fd, chunk: 1000, window: window )
+					expect( out.string ).to eq( data )
+					Time.now - start_time
+				end
+			end
+			expect( durations[1] ).to be < durations[0] / 4
+			conn.finish
+		end
+		@conn.lo_unlink( oid )
+	end
+
+	it "streams a large object to a file descriptor" do
+		@conn.transaction do
+			oid = @conn.lo_create( 0 )
+			fd = @conn.lo_open( oid, PG::INV_READ|PG::INV_WRITE )
+			@conn.lo_write( fd, "foobar" )
+			@conn.lo_lseek( fd, 0, PG::SEEK_SET )
+			rd, wr = IO.pipe
+			expect( @conn.lo_copy_to( wr.fileno, fd ) ).to eq( 6 )
+			wr.close
+			expect( rd.read ).to eq( "foobar" )
+			rd.close
+		end
+	end
+
 	it "supports explicitly calling #exec_params" do
 		@conn.exec( "CREATE TABLE students ( name TEXT, age INTEGER )" )
 		@conn.exec_params( "INSERT INTO students VALUES( $1, $2 )", ['Wally', 8] )
@@ -684,6 +771,83 @@ describe PG::Connection do
 		expect( @conn ).to still_be_usable
 	end
 
+	it "can load a file per #copy_from_file" do
+		path = TEST_DIRECTORY + "copy_from_file.txt"
+		path.write( (1..10000).map{|i| "#{i}\tabc#{i}\n" }.join )
+		@conn.exec( "CREATE TEMP TABLE copytable (col1 INT, col2 TEXT)" )
+		res = @conn.copy_from_file( "COPY copytable FROM STDIN", path.to_s )
+		expect( res ).to eq( bytes: path.size, rows: 10000 )
+		expect( @conn.exec( "SELECT count(*), max(col2) FROM copytable" ).values ).to eq( [["10000", "abc9999"]] )
+		expect( @conn ).to still_be_usable
+	end
+
+	it "can handle errors in #copy_from_file" do
+		path = TEST_DIRECTORY + "copy_from_file.txt"
+		path.write( "1\nxyz\n" )
+		@conn.exec "ROLLBACK"
+		@conn.transaction do
+			@conn.exec( "CREATE TEMP TABLE copytable (col1 INT)" )
+			expect {
+				@conn.copy_from_file( "COPY copytable FROM STDIN", path.to_s )
+			}.to raise_error(PG::Error, /invalid input syntax for .*integer/)
+		end
+		expect {
+			@conn.copy_from_file( "COPY copytable FROM STDIN", (TEST_DIRECTORY + "not_existing").to_s )
+		}.to raise_error(Errno::ENOENT)
+		expect {
+			@conn.copy_from_file( "SELECT 1", path.to_s )
+		}.to raise_error(ArgumentError, /no COPY FROM/)
+		expect( @conn ).to still_be_usable
+		expect {
+			@conn.copy_from_file( "COPY (SELECT 1) TO STDOUT", path.to_s )
+		}.to raise_error(ArgumentError, /no COPY FROM/)
+		expect( @conn ).to still_be_usable
+	end
+
+	it "can write COPY data to an IO per #copy_to_io" do
+		rd, wr = IO.pipe
+		reader = Thread.new { rd.read }
+		res = @conn.copy_to_io( "COPY (SELECT generate_series(1,10000)) TO STDOUT", wr )
+		wr.close
+		expected = (1..10000).map{|i| "#{i}\n" }.join
+		expect( reader.value ).to eq( expected )
+		expect( res ).to eq( bytes: expected.bytesize, rows: 10000 )
+		rd.close
+		expect( @conn ).to still_be_usable
+	end
+
+	it "can interrupt #copy_to_io while the IO isn't read" do
+		@conn.exec "ROLLBACK"
+		rd, wr = IO.pipe
+		require 'io/nonblock'
+		wr.nonblock = false
+		th = Thread.new do
+			@conn.copy_to_io( "COPY (SELECT generate_series(1,1000000)) TO STDOUT", wr )
+		end
+		sleep 0.5
+		th.raise( Interrupt )
+		expect { th.join( 5 ) }.to raise_error( Interrupt )
+		expect( wr ).not_to be_nonblock
+		wr.close
+		rd.close
+		expect( @conn ).to still_be_usable
+	end
+
+	it "can handle errors in #copy_to_io" do
+		@conn.exec "ROLLBACK"
+		@conn.exec( "CREATE FUNCTION errfunc() RETURNS int AS $$ BEGIN RAISE 'test-error'; END; $$ LANGUAGE plpgsql;" )
+		File.open( File::NULL, "w" ) do |null|
+			expect {
+				@conn.copy_to_io( "COPY (SELECT errfunc()) TO STDOUT", null )
+			}.to raise_error(PG::Error, /test-error/)
+			expect {
+				@conn.copy_to_io( "SELECT 1", null.fileno )
+			}.to raise_error(ArgumentError, /no COPY TO/)
+		end
+		expect( @conn ).to still_be_usable
+		@conn.exec( "DROP FUNCTION errfunc()" )
+	end
+
 	it "gracefully handle SQL statements while in #copy_data for input" do
 		@conn.exec "ROLLBACK"
 		@conn.transaction do
@@ -1174,6 +1338,46 @@ describe PG::Connection do
 
 	end
 
+	describe "pipeline mode", :postgresql_14, :without_transaction do
+
+		it "enters and exits pipeline mode" do
+			expect( @conn.pipeline_status ).to eq( PG::PQ_PIPELINE_OFF )
+			@conn.enter_pipeline_mode
+			expect( @conn.pipeline_status ).to eq( PG::PQ_PIPELINE_ON )
+			@conn.exit_pipeline_mode
+			expect( @conn.pipeline_status ).to eq( PG::PQ_PIPELINE_OFF )
+		end
+
+		it "receives the results of pipelined queries" do
+			@conn.enter_pipeline_mode
+			@conn.send_query_params( "SELECT $1::int", [1] )
+			@conn.send_query_params( "SELECT 1 / $1::int", [0] )
+			@conn.pipeline_sync
+			@conn.send_query_params( "SELECT $1::int", [3] )
+			@conn.pipeline_sync
+
+			expect( @conn.get_result.values ).to eq( [["1"]] )
+			expect( @conn.get_result ).to be_nil
+			expect{ @conn.get_result.check }.to raise_error( PG::DivisionByZero )
+			expect( @conn.get_result ).to be_nil
+			expect( @conn.get_result.result_status ).to eq( PG::PGRES_PIPELINE_SYNC )
+			expect( @conn.get_result.values ).to eq( [["3"]] )
+			expect( @conn.get_result ).to be_nil
+			expect( @conn.get_result.check.result_status ).to eq( PG::PGRES_PIPELINE_SYNC )
+			@conn.exit_pipeline_mode
+		end
+
+		it "raises an error when exiting with pending results" do
+			@conn.enter_pipeline_mode
+			@conn.send_query_params( "SELECT 1", [] )
+			expect{ @conn.exit_pipeline_mode }.to raise_error( PG::Error )
+			@conn.pipeline_sync
+			2.times { @conn.get_result }
+			@conn.get_result
+			@conn.exit_pipeline_mode
+		end
+	end
+
 	describe "set_single_row_mode" do
 
 		it "raises an error when called at the wrong time" do
@@ -1235,6 +1439,241 @@ describe PG::Connection do
 			expect( first_result.result_status ).to eq( PG::PGRES_SINGLE_TUPLE )
 		end
 
+		context "with read-ahead" do
+			before :each do
+				@conn.read_ahead = 64 * 1024
+			end
+
+			after :each do
+				@conn.read_ahead = 0
+			end
+
+			it "streams all rows of each query" do
+				@conn.send_query( "SELECT generate_series(1,20000), repeat('x', 100); SELECT 'second'" )
+				@conn.set_single_row_mode
+				rows = []
+				@conn.get_result.stream_each_row {|row| rows << row[0].to_i }
+				expect( rows ).to eq( (1..20000).to_a )
+				expect( @conn.get_result.stream_each_row.to_a ).to eq( [["second"]] )
+				expect( @conn.get_result ).to be_nil
+			end
+
+			it "raises errors of the server" do
+				@conn.exec( "CREATE FUNCTION errfunc() RETURNS int AS $$ BEGIN RAISE 'test-error'; END; $$ LANGUAGE plpgsql;" )
+				@conn.send_query( "SELECT generate_series(0,999), NULL UNION ALL SELECT 1000, errfunc();" )
+				@conn.set_single_row_mode
+				rows = 0
+				expect {
+					@conn.get_result.stream_each {|row| rows += 1 }
+				}.to raise_error( PG::Error, /test-error/ )
+				expect( rows ).to eq( 1000 )
+			end
+
+			it "can be left in the middle of the stream" do
+				@conn.send_query( "SELECT generate_series(1,20000)" )
+				@conn.set_single_row_mode
+				@conn.get_result.stream_each.with_index {|_, i| break if i == 10 }
+				@conn.discard_results
+				expect( @conn.exec("SELECT 1").values ).to eq( [["1"]] )
+			end
+
+			it "refuses other uses of the connection while streaming" do
+				@conn.send_query( "SELECT generate_series(1,1000)" )
+				@conn.set_single_row_mode
+				@conn.get_result.stream_each do
+					expect { @conn.exec("SELECT 1") }.to raise_error( PG::Error, /read-ahead/ )
+					break
+				end
+				@conn.discard_results
+				expect( @conn.exec("SELECT 1").values ).to eq( [["1"]] )
+			end
+		end
+	end
+
+	describe "cursor_each" do
+		it "yields all rows in batches of a cursor" do
+			rows = []
+			count = @conn.cursor_each( "SELECT generate_series(1,$1::int) AS n", [2500], fetch_rows: 1000 ) do |row|
+				rows << row["n"].to_i
+			end
+			expect( count ).to eq( 2500 )
+			expect( rows ).to eq( (1..2500).to_a )
+			expect( @conn.exec("SELECT count(*) FROM pg_cursors").getvalue(0, 0) ).to eq( "0" )
+		end
+
+		it "allows queries within the block" do
+			sums = @conn.cursor_each( "SELECT generate_series(1,5) AS n", fetch_rows: 2 ).map do |row|
+				@conn.exec_params( "SELECT $1::int * 2", [row["n"]] ).getvalue( 0, 0 ).to_i
+			end
+			expect( sums ).to eq( [2, 4, 6, 8, 10] )
+		end
+
+		it "adapts the batch size to fetch_bytes" do
+			sizes = []
+			@conn.cursor_each( "SELECT repeat('x', 1000) FROM generate_series(1,5000)", fetch_rows: 10,
+					fetch_bytes: 100_000, batches: true ) do |res|
+				sizes << res.ntuples
+			end
+			expect( sizes.sum ).to eq( 5000 )
+			expect( sizes.first ).to eq( 10 )
+			expect( sizes[3] ).to be_between( 50, 200 )
+		end
+
+		it "prefetches the next batch" do
+			rows = @conn.cursor_each( "SELECT generate_series(1,1000) AS n", fetch_rows: 100, prefetch: true ).to_a
+			expect( rows.map {|row| row["n"].to_i } ).to eq( (1..1000).to_a )
+		end
+
+		it "closes the cursor when the block breaks", :without_transaction do
+			@conn.cursor_each( "SELECT generate_series(1,1000)", fetch_rows: 10, prefetch: true ) do |row|
+				break
+			end
+			expect( @conn.transaction_status ).to eq( PG::PQTRANS_IDLE )
+			expect( @conn.exec("SELECT count(*) FROM pg_cursors").getvalue(0, 0) ).to eq( "0" )
+		end
+	end
+
+	describe "max_result_bytes" do
+		after :each do
+			@conn.max_result_bytes = 0
+			@conn.chunked_results = false
+		end
+
+		it "returns results within the limit unchanged" do
+			@conn.max_result_bytes = 1024 * 1024
+			res = @conn.exec( "SELECT generate_series(1,1000) AS n, NULL::text AS t" )
+			expect( res.result_status ).to eq( PG::PGRES_TUPLES_OK )
+			expect( res.cmd_tuples ).to eq( 1000 )
+			expect( res.cmd_status ).to eq( "SELECT 1000" )
+			expect( res.fields ).to eq( %w[n t] )
+			expect( res.ftype(0) ).to eq( 23 )
+			expect( res.column_values(0) ).to eq( (1..1000).map(&:to_s) )
+			expect( res.getisnull(0, 1) ).to be true
+		end
+
+		it "raises an error when the limit is exceeded" do
+			@conn.max_result_bytes = 100_000
+			expect {
+				@conn.exec_params( "SELECT repeat('x', 1000) FROM generate_series(1,$1::int)", [1000] )
+			}.to raise_error( PG::ResultTooLarge, /100000 bytes/ )
+			expect( @conn.get_result ).to be_nil
+		end
+
+		it "raises an error with a block unless chunked results are enabled", :without_transaction do
+			@conn.max_result_bytes = 100_000
+			expect {
+				@conn.exec( "SELECT repeat('x', 1000) FROM generate_series(1,1000)" ) {|res| res.ntuples }
+			}.to raise_error( PG::ResultTooLarge )
+			expect( @conn.exec("SELECT 1").values ).to eq( [["1"]] )
+		end
+
+		it "yields large results in chunks", :without_transaction do
+			@conn.max_result_bytes = 100_000
+			@conn.chunked_results = true
+			sizes = []
+			@conn.exec( "SELECT repeat('x', 1000) FROM generate_series(1,1000)" ) do |res|
+				sizes << res.ntuples
+			end
+			expect( sizes.sum ).to eq( 1000 )
+			expect( sizes.size ).to be_between( 10, 12 )
+			expect( @conn.exec("SELECT 1").values ).to eq( [["1"]] )
+		end
+	end
+
+	describe "exec_spilled", if: defined?(PG::SpilledResult) do
+		it "stores the result in a spill file" do
+			res = @conn.exec_spilled( "SELECT n, CASE WHEN n % 3 = 0 THEN NULL ELSE repeat('x', n % 100) END AS t " \
+					"FROM generate_series(1,$1::int) AS n", [10_000] )
+			expect( res.ntuples ).to eq( 10_000 )
+			expect( res.fields ).to eq( %w[n t] )
+			expect( res.cmd_tuples ).to eq( 10_000 )
+			expect( res.bytesize ).to be > 10_000
+			expect( res.column_values(0) ).to eq( (1..10_000).map(&:to_s) )
+			expect( res.getvalue(4999, 1) ).to eq( "x" * (5000 % 100) )
+			expect( res.getisnull(2, 1) ).to be true
+			expect( res.getvalue(0, 1) ).to eq( "x" )
+			expect( res[9999] ).to eq( "n" => "10000", "t" => "x" )
+			expect( res.each_row.count ).to eq( 10_000 )
+			res.clear
+			expect( res ).to be_cleared
+		end
+
+		it "type casts per type map" do
+			res = @conn.exec_spilled( "SELECT 1::int AS i, true AS b" )
+			res.type_map = PG::BasicTypeMapForResults.new( @conn )
+			expect( res.values ).to eq( [[1, true]] )
+		end
+
+		it "refuses to go on, when a type map cleared the result" do
+			res = @conn.exec_spilled( "SELECT n, n FROM generate_series(1,1000) AS n" )
+			tm = Class.new( PG::TypeMapInRuby ) do
+				define_method( :typecast_copy_get ) {|*| res.clear; 1 }
+			end
+			res.type_map = tm.new
+			expect { res.values }.to raise_error( PG::Error, /cleared/ )
+			expect( res ).to be_cleared
+		end
+
+		it "raises server errors and keeps the connection usable", :without_transaction do
+			expect {
+				@conn.exec_spilled( "SELECT 1/(n-5) FROM generate_series(1,10) AS n" )
+			}.to raise_error( PG::DivisionByZero )
+			expect( @conn.exec("SELECT 1").values ).to eq( [["1"]] )
+		end
+	end
+
+	describe "alloc_stats" do
+		it "counts query params and results" do
+			@conn.reset_alloc_stats
+			@conn.exec_params( "SELECT $1::int, $2::text", [1, "x" * 5000] )
+			stats = @conn.alloc_stats
+			expect( stats ).to include( queries: 1, params: 2, results: 1 )
+			expect( stats[:result_bytes] ).to be > 5000
+		end
+
+		it "counts heap allocations of type casted params" do
+			@conn.reset_alloc_stats
+			tm = PG::TypeMapByColumn.new [PG::TextEncoder::Integer.new] * 1000
+			@conn.exec_params( "SELECT " + (1..1000).map{|i| "$#{i}::int8" }.join(","), (1..1000).map{|i| i * 1000000 }, 0, tm )
+			stats = @conn.alloc_stats
+			expect( stats[:param_bytes] ).to be > 7000
+			expect( stats[:xmalloc_bytes] ).to be > 0
+			expect( stats[:typecast_heap_chunks] ).to be > 0
+			@conn.reset_alloc_stats
+			expect( @conn.alloc_stats.values.sum ).to eq( 0 )
+		end
+
+		it "runs queries within an allocation budget" do
+			@conn.exec_params( "SELECT $1::int", [1] )
+			expect_allocation_budget( 20 ) { @conn.exec_params( "SELECT $1::int", [1] ) }
+		end
+	end
+
+	context "through a latency injecting proxy" do
+
+		it "needs one round trip per synchronous query" do
+			with_latency_proxy( latency: 0.05 ) do |proxy|
+				conn = PG.connect( proxy.conninfo )
+				start_time = Time.now
+				3.times { conn.exec( "SELECT 1" ) }
+				expect( Time.now - start_time ).to be >= 3 * 2 * 0.05
+				conn.finish
+			end
+		end
+
+		it "delivers chunked and throttled data unchanged" do
+			with_latency_proxy( latency: 0.01, chunk_size: 7, bandwidth: 10_000_000 ) do |proxy|
+				conn = PG.connect( proxy.conninfo )
+				conn.send_query( "SELECT generate_series(1,1000)" )
+				conn.set_single_row_mode
+				values = []
+				conn.get_result.stream_each_row {|row| values << row.first.to_i }
+				expect( values ).to eq( (1..1000).to_a )
+				expect( conn ).to still_be_usable
+				conn.finish
+			end
+		end
+
 	end
 
 	context "multinationalization support" do
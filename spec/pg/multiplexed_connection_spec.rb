@@ -0,0 +1,69 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+
+describe PG::MultiplexedConnection, :postgresql_14, :without_transaction do
+	let!(:conns) { 2.times.map { PG.connect(@conninfo) } }
+	let(:mconn) { PG::MultiplexedConnection.new( conns ) }
+
+	after :each do
+		conns.each( &:finish )
+	end
+
+	it "enters and exits pipeline mode" do
+		mconn
+		expect( conns.map(&:pipeline_status) ).to eq( [PG::PQ_PIPELINE_ON] * 2 )
+		mconn.close
+		expect( conns.map(&:pipeline_status) ).to eq( [PG::PQ_PIPELINE_OFF] * 2 )
+		expect( conns.first.exec( "SELECT 1" ).values ).to eq( [["1"]] )
+	end
+
+	it "routes the results of many threads to their callers" do
+		threads = 50.times.map do |i|
+			Thread.new { mconn.exec_params( "SELECT $1::int * 2, pg_backend_pid()", [i] ).values.first }
+		end
+		rows = threads.map( &:value )
+		mconn.close
+
+		expect( rows.map(&:first) ).to eq( 50.times.map {|i| (i * 2).to_s } )
+		expect( rows.map(&:last).uniq.size ).to be <= 2
+	end
+
+	it "raises errors to the failing caller only" do
+		threads = 10.times.map do |i|
+			Thread.new do
+				begin
+					mconn.exec_params( "SELECT 1 / $1::int", [i % 2] ).getvalue(0, 0)
+				rescue PG::DivisionByZero => err
+					err
+				end
+			end
+		end
+		res = threads.map( &:value )
+		mconn.close
+
+		expect( res.values_at(0, 2, 4, 6, 8) ).to all( be_kind_of(PG::DivisionByZero) )
+		expect( res.values_at(1, 3, 5, 7, 9) ).to eq( ["1"] * 5 )
+	end
+
+	it "executes prepared statements" do
+		conns.each {|conn| conn.prepare( "double", "SELECT $1::int * 2" ) }
+		expect( mconn.exec_prepared( "double", [21] ).getvalue(0, 0) ).to eq( "42" )
+		mconn.close
+	end
+
+	it "casts the results per type_map_for_results" do
+		conns.each {|conn| conn.type_map_for_results = PG::BasicTypeMapForResults.new( conn ) }
+		expect( mconn.exec_params( "SELECT 42" ).getvalue(0, 0) ).to eq( 42 )
+		mconn.close
+	end
+
+	it "fails pending and further queries when the connection breaks" do
+		mconn = PG::MultiplexedConnection.new( conns.first )
+		@conn.exec( "SELECT pg_terminate_backend(#{conns.first.backend_pid})" )
+		expect{ mconn.exec_params( "SELECT 1" ) }.to raise_error( PG::Error )
+		expect{ mconn.exec_params( "SELECT 1" ) }.to raise_error( PG::MultiplexedConnection::ClosedError )
+	end
+end
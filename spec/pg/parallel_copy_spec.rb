@@ -0,0 +1,73 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+
+describe PG::ParallelCopy, :without_transaction do
+	let!(:conns) { 3.times.map { PG.connect(@conninfo) } }
+
+	before :each do
+		@conn.exec( "DROP TABLE IF EXISTS parallel_copy_test" )
+		@conn.exec( "CREATE TABLE parallel_copy_test (id INT PRIMARY KEY, val TEXT)" )
+	end
+
+	after :each do
+		conns.each( &:finish )
+		@conn.exec( "DROP TABLE IF EXISTS parallel_copy_test" )
+	end
+
+	it "loads an Enumerable of rows through several streams" do
+		rows = 10_000.times.map {|i| [i, "val #{i}"] }
+		res = PG::ParallelCopy.load( conns, "parallel_copy_test", rows, columns: %w[id val], buffer_size: 4096 )
+
+		expect( res[:rows] ).to eq( 10_000 )
+		expect( res[:streams].size ).to eq( 3 )
+		expect( res[:streams].map {|st| st[:rows] } ).to all( be > 0 )
+		expect( @conn.exec("SELECT count(*), sum(id) FROM parallel_copy_test").values ).to eq( [["10000", "49995000"]] )
+	end
+
+	it "sends rows with the same key through the same stream" do
+		rows = 100.times.map {|i| [i, (i % 2).to_s] }
+		res = PG::ParallelCopy.new( conns, "parallel_copy_test", partition_by: ->(row){ row[1] } ).load( rows )
+
+		expect( res[:streams].map {|st| st[:rows] }.sort ).to eq( [0, 50, 50] )
+	end
+
+	it "loads lines of a file as they are" do
+		rows = 200.times.map {|i| "#{i},\"a,#{i}\"\n" }.join
+		file = TEST_DIRECTORY + "parallel_copy.csv"
+		File.write( file, rows )
+
+		res = PG::ParallelCopy.load( conns, "parallel_copy_test", file.to_s, copy_options: "(FORMAT csv)" )
+		expect( res[:rows] ).to eq( 200 )
+		expect( @conn.exec("SELECT val FROM parallel_copy_test WHERE id=7").getvalue(0, 0) ).to eq( "a,7" )
+	end
+
+	it "rolls back all streams and reports the failed ones" do
+		rows = 1000.times.map {|i| [i % 999, "x"] }
+
+		expect {
+			# Rows with the same key are sent through the same stream, which fails at once.
+			PG::ParallelCopy.load( conns, "parallel_copy_test", rows, buffer_size: 100, partition_by: ->(row){ row[0] } )
+		}.to raise_error( PG::ParallelCopy::Error ) {|err|
+			expect( err.errors.values ).to all( be_kind_of(PG::UniqueViolation) )
+			expect( err.committed ).to be_empty
+		}
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+		expect( @conn.exec("SELECT count(*) FROM parallel_copy_test").getvalue(0, 0) ).to eq( "0" )
+	end
+
+	it "aborts a stream waiting for the transaction of another stream" do
+		# The second row waits for the first one, while more rows than fit into the queues follow.
+		rows = [[0, "x"]] + 1000.times.map {|i| [i, "x"] }
+
+		expect {
+			PG::ParallelCopy.load( conns, "parallel_copy_test", rows, buffer_size: 1, queue_depth: 1, lock_timeout: 0.5 )
+		}.to raise_error( PG::ParallelCopy::Error ) {|err|
+			expect( err.errors.values ).to include( be_kind_of(PG::LockNotAvailable) )
+		}
+		expect( conns.map(&:transaction_status) ).to all( eq(PG::PQTRANS_IDLE) )
+		expect( @conn.exec("SELECT count(*) FROM parallel_copy_test").getvalue(0, 0) ).to eq( "0" )
+	end
+end
@@ -0,0 +1,71 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+require 'tmpdir'
+
+describe PG::ParallelExport, :without_transaction do
+	let!(:conns) { 3.times.map { PG.connect(@conninfo) } }
+
+	before :each do
+		@conn.exec( "DROP TABLE IF EXISTS parallel_export_test" )
+		@conn.exec( "CREATE TABLE parallel_export_test AS SELECT i AS id, 'val ' || i AS val FROM generate_series(1, 10000) i" )
+	end
+
+	after :each do
+		conns.each( &:finish )
+		@conn.exec( "DROP TABLE IF EXISTS parallel_export_test" )
+	end
+
+	it "exports ctid ranges into separate files" do
+		pattern = (TEST_DIRECTORY + "parallel_export.%d.txt").to_s
+		res = PG::ParallelExport.new( conns, "parallel_export_test", parts: 5 ).export_to_files( pattern )
+
+		expect( res.size ).to eq( 5 )
+		expect( res.sum {|part| part[:rows] } ).to eq( 10_000 )
+		lines = res.flat_map {|part| File.readlines(part[:path]) }
+		expect( lines.map(&:to_i).sort ).to eq( (1..10_000).to_a )
+	end
+
+	it "exports key ranges into one ordered stream" do
+		r, w = IO.pipe
+		reader = Thread.new { r.read }
+		res = PG::ParallelExport.new( conns, "parallel_export_test", key: "id", columns: %w[id] ).export( w )
+		w.close
+
+		expect( res ).to eq( rows: 10_000, bytes: reader.value.bytesize, parts: 3 )
+		expect( reader.value.lines.map(&:to_i) ).to eq( (1..10_000).to_a )
+	end
+
+	it "exports a consistent snapshot" do
+		export = PG::ParallelExport.new( conns, "parallel_export_test", key: "id" )
+		export.define_singleton_method( :key_ranges ) do |conn|
+			@conn_for_spec.exec( "DELETE FROM parallel_export_test" )
+			super( conn )
+		end
+		export.instance_variable_set( :@conn_for_spec, @conn )
+
+		r, w = IO.pipe
+		reader = Thread.new { r.read }
+		export.export( w )
+		w.close
+		expect( reader.value.lines.size ).to eq( 10_000 )
+	end
+
+	it "finishes all parts and removes the temporary files, when the output fails" do
+		tmpdir = Dir.mktmpdir
+		export = PG::ParallelExport.new( conns, "parallel_export_test", key: "id", parts: 10, tmpdir: tmpdir )
+		r, w = IO.pipe
+		r.close
+
+		expect { export.export( w ) }.to raise_error( Errno::EPIPE )
+		expect( Dir.children(tmpdir) ).to be_empty
+		conns.each do |conn|
+			expect( conn.transaction_status ).to eq( PG::PQTRANS_IDLE )
+		end
+	ensure
+		w.close if w
+		FileUtils.rm_rf( tmpdir ) if tmpdir
+	end
+end
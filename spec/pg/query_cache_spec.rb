@@ -0,0 +1,117 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+require 'delegate'
+
+describe PG::QueryCache, :without_transaction do
+	let!(:listen_conn) { PG.connect(@conninfo) }
+	let(:cache) { PG::QueryCache.new( @conn, listen_connection: listen_conn, ttl: 60 ) }
+
+	before :each do
+		@conn.exec( "DROP TABLE IF EXISTS query_cache_test" )
+		@conn.exec( "CREATE TABLE query_cache_test AS SELECT i AS id FROM generate_series(1, 10) i" )
+	end
+
+	after :each do
+		listen_conn.finish unless listen_conn.finished?
+		@conn.exec( "DROP TABLE IF EXISTS query_cache_test" )
+	end
+
+	it "returns the cached result for the same query and parameters" do
+		res1 = cache.exec_params( "SELECT count(*) FROM query_cache_test WHERE id > $1", [5] )
+		res2 = cache.exec_params( "SELECT count(*) FROM query_cache_test WHERE id > $1", [5] )
+		res3 = cache.exec_params( "SELECT count(*) FROM query_cache_test WHERE id > $1", [8] )
+
+		expect( res2 ).to equal( res1 )
+		expect( res3 ).not_to equal( res1 )
+		expect( res3.getvalue(0, 0) ).to eq( "2" )
+		expect( cache.stats ).to include( hits: 1, misses: 2, entries: 2 )
+	end
+
+	it "shares frozen results" do
+		res = cache.exec_params( "SELECT 1" )
+		expect( res ).to be_frozen
+		expect{ res.clear }.to raise_error( FrozenError )
+		expect{ res.type_map = PG::TypeMapAllStrings.new }.to raise_error( FrozenError )
+		expect( res.values ).to eq( [["1"]] )
+	end
+
+	it "doesn't cache failed or non-tuple results" do
+		cache.exec_params( "UPDATE query_cache_test SET id = id" )
+		expect{ cache.exec_params( "SELECT * FROM query_cache_test_nonexistent" ) }.to raise_error( PG::UndefinedTable )
+		expect( cache.size ).to eq( 0 )
+	end
+
+	it "invalidates tagged entries" do
+		sql = "SELECT count(*) FROM query_cache_test"
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "10" )
+		@conn.exec( "DELETE FROM query_cache_test WHERE id > 5" )
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "10" )
+
+		cache.invalidate( "query_cache_test" )
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "5" )
+		expect( cache.stats[:invalidations] ).to eq( 1 )
+	end
+
+	it "invalidates tagged entries per notification" do
+		sql = "SELECT count(*) FROM query_cache_test"
+		cache.exec_params( sql, [], tags: ["query_cache_test"] )
+		@conn.exec( "DELETE FROM query_cache_test WHERE id > 5" )
+		@conn.exec( "NOTIFY pg_query_cache, 'query_cache_test'" )
+		sleep 0.1
+
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "5" )
+	end
+
+	it "doesn't store a result whose tag was invalidated while the query ran" do
+		sql = "SELECT count(*) FROM query_cache_test"
+		conn = SimpleDelegator.new( @conn )
+		cache = PG::QueryCache.new( conn, listen_connection: listen_conn )
+		conn.define_singleton_method( :exec_params ) do |*args|
+			res = __getobj__.exec_params( *args )
+			if res.getvalue( 0, 0 ) == "10"
+				exec( "DELETE FROM query_cache_test WHERE id > 5" )
+				exec( "NOTIFY pg_query_cache, 'query_cache_test'" )
+				sleep 0.1
+				# Another thread consumes the notification before the result is stored.
+				Thread.new { cache.process_notifications }.join
+			end
+			res
+		end
+
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "10" )
+		expect( cache.size ).to eq( 0 )
+		expect( cache.exec_params( sql, [], tags: ["query_cache_test"] ).getvalue(0, 0) ).to eq( "5" )
+	end
+
+	it "evicts the least recently used entries to stay within max_bytes" do
+		res = @conn.exec( "SELECT 1" )
+		cache = PG::QueryCache.new( @conn, max_bytes: (res.memsize + PG::QueryCache::ENTRY_OVERHEAD) * 2 + 10 )
+		cache.exec_params( "SELECT 1" )
+		cache.exec_params( "SELECT 2" )
+		cache.exec_params( "SELECT 1" )
+		cache.exec_params( "SELECT 3" )
+
+		expect( cache.size ).to eq( 2 )
+		expect( cache.stats[:evictions] ).to eq( 1 )
+		expect( cache.bytes ).to be <= cache.max_bytes
+		cache.exec_params( "SELECT 1" )
+		expect( cache.stats[:hits] ).to eq( 2 )
+	end
+
+	it "expires entries after ttl" do
+		cache = PG::QueryCache.new( @conn, ttl: 0.05 )
+		res = cache.exec_params( "SELECT 1" )
+		sleep 0.1
+		expect( cache.exec_params( "SELECT 1" ) ).not_to equal( res )
+	end
+
+	it "bypasses the cache while the listen connection is broken" do
+		cache.exec_params( "SELECT 1" )
+		listen_conn.finish
+		expect( cache.exec_params( "SELECT 1" ).values ).to eq( [["1"]] )
+		expect( cache.size ).to eq( 0 )
+	end
+end
@@ -0,0 +1,234 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+require 'tmpdir'
+require 'stringio'
+require 'rubygems/package'
+
+describe PG::Replication do
+	let!(:relation_message) do
+		["R", 1234, "public\0", "tab\0", "d", 2,
+			1, "id\0", 23, -1,
+			0, "name\0", 25, -1].pack("aNa*a*an" + "Ca*NN" * 2)
+	end
+
+	def tuple_data( *values )
+		[values.size].pack("n") + values.map {|v| v.nil? ? "n" : ["t", v.bytesize, v].pack("aNa*") }.join
+	end
+
+	it "parses XLogData and keepalive messages" do
+		msg = PG::Replication.parse_copy_data( ["w", 0x16B374D848, 0x16B374D900, 0, "Bdata"].pack("aQ>Q>q>a*") )
+		expect( msg ).to eq( type: :xlog_data, wal_start: 0x16B374D848, wal_end: 0x16B374D900, send_time: Time.utc(2000), data: "Bdata" )
+
+		msg = PG::Replication.parse_copy_data( ["k", 123, 0, 1].pack("aQ>q>C") )
+		expect( msg ).to eq( type: :keepalive, wal_end: 123, send_time: Time.utc(2000), reply_requested: true )
+	end
+
+	it "builds standby status updates" do
+		msg = PG::Replication.standby_status_update( 3, 2, 1 )
+		expect( msg.unpack("aQ>Q>Q>q>C").values_at(0, 1, 2, 3, 5) ).to eq( ["r", 3, 2, 1, 0] )
+	end
+
+	it "decodes pgoutput changes per TypeMapByOid" do
+		tm = PG::TypeMapByOid.new
+		tm.add_coder PG::TextDecoder::Integer.new( oid: 23 )
+		decoder = PG::Replication::PgoutputDecoder.new( tm )
+
+		rel = decoder.decode( relation_message )
+		expect( rel ).to include( type: :relation, oid: 1234, namespace: "public", name: "tab" )
+		expect( rel[:columns].map {|c| c[:name] } ).to eq( %w[id name] )
+
+		change = decoder.decode( ["U", 1234, "K"].pack("aNa") + tuple_data("1", nil) + "N" + tuple_data("2", "new") )
+		expect( change ).to include( type: :update, relation: rel, key: true )
+		expect( change[:old] ).to eq( "id" => 1, "name" => nil )
+		expect( change[:new] ).to eq( "id" => 2, "name" => "new" )
+	end
+
+	it "raises an error on changes of unknown relations" do
+		decoder = PG::Replication::PgoutputDecoder.new
+		expect {
+			decoder.decode( ["I", 1234, "N"].pack("aNa") + tuple_data("1", "x") )
+		}.to raise_error( ArgumentError, /relation OID 1234/ )
+	end
+
+	it "streams changes of a publication", :without_transaction do
+		@conn.exec( "DROP TABLE IF EXISTS replication_test" )
+		@conn.exec( "CREATE TABLE replication_test (id INT PRIMARY KEY, name TEXT)" )
+		@conn.exec( "CREATE PUBLICATION replication_test_pub FOR TABLE replication_test" )
+
+		repl = PG::LogicalReplication.new( @conninfo, slot: "replication_test_slot", publications: ["replication_test_pub"],
+			create_slot: true, temporary: true, type_map: PG::BasicTypeMapForResults.new(@conn) )
+		repl.start
+		@conn.exec( "INSERT INTO replication_test VALUES (1, 'one'), (2, 'two')" )
+		@conn.exec( "DELETE FROM replication_test WHERE id=1" )
+
+		changes = []
+		repl.each do |change|
+			changes << change
+			repl.stop if change[:type] == :commit && changes.count {|c| c[:type] == :commit } == 2
+		end
+
+		expect( changes.map {|c| c[:type] } ).to eq( %i[begin relation insert insert commit begin delete commit] )
+		expect( changes[2][:new] ).to eq( "id" => 1, "name" => "one" )
+		expect( changes[6][:old] ).to eq( "id" => 1, "name" => nil )
+		expect( repl.flushed_lsn ).to eq( changes.last[:end_lsn] )
+		expect( repl.connection.transaction_status ).to eq( PG::PQTRANS_IDLE )
+	ensure
+		repl&.close
+		@conn.exec( "DROP PUBLICATION IF EXISTS replication_test_pub" )
+		@conn.exec( "DROP TABLE IF EXISTS replication_test" )
+	end
+
+	it "sends standby status updates while data arrives continuously" do
+		conn = PG.connect( @conninfo )
+		sent = []
+		xlog = ["w", 1, 1, 0, "M"].pack( "aQ>Q>q>a*" )
+		conn.define_singleton_method( :get_copy_data ) {|*| xlog }
+		conn.define_singleton_method( :put_copy_data ) {|data| sent << data }
+		conn.define_singleton_method( :flush ) { true }
+
+		repl = PG::LogicalReplication.new( conn, slot: "s", publications: ["p"], status_interval: 0.05 )
+		repl.instance_variable_set( :@next_status, Process.clock_gettime(Process::CLOCK_MONOTONIC) + 0.05 )
+		deadline = Time.now + 0.3
+		repl.send( :receive ) while Time.now < deadline
+
+		expect( sent.size ).to be_between( 3, 7 )
+		expect( sent.map {|m| m[0] }.uniq ).to eq( ["r"] )
+	ensure
+		conn.finish if conn
+	end
+
+	it "streams WAL segments into a directory", :without_transaction do
+		repl = PG.connect( @conninfo, replication: true )
+		segment_size = repl.send( :wal_segment_size )
+		switcher = Thread.new do
+			loop do
+				@conn.exec( "SELECT txid_current(); SELECT pg_switch_wal()" )
+				sleep 0.2
+			end
+		end
+
+		Dir.mktmpdir do |dir|
+			segment = nil
+			repl.stream_wal( dir, status_interval: 1 ) do |path|
+				segment = path
+				break
+			end
+
+			expect( File.basename(segment) ).to match( /\A\h{24}\z/ )
+			expect( File.size(segment) ).to eq( segment_size )
+			expect( repl.transaction_status ).to eq( PG::PQTRANS_IDLE )
+		end
+	ensure
+		switcher&.kill&.join
+		repl&.finish
+	end
+
+	### Start a server, which sends +data+ as COPY OUT stream in response to any query,
+	### like a server sending a BASE_BACKUP archive. Returns the connection string.
+	def copy_out_server( data )
+		server = TCPServer.new( '127.0.0.1', 0 )
+		@server_thread = Thread.new do
+			sock = server.accept
+			msg = ->(type, body) { sock.write( [type, body.bytesize + 4].pack("aN") + body ) }
+			loop do
+				len, code = sock.read( 8 ).unpack( "NN" )
+				sock.read( len - 8 )
+				# Refuse SSL and GSS encryption requests
+				break unless [80877103, 80877104].include?( code )
+				sock.write( "N" )
+			end
+			msg.( "R", [0].pack("N") )
+			msg.( "S", "client_encoding\0UTF8\0" )
+			msg.( "S", "server_version\00015.0\0" )
+			msg.( "K", [1, 2].pack("NN") )
+			msg.( "Z", "I" )
+			sock.read( 1 )
+			sock.read( sock.read( 4 ).unpack1("N") - 4 )
+			msg.( "H", [0, 0].pack("Cn") )
+			msg.( "d", data )
+			msg.( "c", "" )
+			msg.( "C", "BASE_BACKUP\0" )
+			msg.( "Z", "I" )
+			# Accept the cancel request of a failed transfer.
+			until IO.select( [sock, server] )[0].include?( sock )
+				server.accept.close
+			end
+			sock.read
+		ensure
+			sock&.close
+			server.close
+		end
+		"host=127.0.0.1 port=#{server.addr[1]} sslmode=disable"
+	end
+
+	def tar_archive
+		io = StringIO.new( "".b )
+		Gem::Package::TarWriter.new( io ) {|tar| yield tar }
+		io.string
+	end
+
+	it "refuses symlinks of a hostile archive", if: PG::Connection.method_defined?( :receive_base_backup ) do
+		Dir.mktmpdir do |outside|
+			archive = tar_archive do |tar|
+				tar.add_symlink( "link", outside, 0777 )
+				tar.add_file_simple( "link/passwd", 0644, 3 ) {|f| f.write "pwn" }
+			end
+			conn = PG.connect( copy_out_server(archive) )
+			conn.send_query( "BASE_BACKUP" )
+			expect( conn.get_result.result_status ).to eq( PG::PGRES_COPY_OUT )
+
+			Dir.mktmpdir do |dir|
+				expect {
+					conn.receive_base_backup( dir, true, false, "base.tar" )
+				}.to raise_error( Errno::EINVAL )
+				expect( File.symlink?(File.join(dir, "link")) ).to be false
+			end
+			expect( Dir.children(outside) ).to be_empty
+		ensure
+			conn&.finish
+			@server_thread&.kill&.join
+		end
+	end
+
+	it "links tablespaces of an extracted archive to their copy", if: PG::Connection.method_defined?( :receive_base_backup ) do
+		archive = tar_archive do |tar|
+			tar.add_file_simple( "PG_VERSION", 0600, 3 ) {|f| f.write "15\n" }
+			tar.add_symlink( "pg_tblspc/16400", "/somewhere/else", 0777 )
+		end
+		conn = PG.connect( copy_out_server(archive) )
+		conn.send_query( "BASE_BACKUP" )
+		conn.get_result
+
+		Dir.mktmpdir do |dir|
+			expect( conn.receive_base_backup( dir, true, false, "base.tar" ) ).to eq( ["base.tar"] )
+			expect( File.read(File.join(dir, "PG_VERSION")) ).to eq( "15\n" )
+			expect( File.readlink(File.join(dir, "pg_tblspc/16400")) ).to eq( File.join(dir, "tablespaces/16400") )
+		end
+	ensure
+		conn&.finish
+		@server_thread&.kill&.join
+	end
+
+	it "takes base backups in tar and plain format", :without_transaction do
+		repl = PG.connect( @conninfo, replication: true )
+
+		Dir.mktmpdir do |dir|
+			res = repl.base_backup( dir, label: "pg spec" )
+			expect( res[:archives] ).to include( "base.tar" )
+			expect( res[:timeline] ).to be >= 1
+			expect( File.size(File.join(dir, "base.tar")) ).to be > 0
+		end
+
+		Dir.mktmpdir do |dir|
+			res = repl.base_backup( dir, format: :plain, wal: false )
+			expect( File.read(File.join(dir, "PG_VERSION")).to_i ).to eq( repl.server_version / 10000 )
+			expect( File.directory?(File.join(dir, "global")) ).to be true
+			expect( PG::LogicalReplication.parse_lsn(res[:end_lsn]) ).to be >= PG::LogicalReplication.parse_lsn(res[:start_lsn])
+		end
+	ensure
+		repl&.finish
+	end
+end
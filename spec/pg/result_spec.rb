@@ -633,6 +633,98 @@ describe PG::Result do
 		expect( ObjectSpace.memsize_of(r) ).to be < 100
 	end
 
+	it "reports the memory size of the libpq result" do
+		r = @conn.exec "select repeat('x', 10000)"
+		expect( r.memsize ).to be > 10000
+		expect( r.memsize ).to be <= ObjectSpace.memsize_of(r)
+		r.clear
+		expect( r.memsize ).to eq( 0 )
+	end
+
+	it "can be dumped to binary and loaded again" do
+		r = @conn.exec "SELECT g AS i, repeat('ä', g) AS t, NULL AS n FROM generate_series(1, 100) g"
+		[r.dump_binary, r.dump_binary(compress: true)].each do |data|
+			expect( data.encoding ).to eq( Encoding::BINARY )
+			r2 = PG::Result.load_binary( data, @conn )
+			expect( r2.result_status ).to eq( PG::PGRES_TUPLES_OK )
+			expect( r2.values ).to eq( r.values )
+			expect( r2.fields ).to eq( %w[i t n] )
+			expect( r2.ftype(0) ).to eq( 23 )
+			expect( r2.cmd_status ).to eq( "SELECT 100" )
+			expect( r2.cmd_tuples ).to eq( 100 )
+			expect( r2.getvalue(0, 1).encoding ).to eq( r.getvalue(0, 1).encoding )
+		end
+		expect( r.dump_binary(compress: true).bytesize ).to be < r.dump_binary.bytesize
+
+		r3 = PG::Result.load_binary( r.dump_binary, type_map: PG::TypeMapByColumn.new([PG::TextDecoder::Integer.new, nil, nil]) )
+		expect( r3.column_values(0) ).to eq( (1..100).to_a )
+	end
+
+	it "can be duplicated independently of the original" do
+		r = @conn.exec "SELECT g AS i, 'x' AS t FROM generate_series(1, 10) g"
+		r.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, nil]
+		r.freeze
+		r2 = r.dup
+
+		expect( r2 ).not_to be_frozen
+		expect( r2.type_map ).to eq( r.type_map )
+		expect( r2.values ).to eq( r.values )
+		expect( r2.fields ).to eq( %w[i t] )
+		expect( r2.cmd_tuples ).to eq( 10 )
+		r2.clear
+		expect( r.column_values(0) ).to eq( (1..10).to_a )
+		expect( r.dup.cmd_status ).to eq( "SELECT 10" )
+	end
+
+	it "refuses to load invalid binary data" do
+		data = @conn.exec( "SELECT 1" ).dump_binary
+		expect{ PG::Result.load_binary( data[0..-2] ) }.to raise_error( ArgumentError, /truncated/ )
+		expect{ PG::Result.load_binary( "xyz" ) }.to raise_error( ArgumentError )
+	end
+
+	it "can materialize the values and release the libpq result" do
+		r = @conn.exec "SELECT g AS i, repeat('x', 100) AS t, NULL AS n FROM generate_series(1, 100) g"
+		r.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, nil, nil]
+		tuple = r.tuple(1)
+		expect( tuple[:i] ).to eq( 2 )
+		size = r.memsize
+
+		expect( r.materialize! ).to eq( r )
+		expect( r ).to be_materialized
+		expect( r.memsize ).to be < size / 2
+		expect( r.ntuples ).to eq( 100 )
+		expect( r.cmd_tuples ).to eq( 100 )
+		expect( r.fields ).to eq( %w[i t n] )
+		expect( r.ftype(0) ).to eq( 23 )
+		expect( r.values.first ).to eq( [1, "x" * 100, nil] )
+		expect( r.column_values(0) ).to eq( (1..100).to_a )
+		expect( r.field_values("t").uniq ).to eq( ["x" * 100] )
+		expect( r[99] ).to eq( "i" => 100, "t" => "x" * 100, "n" => nil )
+		expect( r.each_row.to_a.size ).to eq( 100 )
+		expect( r.tuple(2).to_a ).to eq( [["i", 3], ["t", "x" * 100], ["n", nil]] )
+		expect( tuple[:t] ).to eq( "x" * 100 )
+		expect( r.getvalue(0, 1) ).to be_frozen
+		expect( r.getisnull(0, 2) ).to be_truthy
+		expect( r.getisnull(0, 1) ).to be_falsey
+		expect( r.getlength(0, 1) ).to eq( 100 )
+		expect{ r.getlength(0, 0) }.to raise_error( PG::Error, /type casted/ )
+		expect{ r.type_map = PG::TypeMapAllStrings.new }.to raise_error( PG::Error, /materialized/ )
+
+		r.clear
+		expect( r ).not_to be_materialized
+	end
+
+	it "needs less memory after materializing immediate values" do
+		r = @conn.exec "SELECT g AS i, g % 2 = 0 AS b FROM generate_series(1, 1000) g"
+		r.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, PG::TextDecoder::Boolean.new]
+		before = ObjectSpace.memsize_of( r )
+
+		r.materialize!
+		values = ObjectSpace.reachable_objects_from( r ).find {|obj| Array === obj && obj.size == 2000 }
+		expect( values ).to include( 1000, true, false )
+		expect( ObjectSpace.memsize_of(r) + ObjectSpace.memsize_of(values) ).to be < before
+	end
+
 	context 'result value conversions with TypeMapByColumn' do
 		let!(:textdec_int){ PG::TextDecoder::Integer.new name: 'INT4', oid: 23 }
 		let!(:textdec_float){ PG::TextDecoder::Float.new name: 'FLOAT4', oid: 700 }
@@ -678,4 +770,57 @@ describe PG::Result do
 			expect{ res.type_map = 1 }.to raise_error(TypeError)
 		end
 	end
+
+	it "counts decoded values and created objects" do
+		res = @conn.exec( "SELECT 1 AS a, 'abc' AS b FROM generate_series(1,3)" )
+		res.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, nil]
+		expect( res.decode_stats.values.sum ).to eq( 0 )
+
+		res.values
+		stats = res.decode_stats
+		expect( stats ).to include( values: 6, value_objects: 3, string_bytes: 9, arrays: 4 )
+
+		res.each {}
+		res.tuple(0)
+		stats = res.decode_stats
+		expect( stats ).to include( values: 12, fnames: 2, hashes: 4, tuples: 1 )
+	end
+
+	it "retrieves values within an allocation budget" do
+		res = @conn.exec( "SELECT 1 AS a, 'abc' AS b FROM generate_series(1,100)" )
+		res.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, nil]
+		# One Array per row plus the String values
+		expect_allocation_budget( 210 ) { res.values }
+	end
+
+	context "built without a connection" do
+		it "provides fields, types and values" do
+			res = PG::Result.build( ["a", "b"], [23, 25], [["1", "abc"], [nil, "def"]] )
+			expect( res.result_status ).to eq( PG::PGRES_TUPLES_OK )
+			expect( res.fields ).to eq( ["a", "b"] )
+			expect( res.ftype(0) ).to eq( 23 )
+			expect( res.ftype(1) ).to eq( 25 )
+			expect( res.values ).to eq( [["1", "abc"], [nil, "def"]] )
+			expect( res.getisnull(1, 0) ).to be_truthy
+			expect( res.tuple(1).to_h ).to eq( {"a" => nil, "b" => "def"} )
+		end
+
+		it "decodes values through the assigned type map" do
+			res = PG::Result.build( ["i", "b"], [23, 17], [["123", "\x00\xff".b]], [0, 1] )
+			res.type_map = PG::TypeMapByColumn.new [PG::TextDecoder::Integer.new, PG::BinaryDecoder::Bytea.new]
+			expect( res.fformat(1) ).to eq( 1 )
+			expect( res.values ).to eq( [[123, "\x00\xff".b]] )
+		end
+
+		it "can have no rows" do
+			res = PG::Result.build( ["a"], [25], [] )
+			expect( res.ntuples ).to eq( 0 )
+			expect( res.fields ).to eq( ["a"] )
+		end
+
+		it "raises an error on rows with wrong number of values" do
+			expect{ PG::Result.build( ["a", "b"], [23, 25], [["1"]] ) }.to raise_error(ArgumentError)
+			expect{ PG::Result.build( ["a"], [23, 25], [] ) }.to raise_error(ArgumentError)
+		end
+	end
 end
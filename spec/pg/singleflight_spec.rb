@@ -0,0 +1,75 @@
+# -*- rspec -*-
+# encoding: utf-8
+
+require_relative '../helpers'
+require 'pg'
+
+describe PG::Singleflight, :without_transaction do
+	let(:pool) { PG::ConnectionPool.new( @conninfo, size: 5, health_check_interval: nil ) }
+	let(:singleflight) { PG::Singleflight.new( pool ) }
+
+	after :each do
+		pool.shutdown
+	end
+
+	it "runs identical concurrent queries once" do
+		threads = 10.times.map do
+			Thread.new { singleflight.exec_params( "SELECT $1::int, pg_sleep(0.3)", [5] ) }
+		end
+		results = threads.map( &:value )
+
+		expect( singleflight.stats ).to eq( leaders: 1, followers: 9 )
+		expect( results.map {|r| r.getvalue(0, 0) } ).to all( eq("5") )
+		expect( results.map(&:object_id).uniq.size ).to eq( 10 )
+		results.first.clear
+		expect( results.last.getvalue(0, 0) ).to eq( "5" )
+	end
+
+	it "doesn't coalesce queries with different parameters" do
+		threads = 4.times.map do |i|
+			Thread.new { singleflight.exec_params( "SELECT $1::int, pg_sleep(0.1)", [i] ).getvalue(0, 0) }
+		end
+
+		expect( threads.map( &:value ) ).to eq( %w[0 1 2 3] )
+		expect( singleflight.stats ).to eq( leaders: 4, followers: 0 )
+	end
+
+	it "doesn't coalesce consecutive queries" do
+		2.times { singleflight.exec_params( "SELECT 1", [] ) }
+		expect( singleflight.stats ).to eq( leaders: 2, followers: 0 )
+	end
+
+	it "raises the error of the leader to all followers" do
+		threads = 5.times.map do
+			Thread.new do
+				begin
+					singleflight.exec_params( "SELECT pg_sleep(0.3), 1 / $1::int", [0] )
+				rescue PG::DivisionByZero => err
+					err
+				end
+			end
+		end
+
+		expect( threads.map( &:value ) ).to all( be_kind_of(PG::DivisionByZero) )
+		expect( singleflight.stats[:leaders] ).to eq( 1 )
+	end
+
+	it "fails the followers if the leader is killed" do
+		leader = Thread.new { singleflight.exec_params( "SELECT pg_sleep(1)" ) }
+		sleep 0.01 until singleflight.stats[:leaders] == 1
+		followers = 3.times.map do
+			Thread.new do
+				begin
+					singleflight.exec_params( "SELECT pg_sleep(1)" )
+				rescue PG::Singleflight::Aborted => err
+					err
+				end
+			end
+		end
+		sleep 0.01 until singleflight.stats[:followers] == 3
+		leader.kill
+		leader.join
+
+		expect( followers.map( &:value ) ).to all( be_kind_of(PG::Singleflight::Aborted) )
+	end
+end
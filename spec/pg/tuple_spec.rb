@@ -329,5 +329,28 @@ describe PG::Tuple do
 			# should fail due to the second column
 			expect{ t.values }.to raise_error(PG::Error)
 		end
+
+		it "keeps compacted tuples usable" do
+			r = result2x3cast
+			t = r.tuple(1)
+			t[0] # materialize first field only
+			expect( t.compact! ).to eq( t )
+			r.clear
+
+			expect( t[0] ).to eq( 2 )
+			expect( t[1] ).to eq( false )
+			expect( t.values ).to eq( [2, false, "4"] )
+			expect( t.inspect ).to eq('#<PG::Tuple a: 2, b: false, b: "4">')
+		end
+
+		it "releases a result with one tuple" do
+			r = @conn.exec( "VALUES(1, 'a')" )
+			t = r.tuple(0)
+			t.compact!
+			expect( ObjectSpace.reachable_objects_from(t) ).not_to include( r )
+			r.clear
+
+			expect( t.values ).to eq( ["1", "a"] )
+		end
 	end
 end
@@ -1017,6 +1017,79 @@ describe "PG::Type derivations" do
 				end
 			end
 		end
+
+		describe PG::TextEncoder::CsvRow do
+			let!(:encoder) do
+				PG::TextEncoder::CsvRow.new
+			end
+
+			it "should have CSV default values" do
+				expect( encoder.delimiter ).to eq( "," )
+				expect( encoder.null_string ).to eq( "" )
+				expect( encoder.quote ).to eq( '"' )
+				expect( encoder.escape ).to eq( '"' )
+				expect( encoder.force_quote ).to eq( false )
+				expect( encoder.header ).to eq( false )
+			end
+
+			it "should quote values only when necessary" do
+				expect( encoder.encode(["astring", 7, nil, "", "a,b", 'q"x', "l\nm", "c\rr"]) ).
+					to eq( %Q{astring,7,,"","a,b","q""x","l\nm","c\rr"\n} )
+			end
+
+			it "should respect force_quote and escape" do
+				encoder.force_quote = [1]
+				encoder.escape = "\\"
+				expect( encoder.encode(["a", "b", 'c"\\']) ).to eq( %Q{a,"b","c\\"\\\\"\n} )
+				encoder.force_quote = true
+				expect( encoder.encode(["a", nil]) ).to eq( %Q{"a",\n} )
+			end
+
+			it "should encode the header row without type casts" do
+				encoder.header = true
+				encoder.type_map = PG::TypeMapByColumn.new [textenc_int, nil]
+				expect( encoder.encode(["id", "name"]) ).to eq( "id,name\n" )
+				expect( encoder.encode([3, "x"]) ).to eq( "3,x\n" )
+			end
+
+			it "copies all attributes with #dup" do
+				encoder.quote = "'"
+				encoder.force_quote = [0]
+				encoder.header = true
+				encoder2 = encoder.dup
+				expect( encoder2.to_h ).to eq( encoder.to_h )
+				expect( encoder2.delimiter ).to eq( "," )
+			end
+		end
+
+		describe PG::TextDecoder::CsvRow do
+			let!(:decoder) do
+				PG::TextDecoder::CsvRow.new
+			end
+
+			it "should decode quoted and unquoted values" do
+				expect( decoder.decode(%Q{astring,7,,"","a,b","q""x","l\nm"\r\n}) ).
+					to eq( ["astring", "7", nil, "", "a,b", 'q"x', "l\nm"] )
+			end
+
+			it "should respect quote, escape and null_string" do
+				decoder.quote = "'"
+				decoder.escape = "\\"
+				decoder.null_string = "NULL"
+				expect( decoder.decode(%Q{'a\\'b',NULL,'NULL'\n}) ).to eq( ["a'b", nil, "NULL"] )
+			end
+
+			it "should decode the header row without type casts" do
+				decoder.header = true
+				decoder.type_map = PG::TypeMapByColumn.new [textdec_int, textdec_string]
+				expect( decoder.decode("id,name\n") ).to eq( ["id", "name"] )
+				expect( decoder.decode("3,x\n") ).to eq( [3, "x"] )
+			end
+
+			it "should raise an error on unterminated quotes" do
+				expect{ decoder.decode(%Q{a,"b\n}) }.to raise_error(ArgumentError, /unterminated/)
+			end
+		end
 	end
 
 	describe PG::RecordCoder do